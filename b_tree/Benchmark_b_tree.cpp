@@ -0,0 +1,93 @@
+#include "b_tree.h"
+#include "../red_black_tree/red_black_tree.h"
+
+#include<iostream>
+#include<vector>
+#include<random>
+#include<chrono>
+#include<algorithm>
+
+using std::cout;
+
+template<typename F>
+double time_ms(F&& work) {
+	auto t0 = std::chrono::steady_clock::now();
+	work();
+	auto t1 = std::chrono::steady_clock::now();
+	double result = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	return result;
+}
+
+std::vector<int> generate_keys(int count, unsigned seed, int max_key = 0x7fff'ffff) {
+	std::mt19937 gen{seed};
+	std::uniform_int_distribution<> dist{0, max_key};
+	std::vector<int> result(count);
+	for (int& key : result) {
+		key = dist(gen);
+	}
+	return result;
+}
+
+
+/*
+  random inserts, random lookups (half of them hits), a full in-order scan and random removals.
+  times are per operation, the scan is per key.
+*/
+template<typename Tree>
+void bench_tree(const char *name, const std::vector<int>& keys, const std::vector<int>& lookups) {
+	Tree tree;
+	double insert_ms = time_ms([&]() {
+		for (int key : keys) {
+			tree.add(key);
+		}
+	});
+
+	int found = 0;
+	double lookup_ms = time_ms([&]() {
+		for (int key : lookups) {
+			found += tree.find(key) != tree.end();
+		}
+	});
+
+	long long sum = 0;
+	double scan_ms = time_ms([&]() {
+		for (int key : tree) {
+			sum += key;
+		}
+	});
+
+	cout << name << "\t" << keys.size() << "\t" << insert_ms * 1e6 / keys.size() << "\t"
+		 << lookup_ms * 1e6 / lookups.size() << "\t" << scan_ms * 1e6 / keys.size() << "\t" << found << "\n";
+
+	tree.clear();
+	return;
+}
+
+void bench_b_tree_vs_red_black_tree() {
+	int sizes[] = {100'000, 1'000'000, 10'000'000};
+
+	cout << "\nbench: b-tree vs red-black tree\n";
+	cout << "tree\tkeys\tinsert_ns\tlookup_ns\tscan_ns\tfound\n";
+
+	for (int size : sizes) {
+		std::vector<int> keys = generate_keys(size, 33);
+		std::vector<int> lookups = generate_keys(1'000'000, 34);
+		for (int i = 0 ; i < (int)lookups.size() ; i += 2) {
+			lookups[i] = keys[lookups[i] % size];
+		}
+
+		bench_tree<RedBlackTree<int>>("red_black", keys, lookups);
+		bench_tree<BTree<int, 16>>("b_tree_16", keys, lookups);
+		bench_tree<BTree<int, 32>>("b_tree_32", keys, lookups);
+		bench_tree<BTree<int, 64>>("b_tree_64", keys, lookups);
+	}
+
+	return;
+}
+
+
+int main() {
+	bench_b_tree_vs_red_black_tree();
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+#include "b_tree.h"
+
+#include<iostream>
+#include<string>
+#include<vector>
+#include<set>
+#include<random>
+#include<algorithm>
+
+using std::cout;
+
+/**
+ *  checks the B+ tree invariants of the subtree: keys sorted, separators bound their children,
+ *  every node but the root at least half full, all leaves at the same depth.
+ *  @return depth of the leaves, -1 if an invariant is broken
+ */
+template<typename Tree>
+int test_helper_b_tree_depth(const typename Tree::Node *node, bool is_root, const int *low, const int *high) {
+	if ((!is_root && node->count < Tree::min_keys) || node->count > (int)std::size(node->keys)) {
+		return -1;
+	}
+	for (int i = 0 ; i < node->count ; ++i) {
+		if (i > 0 && !(node->keys[i - 1] < node->keys[i])) return -1;
+		if (low && node->keys[i] < *low) return -1;
+		if (high && !(node->keys[i] < *high)) return -1;
+	}
+	if (node->is_leaf) {
+		return 1;
+	}
+
+	auto inner = static_cast<const typename Tree::Inner *>(node);
+	int depth = -1;
+	for (int i = 0 ; i <= inner->count ; ++i) {
+		const int *child_low = (i > 0) ? &inner->keys[i - 1] : low;
+		const int *child_high = (i < inner->count) ? &inner->keys[i] : high;
+		int child_depth = test_helper_b_tree_depth<Tree>(inner->children[i], false, child_low, child_high);
+		if (child_depth < 0 || (depth >= 0 && child_depth != depth)) {
+			return -1;
+		}
+		depth = child_depth;
+	}
+	return depth + 1;
+}
+
+template<typename Tree>
+bool test_helper_b_tree_matches(const Tree& tree, const std::set<int>& expected) {
+	if (tree.size() != (int)expected.size()) {
+		return false;
+	}
+	if (tree.root && test_helper_b_tree_depth<Tree>(tree.root, true, nullptr, nullptr) < 0) {
+		return false;
+	}
+	bool OK = std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+	OK &= std::equal(std::make_reverse_iterator(tree.end()), std::make_reverse_iterator(tree.begin()), expected.rbegin(), expected.rend());
+	return OK;
+}
+
+
+void test_01() {
+	bool OK = true;
+	BTree<int, 4> tree;
+	std::set<int> expected;
+
+	std::mt19937 gen{1};
+	std::uniform_int_distribution<> dist{0, 2000};
+	for (int i = 0 ; i < 3000 ; ++i) {
+		int key = dist(gen);
+		OK &= tree.add(key) == expected.insert(key).second;
+	}
+	OK &= test_helper_b_tree_matches(tree, expected);
+	OK &= tree.height() > 3;
+
+	for (int i = 0 ; i < 3000 ; ++i) {
+		int key = dist(gen);
+		OK &= tree.remove(key) == (expected.erase(key) == 1);
+		if (i % 100 == 0) {
+			OK &= test_helper_b_tree_matches(tree, expected);
+		}
+	}
+	OK &= test_helper_b_tree_matches(tree, expected);
+
+	for (int key : std::vector<int>(expected.begin(), expected.end())) {
+		OK &= tree.remove(key);
+	}
+	OK &= tree.size() == 0 && tree.root == nullptr && tree.begin() == tree.end();
+
+	cout << "\ntest: b-tree random add and remove against std::set, 4 keys per node\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+
+	return;
+}
+
+void test_02() {
+	bool OK = true;
+	BTree<int> tree;
+	std::set<int> expected;
+
+	std::mt19937 gen{2};
+	std::uniform_int_distribution<> dist{0, 100'000};
+	for (int i = 0 ; i < 50'000 ; ++i) {
+		int key = dist(gen);
+		tree.add(key);
+		expected.insert(key);
+	}
+	OK &= test_helper_b_tree_matches(tree, expected);
+
+	for (int i = 0 ; i < 2000 ; ++i) {
+		int key = dist(gen);
+		OK &= tree.contains(key) == expected.contains(key);
+
+		auto low = tree.lower_bound(key);
+		auto expected_low = expected.lower_bound(key);
+		OK &= (low == tree.end()) == (expected_low == expected.end());
+		if (low != tree.end() && expected_low != expected.end()) OK &= *low == *expected_low;
+
+		auto high = tree.upper_bound(key);
+		auto expected_high = expected.upper_bound(key);
+		OK &= (high == tree.end()) == (expected_high == expected.end());
+		if (high != tree.end() && expected_high != expected.end()) OK &= *high == *expected_high;
+
+		auto [first, last] = tree.equal_range(key);
+		OK &= std::distance(first, last) == (int)expected.count(key);
+	}
+
+	cout << "\ntest: b-tree find, lower_bound, upper_bound, equal_range with " << btree_default_node_keys<int> << " keys per node, height " << tree.height() << "\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+
+	return;
+}
+
+void test_03() {
+	bool OK = true;
+
+	for (int count : {0, 1, 4, 5, 9, 10, 63, 64, 65, 1000, 12345}) {
+		std::vector<int> keys;
+		for (int i = 0 ; i < count ; ++i) {
+			keys.push_back(2 * i);
+			if (i % 7 == 0) keys.push_back(2 * i);
+		}
+		BTree<int, 4> small{keys.begin(), keys.end()};
+		BTree<int> large{keys.begin(), keys.end()};
+		std::set<int> expected{keys.begin(), keys.end()};
+
+		OK &= test_helper_b_tree_matches(small, expected);
+		OK &= test_helper_b_tree_matches(large, expected);
+
+		for (int i = 0 ; i < count ; i += 3) {
+			small.add(2 * i + 1);
+			small.remove(2 * i);
+			expected.insert(2 * i + 1);
+			expected.erase(2 * i);
+		}
+		OK &= test_helper_b_tree_matches(small, expected);
+	}
+
+	cout << "\ntest: b-tree bulk build from sorted keys, then edits\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+
+	return;
+}
+
+void test_04() {
+	bool OK = true;
+	BTree<std::string, 4> tree;
+
+	const char *words[] = {"pear", "apple", "fig", "kiwi", "plum", "date", "lime", "apple", "yuzu"};
+	for (const char *word : words) {
+		tree.add(word);
+	}
+	OK &= tree.size() == 8;
+	OK &= *tree.begin() == "apple" && *--tree.end() == "yuzu";
+	OK &= tree.contains(std::string("fig")) && !tree.contains(std::string("grape"));
+	OK &= *tree.lower_bound(std::string("grape")) == "kiwi";
+
+	BTree<int, 8, std::compare_three_way> ascending;
+	for (int i = 100 ; i > 0 ; --i) {
+		ascending.add(i);
+	}
+	int expected = 1;
+	for (int key : ascending) {
+		OK &= key == expected++;
+	}
+
+	cout << "\ntest: b-tree with string keys and descending inserts\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+
+	return;
+}
+
+
+int main() {
+	test_01();
+	test_02();
+	test_03();
+	test_04();
+
+	return 0;
+}
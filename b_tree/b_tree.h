@@ -0,0 +1,737 @@
+#ifndef B_TREE_H
+#define B_TREE_H
+
+#include<cstdio>
+#include<cstddef>
+#include<compare>
+#include<functional>
+#include<iterator>
+#include<utility>
+#include<vector>
+
+/*
+  ordered set with the same interface as RedBlackTree, stored as a B+ tree.
+  RedBlackTree simulates a 2-3-4 tree with up to three binary nodes per logical node, so every level
+  of the logical tree can cost several cache misses. here a node holds up to node_keys keys in
+  contiguous, cache-line aligned memory, and a lookup touches one node per level.
+  all keys live in the leaves, inner nodes only route. leaves are linked for iteration.
+*/
+
+//keys of one node fill about four cache lines: 64 ints, 32 doubles. never fewer than 4
+template<typename Tval>
+constexpr int btree_default_node_keys = (256 / sizeof(Tval) < 4) ? 4 : (256 / sizeof(Tval) > 64) ? 64 : int(256 / sizeof(Tval));
+
+template<typename Tval, int node_keys = btree_default_node_keys<Tval>, typename Compare = std::compare_three_way>
+struct BTree {
+	static_assert(node_keys >= 4, "a node must hold at least 4 keys");
+
+	//every node but the root holds at least min_keys keys
+	static constexpr int min_keys = node_keys / 2;
+
+	struct alignas(64) Node {
+		int count = 0;
+		bool is_leaf = true;
+		Tval keys[node_keys];
+	};
+
+	struct Leaf : Node {
+		Leaf *prev = nullptr;
+		Leaf *next = nullptr;
+	};
+
+	//children[i] holds the keys in [keys[i-1], keys[i])
+	struct Inner : Node {
+		Node *children[node_keys + 1];
+	};
+
+	struct iterator {
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = Tval;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Tval*;
+		using reference = const Tval&;
+
+		Leaf *leaf = nullptr; //nullptr means end()
+		int index = 0;
+		const BTree *tree = nullptr;
+
+		reference operator*() const { return leaf->keys[index]; }
+		pointer operator->() const { return &leaf->keys[index]; }
+
+		iterator& operator++() {
+			++index;
+			if (index == leaf->count) {
+				leaf = leaf->next;
+				index = 0;
+			}
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator before = *this;
+			++*this;
+			return before;
+		}
+
+		iterator& operator--() {
+			if (!leaf) {
+				leaf = tree->last_leaf();
+				index = leaf->count - 1;
+			} else if (index == 0) {
+				leaf = leaf->prev;
+				index = leaf->count - 1;
+			} else {
+				--index;
+			}
+			return *this;
+		}
+
+		iterator operator--(int) {
+			iterator before = *this;
+			--*this;
+			return before;
+		}
+
+		bool operator==(const iterator& other) const {
+			return leaf == other.leaf && index == other.index;
+		}
+	};
+	using const_iterator = iterator;
+
+	Node *root = nullptr;
+	int key_count = 0;
+
+	bool add(const Tval& new_val);
+	bool remove(const Tval& target_key);
+	template<std::forward_iterator It>
+	void assign_sorted(It first, It last);
+	void clear();
+
+	template<typename Tkey = Tval>
+	iterator find(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	bool contains(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	iterator lower_bound(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	iterator upper_bound(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	std::pair<iterator, iterator> equal_range(const Tkey& target_key) const;
+
+	int size() const { return key_count; }
+	int height() const;
+	iterator begin() const;
+	iterator end() const;
+
+	template<typename A, typename B>
+	static auto order(const A& a, const B& b) { return Compare{}(a, b); }
+
+	template<typename A, typename B>
+	static bool is_less(const A& a, const B& b) { return order(a, b) < 0; }
+
+	template<typename Tkey>
+	static int lower_index(const Node *node, const Tkey& target_key);
+	template<typename Tkey>
+	static int upper_index(const Node *node, const Tkey& target_key);
+	template<typename Tkey>
+	Leaf *find_leaf(const Tkey& target_key) const;
+	Leaf *first_leaf() const;
+	Leaf *last_leaf() const;
+
+	bool insert_into(Node *node, const Tval& new_val, Tval *split_key, Node **split_node);
+	bool remove_from(Node *node, const Tval& target_key);
+	void fix_underflow(Inner *parent, int child_index);
+	static void delete_subtree(Node *node);
+
+	BTree()
+	{}
+
+	template<std::forward_iterator It>
+	BTree(It first, It last)
+	{
+		assign_sorted(first, last);
+	}
+
+	BTree(const BTree&) = delete;
+	BTree& operator=(const BTree&) = delete;
+
+	BTree(BTree&& other)
+	: root{other.root}, key_count{other.key_count}
+	{
+		other.root = nullptr;
+		other.key_count = 0;
+	}
+
+	~BTree() {
+		clear();
+	}
+};
+
+
+/**
+ *  @return first index whose key is not less than target_key, or node->count.
+ *  branch-free binary search: the loop runs log2(count) times no matter where the key is,
+ *  and the compiler turns the step into a conditional move.
+ */
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+int BTree<Tval, node_keys, Compare>::lower_index(const Node *node, const Tkey& target_key) {
+	int count = node->count;
+	if (count == 0) {
+		return 0;
+	}
+	const Tval *base = node->keys;
+	while (count > 1) {
+		int half = count / 2;
+		base = is_less(base[half - 1], target_key) ? base + half : base;
+		count -= half;
+	}
+	int result = int(base - node->keys) + (is_less(*base, target_key) ? 1 : 0);
+	return result;
+}
+
+/**
+ *  @return first index whose key is greater than target_key, or node->count
+ */
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+int BTree<Tval, node_keys, Compare>::upper_index(const Node *node, const Tkey& target_key) {
+	int count = node->count;
+	if (count == 0) {
+		return 0;
+	}
+	const Tval *base = node->keys;
+	while (count > 1) {
+		int half = count / 2;
+		base = !is_less(target_key, base[half - 1]) ? base + half : base;
+		count -= half;
+	}
+	int result = int(base - node->keys) + (!is_less(target_key, *base) ? 1 : 0);
+	return result;
+}
+
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+BTree<Tval, node_keys, Compare>::Leaf *BTree<Tval, node_keys, Compare>::find_leaf(const Tkey& target_key) const {
+	Node *current = root;
+	if (!current) {
+		return nullptr;
+	}
+	while (!current->is_leaf) {
+		Inner *inner = static_cast<Inner *>(current);
+		current = inner->children[upper_index(inner, target_key)];
+	}
+	return static_cast<Leaf *>(current);
+}
+
+template<typename Tval, int node_keys, typename Compare>
+BTree<Tval, node_keys, Compare>::Leaf *BTree<Tval, node_keys, Compare>::first_leaf() const {
+	Node *current = root;
+	if (!current) {
+		return nullptr;
+	}
+	while (!current->is_leaf) {
+		current = static_cast<Inner *>(current)->children[0];
+	}
+	return static_cast<Leaf *>(current);
+}
+
+template<typename Tval, int node_keys, typename Compare>
+BTree<Tval, node_keys, Compare>::Leaf *BTree<Tval, node_keys, Compare>::last_leaf() const {
+	Node *current = root;
+	if (!current) {
+		return nullptr;
+	}
+	while (!current->is_leaf) {
+		current = static_cast<Inner *>(current)->children[current->count];
+	}
+	return static_cast<Leaf *>(current);
+}
+
+template<typename Tval, int node_keys, typename Compare>
+int BTree<Tval, node_keys, Compare>::height() const {
+	int result = 0;
+	for (Node *current = root ; current ; ) {
+		++result;
+		current = current->is_leaf ? nullptr : static_cast<Inner *>(current)->children[0];
+	}
+	return result;
+}
+
+template<typename Tval, int node_keys, typename Compare>
+BTree<Tval, node_keys, Compare>::iterator BTree<Tval, node_keys, Compare>::begin() const {
+	Leaf *leaf = first_leaf();
+	iterator result{(leaf && leaf->count > 0) ? leaf : nullptr, 0, this};
+	return result;
+}
+
+template<typename Tval, int node_keys, typename Compare>
+BTree<Tval, node_keys, Compare>::iterator BTree<Tval, node_keys, Compare>::end() const {
+	iterator result{nullptr, 0, this};
+	return result;
+}
+
+/**
+ *  @return first key not less than target_key
+ */
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+BTree<Tval, node_keys, Compare>::iterator BTree<Tval, node_keys, Compare>::lower_bound(const Tkey& target_key) const {
+	Leaf *leaf = find_leaf(target_key);
+	if (!leaf) {
+		return end();
+	}
+	int index = lower_index(leaf, target_key);
+	if (index == leaf->count) {
+		//separators only route, the next larger key may be the first one of the next leaf
+		leaf = leaf->next;
+		index = 0;
+	}
+	iterator result{leaf, index, this};
+	return result;
+}
+
+/**
+ *  @return first key greater than target_key
+ */
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+BTree<Tval, node_keys, Compare>::iterator BTree<Tval, node_keys, Compare>::upper_bound(const Tkey& target_key) const {
+	Leaf *leaf = find_leaf(target_key);
+	if (!leaf) {
+		return end();
+	}
+	int index = upper_index(leaf, target_key);
+	if (index == leaf->count) {
+		leaf = leaf->next;
+		index = 0;
+	}
+	iterator result{leaf, index, this};
+	return result;
+}
+
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+std::pair<typename BTree<Tval, node_keys, Compare>::iterator, typename BTree<Tval, node_keys, Compare>::iterator> BTree<Tval, node_keys, Compare>::equal_range(const Tkey& target_key) const {
+	std::pair<iterator, iterator> result{lower_bound(target_key), upper_bound(target_key)};
+	return result;
+}
+
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+BTree<Tval, node_keys, Compare>::iterator BTree<Tval, node_keys, Compare>::find(const Tkey& target_key) const {
+	Leaf *leaf = find_leaf(target_key);
+	if (leaf) {
+		int index = lower_index(leaf, target_key);
+		if (index < leaf->count && order(leaf->keys[index], target_key) == 0) {
+			iterator result{leaf, index, this};
+			return result;
+		}
+	}
+	return end();
+}
+
+template<typename Tval, int node_keys, typename Compare>
+template<typename Tkey>
+bool BTree<Tval, node_keys, Compare>::contains(const Tkey& target_key) const {
+	bool result = find(target_key) != end();
+	return result;
+}
+
+
+/**
+ *  inserts into the subtree of node. if node had to split, the new right half goes to *split_node
+ *  and the smallest key routed to it to *split_key, for the caller to add to the parent.
+ *  @return false if new_val already exists
+ */
+template<typename Tval, int node_keys, typename Compare>
+bool BTree<Tval, node_keys, Compare>::insert_into(Node *node, const Tval& new_val, Tval *split_key, Node **split_node) {
+	*split_node = nullptr;
+
+	if (node->is_leaf) {
+		Leaf *leaf = static_cast<Leaf *>(node);
+		int index = lower_index(leaf, new_val);
+		if (index < leaf->count && order(leaf->keys[index], new_val) == 0) {
+			return false;
+		}
+
+		if (leaf->count == node_keys) {
+			Leaf *right = new Leaf{};
+			int keep = (node_keys + 1) / 2;
+			right->count = node_keys - keep;
+			for (int i = 0 ; i < right->count ; ++i) {
+				right->keys[i] = leaf->keys[keep + i];
+			}
+			leaf->count = keep;
+
+			right->next = leaf->next;
+			right->prev = leaf;
+			if (leaf->next) leaf->next->prev = right;
+			leaf->next = right;
+
+			if (index > keep) {
+				leaf = right;
+				index -= keep;
+			}
+			*split_node = right;
+		}
+
+		for (int i = leaf->count ; i > index ; --i) {
+			leaf->keys[i] = leaf->keys[i - 1];
+		}
+		leaf->keys[index] = new_val;
+		++leaf->count;
+
+		if (*split_node) {
+			*split_key = static_cast<Leaf *>(*split_node)->keys[0];
+		}
+		return true;
+	}
+
+	Inner *inner = static_cast<Inner *>(node);
+	int child_index = upper_index(inner, new_val);
+
+	Tval child_split_key{};
+	Node *child_split = nullptr;
+	bool inserted = insert_into(inner->children[child_index], new_val, &child_split_key, &child_split);
+	if (!child_split) {
+		return inserted;
+	}
+
+	//the child split: its right half goes in at child_index + 1
+	if (inner->count == node_keys) {
+		//split first. the middle key moves up, it isn't kept in either half
+		Inner *right = new Inner{};
+		right->is_leaf = false;
+
+		Tval all_keys[node_keys + 1];
+		Node *all_children[node_keys + 2];
+		for (int i = 0, from = 0 ; i <= node_keys ; ++i) {
+			all_keys[i] = (i == child_index) ? child_split_key : inner->keys[from++];
+		}
+		for (int i = 0, from = 0 ; i <= node_keys + 1 ; ++i) {
+			all_children[i] = (i == child_index + 1) ? child_split : inner->children[from++];
+		}
+
+		int middle = (node_keys + 1) / 2;
+		inner->count = middle;
+		for (int i = 0 ; i < middle ; ++i) {
+			inner->keys[i] = all_keys[i];
+			inner->children[i] = all_children[i];
+		}
+		inner->children[middle] = all_children[middle];
+
+		right->count = node_keys - middle;
+		for (int i = 0 ; i < right->count ; ++i) {
+			right->keys[i] = all_keys[middle + 1 + i];
+			right->children[i] = all_children[middle + 1 + i];
+		}
+		right->children[right->count] = all_children[node_keys + 1];
+
+		*split_key = all_keys[middle];
+		*split_node = right;
+		return inserted;
+	}
+
+	for (int i = inner->count ; i > child_index ; --i) {
+		inner->keys[i] = inner->keys[i - 1];
+		inner->children[i + 1] = inner->children[i];
+	}
+	inner->keys[child_index] = child_split_key;
+	inner->children[child_index + 1] = child_split;
+	++inner->count;
+
+	return inserted;
+}
+
+/**
+ *  @return false if new_val already exists
+ */
+template<typename Tval, int node_keys, typename Compare>
+bool BTree<Tval, node_keys, Compare>::add(const Tval& new_val) {
+	if (!root) {
+		root = new Leaf{};
+	}
+
+	Tval split_key{};
+	Node *split_node = nullptr;
+	bool inserted = insert_into(root, new_val, &split_key, &split_node);
+
+	if (split_node) {
+		Inner *new_root = new Inner{};
+		new_root->is_leaf = false;
+		new_root->count = 1;
+		new_root->keys[0] = split_key;
+		new_root->children[0] = root;
+		new_root->children[1] = split_node;
+		root = new_root;
+	}
+
+	if (inserted) {
+		++key_count;
+	}
+	return inserted;
+}
+
+
+/**
+ *  children[child_index] of parent fell below min_keys.
+ *  borrow a key from a sibling that can spare one, otherwise merge with a sibling.
+ */
+template<typename Tval, int node_keys, typename Compare>
+void BTree<Tval, node_keys, Compare>::fix_underflow(Inner *parent, int child_index) {
+	Node *child = parent->children[child_index];
+	Node *left = (child_index > 0) ? parent->children[child_index - 1] : nullptr;
+	Node *right = (child_index < parent->count) ? parent->children[child_index + 1] : nullptr;
+
+	if (child->is_leaf) {
+		Leaf *leaf = static_cast<Leaf *>(child);
+
+		if (left && left->count > min_keys) {
+			for (int i = leaf->count ; i > 0 ; --i) {
+				leaf->keys[i] = leaf->keys[i - 1];
+			}
+			leaf->keys[0] = left->keys[left->count - 1];
+			++leaf->count;
+			--left->count;
+			parent->keys[child_index - 1] = leaf->keys[0];
+
+		} else if (right && right->count > min_keys) {
+			leaf->keys[leaf->count++] = right->keys[0];
+			for (int i = 0 ; i < right->count - 1 ; ++i) {
+				right->keys[i] = right->keys[i + 1];
+			}
+			--right->count;
+			parent->keys[child_index] = right->keys[0];
+
+		} else {
+			//merge the right one of the pair into the left one
+			int left_index = left ? child_index - 1 : child_index;
+			Leaf *keep = static_cast<Leaf *>(parent->children[left_index]);
+			Leaf *gone = static_cast<Leaf *>(parent->children[left_index + 1]);
+
+			for (int i = 0 ; i < gone->count ; ++i) {
+				keep->keys[keep->count + i] = gone->keys[i];
+			}
+			keep->count += gone->count;
+			keep->next = gone->next;
+			if (gone->next) gone->next->prev = keep;
+
+			for (int i = left_index ; i < parent->count - 1 ; ++i) {
+				parent->keys[i] = parent->keys[i + 1];
+				parent->children[i + 1] = parent->children[i + 2];
+			}
+			--parent->count;
+			delete gone;
+		}
+		return;
+	}
+
+	Inner *inner = static_cast<Inner *>(child);
+
+	if (left && left->count > min_keys) {
+		Inner *from = static_cast<Inner *>(left);
+		for (int i = inner->count ; i > 0 ; --i) {
+			inner->keys[i] = inner->keys[i - 1];
+		}
+		for (int i = inner->count + 1 ; i > 0 ; --i) {
+			inner->children[i] = inner->children[i - 1];
+		}
+		//rotate through the parent: its separator comes down, the sibling's last key goes up
+		inner->keys[0] = parent->keys[child_index - 1];
+		inner->children[0] = from->children[from->count];
+		++inner->count;
+		parent->keys[child_index - 1] = from->keys[from->count - 1];
+		--from->count;
+
+	} else if (right && right->count > min_keys) {
+		Inner *from = static_cast<Inner *>(right);
+		inner->keys[inner->count] = parent->keys[child_index];
+		inner->children[inner->count + 1] = from->children[0];
+		++inner->count;
+		parent->keys[child_index] = from->keys[0];
+
+		for (int i = 0 ; i < from->count - 1 ; ++i) {
+			from->keys[i] = from->keys[i + 1];
+		}
+		for (int i = 0 ; i < from->count ; ++i) {
+			from->children[i] = from->children[i + 1];
+		}
+		--from->count;
+
+	} else {
+		int left_index = left ? child_index - 1 : child_index;
+		Inner *keep = static_cast<Inner *>(parent->children[left_index]);
+		Inner *gone = static_cast<Inner *>(parent->children[left_index + 1]);
+
+		//the separator between the two comes down between their keys
+		keep->keys[keep->count] = parent->keys[left_index];
+		for (int i = 0 ; i < gone->count ; ++i) {
+			keep->keys[keep->count + 1 + i] = gone->keys[i];
+		}
+		for (int i = 0 ; i <= gone->count ; ++i) {
+			keep->children[keep->count + 1 + i] = gone->children[i];
+		}
+		keep->count += 1 + gone->count;
+
+		for (int i = left_index ; i < parent->count - 1 ; ++i) {
+			parent->keys[i] = parent->keys[i + 1];
+			parent->children[i + 1] = parent->children[i + 2];
+		}
+		--parent->count;
+		delete gone;
+	}
+	return;
+}
+
+/**
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, int node_keys, typename Compare>
+bool BTree<Tval, node_keys, Compare>::remove_from(Node *node, const Tval& target_key) {
+	if (node->is_leaf) {
+		int index = lower_index(node, target_key);
+		if (index == node->count || order(node->keys[index], target_key) != 0) {
+			return false;
+		}
+		for (int i = index ; i < node->count - 1 ; ++i) {
+			node->keys[i] = node->keys[i + 1];
+		}
+		--node->count;
+		//NOTE: a separator equal to the removed key may stay behind in an inner node. it still routes correctly.
+		return true;
+	}
+
+	Inner *inner = static_cast<Inner *>(node);
+	int child_index = upper_index(inner, target_key);
+	bool removed = remove_from(inner->children[child_index], target_key);
+	if (removed && inner->children[child_index]->count < min_keys) {
+		fix_underflow(inner, child_index);
+	}
+	return removed;
+}
+
+/**
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, int node_keys, typename Compare>
+bool BTree<Tval, node_keys, Compare>::remove(const Tval& target_key) {
+	if (!root) {
+		return false;
+	}
+
+	bool removed = remove_from(root, target_key);
+
+	if (!root->is_leaf && root->count == 0) {
+		Inner *old_root = static_cast<Inner *>(root);
+		root = old_root->children[0];
+		delete old_root;
+	} else if (root->is_leaf && root->count == 0) {
+		delete static_cast<Leaf *>(root);
+		root = nullptr;
+	}
+
+	if (removed) {
+		--key_count;
+	}
+	return removed;
+}
+
+
+template<typename Tval, int node_keys, typename Compare>
+void BTree<Tval, node_keys, Compare>::delete_subtree(Node *node) {
+	if (node->is_leaf) {
+		delete static_cast<Leaf *>(node);
+		return;
+	}
+	Inner *inner = static_cast<Inner *>(node);
+	for (int i = 0 ; i <= inner->count ; ++i) {
+		delete_subtree(inner->children[i]);
+	}
+	delete inner;
+	return;
+}
+
+template<typename Tval, int node_keys, typename Compare>
+void BTree<Tval, node_keys, Compare>::clear() {
+	if (root) {
+		delete_subtree(root);
+	}
+	root = nullptr;
+	key_count = 0;
+	return;
+}
+
+/**
+ *  replaces the contents with the sorted keys in [first, last). duplicates are skipped.
+ *  builds the levels bottom-up in linear time. keys are spread evenly, so every node
+ *  holds at least min_keys keys.
+ */
+template<typename Tval, int node_keys, typename Compare>
+template<std::forward_iterator It>
+void BTree<Tval, node_keys, Compare>::assign_sorted(It first, It last) {
+	clear();
+
+	std::vector<Tval> keys;
+	for (It cur = first ; cur != last ; ++cur) {
+		if (keys.empty() || is_less(keys.back(), *cur)) {
+			keys.push_back(*cur);
+		}
+	}
+	if (keys.empty()) {
+		return;
+	}
+
+	//level by level: the nodes of the level and the smallest key below each of them
+	std::vector<Node *> level;
+	std::vector<Tval> level_min;
+
+	int count = (int)keys.size();
+	int leaf_count = (count + node_keys - 1) / node_keys;
+	Leaf *previous = nullptr;
+	for (int i = 0, taken = 0 ; i < leaf_count ; ++i) {
+		int take = (count - taken) / (leaf_count - i);
+		Leaf *leaf = new Leaf{};
+		for (int k = 0 ; k < take ; ++k) {
+			leaf->keys[k] = keys[taken + k];
+		}
+		leaf->count = take;
+		leaf->prev = previous;
+		if (previous) previous->next = leaf;
+		previous = leaf;
+
+		level.push_back(leaf);
+		level_min.push_back(keys[taken]);
+		taken += take;
+	}
+
+	while (level.size() > 1) {
+		std::vector<Node *> parents;
+		std::vector<Tval> parents_min;
+
+		int child_count = (int)level.size();
+		int parent_count = (child_count + node_keys) / (node_keys + 1);
+		for (int i = 0, taken = 0 ; i < parent_count ; ++i) {
+			int take = (child_count - taken) / (parent_count - i);
+			Inner *inner = new Inner{};
+			inner->is_leaf = false;
+			inner->count = take - 1;
+			for (int k = 0 ; k < take ; ++k) {
+				inner->children[k] = level[taken + k];
+				if (k > 0) inner->keys[k - 1] = level_min[taken + k];
+			}
+			parents.push_back(inner);
+			parents_min.push_back(level_min[taken]);
+			taken += take;
+		}
+
+		level.swap(parents);
+		level_min.swap(parents_min);
+	}
+
+	root = level[0];
+	key_count = count;
+	return;
+}
+
+#endif //B_TREE_H
@@ -0,0 +1,1147 @@
+#include "red_black_tree.h"
+#include "compact_red_black_tree.h"
+#include "concurrent_red_black_tree.h"
+#include "persistent_red_black_tree.h"
+#include "mapped_red_black_tree.h"
+#include "frozen_red_black_tree.h"
+#include "sharded_red_black_tree.h"
+#include "buffered_red_black_tree.h"
+
+#include<iostream>
+#include<vector>
+#include<random>
+#include<chrono>
+#include<thread>
+#include<atomic>
+#include<shared_mutex>
+#include<set>
+#include<string>
+#include<cstring>
+#include<cmath>
+
+#include<sys/wait.h>
+#include<sys/resource.h>
+
+using std::cout;
+
+template<typename F>
+double time_ms(F&& work) {
+	auto t0 = std::chrono::steady_clock::now();
+	work();
+	auto t1 = std::chrono::steady_clock::now();
+	double result = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	return result;
+}
+
+std::vector<int> generate_keys(int count, unsigned seed, int max_key = 0x7fff'ffff) {
+	std::mt19937 gen{seed};
+	std::uniform_int_distribution<> dist{0, max_key};
+	std::vector<int> result(count);
+	for (int& key : result) {
+		key = dist(gen);
+	}
+	return result;
+}
+
+RedBlackTree<int> make_tree(int count, unsigned seed) {
+	std::vector<int> keys = generate_keys(count, seed);
+	std::sort(keys.begin(), keys.end());
+	RedBlackTree<int> result{keys.begin(), keys.end()};
+	return result;
+}
+
+
+/*
+  insert_many vs. a loop over add(), for different ratios of batch size to tree size.
+  both start from the same tree and insert the same random batch.
+*/
+void bench_insert_many() {
+	int tree_sizes[] = {100'000, 1'000'000};
+	double ratios[] = {0.001, 0.01, 0.1, 0.25, 0.5, 1.0};
+
+	cout << "\nbench: insert_many vs add loop\n";
+	cout << "tree_size\tbatch_size\tadd_loop_ms\tinsert_many_ms\tspeedup\n";
+
+	for (int tree_size : tree_sizes) {
+		for (double ratio : ratios) {
+			int batch_size = max<int>(1, int(tree_size * ratio));
+			std::vector<int> batch = generate_keys(batch_size, 27 + batch_size);
+
+			RedBlackTree<int> looped = make_tree(tree_size, 26);
+			double loop_ms = time_ms([&]() {
+				for (int key : batch) {
+					looped.add(key);
+				}
+			});
+
+			RedBlackTree<int> batched = make_tree(tree_size, 26);
+			double batch_ms = time_ms([&]() {
+				batched.insert_many(batch);
+			});
+
+			bool same_size = looped.root->count() == batched.root->count();
+
+			cout << tree_size << "\t" << batch_size << "\t" << loop_ms << "\t" << batch_ms << "\t"
+				 << loop_ms / batch_ms << (same_size ? "" : "\tERROR: sizes differ") << "\n";
+
+			looped.clear();
+			batched.clear();
+		}
+	}
+
+	return;
+}
+
+
+/*
+  regular nodes vs. the compact layouts: bytes per key, random inserts and random lookups.
+*/
+template<typename Tree>
+void bench_layout(const char *name, size_t node_bytes, const std::vector<int>& keys, const std::vector<int>& lookups) {
+	Tree tree;
+	double insert_ms = time_ms([&]() {
+		for (int key : keys) {
+			tree.add(key);
+		}
+	});
+
+	int found = 0;
+	double lookup_ms = time_ms([&]() {
+		for (int key : lookups) {
+			found += tree.find(key) != tree.end();
+		}
+	});
+
+	cout << name << "\t" << keys.size() << "\t" << node_bytes << "\t"
+		 << insert_ms * 1e6 / keys.size() << "\t" << lookup_ms * 1e6 / lookups.size() << "\t" << found << "\n";
+
+	tree.clear();
+	return;
+}
+
+void bench_compact_layouts() {
+	int sizes[] = {100'000, 1'000'000, 10'000'000};
+
+	cout << "\nbench: node layouts\n";
+	cout << "layout\tkeys\tbytes_per_node\tinsert_ns\tlookup_ns\tfound\n";
+
+	for (int size : sizes) {
+		std::vector<int> keys = generate_keys(size, 32);
+		std::vector<int> lookups = generate_keys(1'000'000, 33);
+		for (int i = 0 ; i < (int)lookups.size() ; i += 2) {
+			lookups[i] = keys[lookups[i] % size];
+		}
+
+		bench_layout<RedBlackTree<int>>("regular", sizeof(RedBlackTree<int>::Node), keys, lookups);
+		bench_layout<CompactRedBlackTree<int, PackedPointerLayout>>("packed_pointer", CompactRedBlackTree<int, PackedPointerLayout>::node_bytes, keys, lookups);
+		bench_layout<CompactRedBlackTree<int, IndexPoolLayout>>("index_pool", CompactRedBlackTree<int, IndexPoolLayout>::node_bytes, keys, lookups);
+	}
+
+	return;
+}
+
+
+/*
+  union and difference of two random trees: join-based on one thread, join-based forked,
+  and the old way of flattening both trees with inorder_to_buf, merging and rebuilding.
+*/
+void bench_set_operations() {
+	std::pair<int, int> sizes[] = {{1'000'000, 1'000}, {1'000'000, 100'000}, {1'000'000, 1'000'000}, {4'000'000, 4'000'000}};
+	int fork_depth = RedBlackTree<int>::set_operation_fork_depth();
+	
+	cout << "\nbench: set operations, " << std::thread::hardware_concurrency() << " hardware threads\n";
+	cout << "operation\tfirst_size\tsecond_size\tflatten_merge_ms\tjoin_ms\tjoin_parallel_ms\tresult_size\n";
+	
+	for (auto [first_size, second_size] : sizes) {
+		for (const char *operation : {"union", "difference"}) {
+			bool is_union = operation[0] == 'u';
+			int result_size = 0;
+			
+			RedBlackTree<int> first = make_tree(first_size, 34);
+			RedBlackTree<int> second = make_tree(second_size, 35);
+			double flatten_ms = time_ms([&]() {
+				std::vector<int> first_keys(first.size()), second_keys(second.size()), merged;
+				first.root->inorder_to_buf(first_keys.data());
+				second.root->inorder_to_buf(second_keys.data());
+				if (is_union) {
+					std::set_union(first_keys.begin(), first_keys.end(), second_keys.begin(), second_keys.end(), std::back_inserter(merged));
+				} else {
+					std::set_difference(first_keys.begin(), first_keys.end(), second_keys.begin(), second_keys.end(), std::back_inserter(merged));
+				}
+				first.assign_sorted(merged.begin(), merged.end());
+			});
+			first.clear();
+			second.clear();
+			
+			double join_ms[2];
+			for (int parallel = 0 ; parallel < 2 ; ++parallel) {
+				first = make_tree(first_size, 34);
+				second = make_tree(second_size, 35);
+				RedBlackTree<int> result;
+				join_ms[parallel] = time_ms([&]() {
+					int depth = parallel ? fork_depth : 0;
+					result = is_union ? RedBlackTree<int>::set_union(first, second, depth)
+									  : RedBlackTree<int>::set_difference(first, second, depth);
+				});
+				result_size = result.size();
+				result.clear();
+			}
+			
+			cout << operation << "\t" << first_size << "\t" << second_size << "\t" << flatten_ms << "\t"
+				 << join_ms[0] << "\t" << join_ms[1] << "\t" << result_size << "\n";
+		}
+	}
+	
+	return;
+}
+
+
+/*
+  lookups per second with 1 to 8 reading threads while one writer keeps adding keys:
+  RedBlackTree behind a reader/writer lock vs. ConcurrentRedBlackTree, whose readers take no lock.
+*/
+template<typename Lookup, typename Write>
+void bench_readers_with_writer(const char *name, int reader_count, Lookup&& lookup, Write&& write) {
+	//NOTE: readers stop on their own, a reader-preferring lock may keep the writer out until they do
+	auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+	std::atomic<long long> total_lookups{0};
+	std::atomic<int> found{0};
+	
+	std::vector<std::thread> readers;
+	for (int t = 0 ; t < reader_count ; ++t) {
+		readers.emplace_back([&, t]() {
+			std::vector<int> keys = generate_keys(1 << 16, 100 + t);
+			long long lookups = 0;
+			int hits = 0;
+			auto reader = lookup();
+			while (std::chrono::steady_clock::now() < until) {
+				for (int i = 0 ; i < 256 ; ++i) {
+					hits += reader(keys[(lookups + i) & 0xffff]);
+				}
+				lookups += 256;
+			}
+			total_lookups += lookups;
+			found += hits;
+		});
+	}
+	
+	long long writes = 0;
+	std::mt19937 gen{36};
+	double elapsed_ms = time_ms([&]() {
+		while (std::chrono::steady_clock::now() < until) {
+			write((int)(gen() & 0x7fff'ffff));
+			++writes;
+		}
+		for (std::thread& thread : readers) {
+			thread.join();
+		}
+	});
+	
+	cout << name << "\t" << reader_count << "\t" << total_lookups / (elapsed_ms * 1e3) << "\t" << writes / (elapsed_ms * 1e-3) << "\n";
+	return;
+}
+
+void bench_concurrent_readers() {
+	int size = 1'000'000;
+	std::vector<int> keys = generate_keys(size, 35);
+	
+	cout << "\nbench: readers with one concurrent writer, " << std::thread::hardware_concurrency() << " hardware threads\n";
+	cout << "tree\treaders\tlookups_per_us\twrites_per_s\n";
+	
+	for (int reader_count : {1, 2, 4, 8}) {
+		RedBlackTree<int> locked = make_tree(size, 35);
+		std::shared_mutex lock;
+		bench_readers_with_writer("shared_mutex", reader_count,
+			[&]() {
+				return [&](int key) {
+					std::shared_lock<std::shared_mutex> guard{lock};
+					return locked.find(key) != locked.end();
+				};
+			},
+			[&](int key) {
+				std::unique_lock<std::shared_mutex> guard{lock};
+				locked.add(key);
+			});
+		locked.clear();
+		
+		ConcurrentRedBlackTree<int> concurrent;
+		for (int key : keys) {
+			concurrent.add(key);
+		}
+		bench_readers_with_writer("rcu", reader_count,
+			[&]() {
+				return [reader = concurrent.reader()](int key) mutable {
+					return reader.contains(key);
+				};
+			},
+			[&](int key) {
+				concurrent.add(key);
+			});
+	}
+	
+	return;
+}
+
+
+/*
+  cost of a point-in-time copy: inorder_to_buf of a RedBlackTree vs. snapshot() of a PersistentRedBlackTree,
+  and what snapshots cost the writer afterwards: random adds with a snapshot taken every n adds.
+*/
+void bench_snapshots() {
+	int size = 1'000'000;
+	std::vector<int> keys = generate_keys(size, 36);
+	std::vector<int> more_keys = generate_keys(200'000, 37);
+	
+	cout << "\nbench: snapshots of " << size << " keys\n";
+	
+	RedBlackTree<int> regular = make_tree(size, 36);
+	std::vector<int> copy(regular.size());
+	double copy_ms = time_ms([&]() {
+		regular.root->inorder_to_buf(copy.data());
+	});
+	regular.clear();
+	
+	PersistentRedBlackTree<int> persistent;
+	for (int key : keys) {
+		persistent.add(key);
+	}
+	PersistentRedBlackTree<int>::Snapshot snapshot;
+	double snapshot_ms = time_ms([&]() {
+		snapshot = persistent.snapshot();
+	});
+	cout << "inorder_to_buf_ms\tsnapshot_ms\n" << copy_ms << "\t" << snapshot_ms << "\n";
+	
+	cout << "tree\tsnapshot_every\tadd_ns\n";
+	RedBlackTree<int> plain = make_tree(size, 36);
+	double plain_ms = time_ms([&]() {
+		for (int key : more_keys) {
+			plain.add(key);
+		}
+	});
+	cout << "regular\tnever\t" << plain_ms * 1e6 / more_keys.size() << "\n";
+	plain.clear();
+	
+	for (int every : {0, 1000, 10, 1}) {
+		PersistentRedBlackTree<int> tree{snapshot};
+		PersistentRedBlackTree<int>::Snapshot latest;
+		double add_ms = time_ms([&]() {
+			for (int i = 0 ; i < (int)more_keys.size() ; ++i) {
+				if (every && i % every == 0) {
+					latest = tree.snapshot();
+				}
+				tree.add(more_keys[i]);
+			}
+		});
+		cout << "persistent\t" << (every ? std::to_string(every) : "never") << "\t" << add_ms * 1e6 / more_keys.size() << "\n";
+	}
+	
+	return;
+}
+
+
+/*
+  restart-to-ready: rebuilding from a text file with add(), load() of a binary file,
+  and mapping the binary file, with and without checksum verification. each includes 1000 lookups.
+*/
+void bench_restart() {
+	int size = 5'000'000;
+	const char *text_path = "/tmp/Benchmark_red_black_tree.txt";
+	const char *binary_path = "/tmp/Benchmark_red_black_tree.bin";
+	std::vector<int> lookups = generate_keys(1000, 38);
+	
+	RedBlackTree<int> tree = make_tree(size, 37);
+	FILE *text = fopen(text_path, "w");
+	for (int key : tree) {
+		fprintf(text, "%d\n", key);
+	}
+	fclose(text);
+	double save_ms = time_ms([&]() {
+		tree.save(binary_path);
+	});
+	int key_count = tree.size();
+	tree.clear();
+	
+	cout << "\nbench: restart with " << key_count << " keys, save took " << save_ms << " ms\n";
+	cout << "method\tready_ms\tfound\n";
+	
+	int found = 0;
+	double text_ms = time_ms([&]() {
+		RedBlackTree<int> rebuilt;
+		FILE *file = fopen(text_path, "r");
+		int key;
+		while (fscanf(file, "%d", &key) == 1) {
+			rebuilt.add(key);
+		}
+		fclose(file);
+		found = 0;
+		for (int key : lookups) found += rebuilt.find(key) != rebuilt.end();
+		rebuilt.clear();
+	});
+	cout << "text_add\t" << text_ms << "\t" << found << "\n";
+	
+	double load_ms = time_ms([&]() {
+		RedBlackTree<int> loaded;
+		loaded.load(binary_path);
+		found = 0;
+		for (int key : lookups) found += loaded.find(key) != loaded.end();
+		loaded.clear();
+	});
+	cout << "load\t" << load_ms << "\t" << found << "\n";
+	
+	for (bool verify : {true, false}) {
+		double map_ms = time_ms([&]() {
+			MappedRedBlackTree<int> mapped;
+			mapped.open(binary_path, verify);
+			found = 0;
+			for (int key : lookups) found += mapped.contains(key);
+		});
+		cout << (verify ? "mmap_verified" : "mmap_trusted") << "\t" << map_ms << "\t" << found << "\n";
+	}
+	
+	remove(text_path);
+	remove(binary_path);
+	return;
+}
+
+
+/*
+  random lookups: Node::find pointer chasing, std::lower_bound over the sorted keys and the frozen
+  Eytzinger snapshot, from sizes that fit in L1 to far beyond the last-level cache.
+*/
+void bench_frozen() {
+	int sizes[] = {1 << 10, 1 << 13, 1 << 16, 1 << 20, 1 << 23, 1 << 25};
+	std::vector<int> lookups = generate_keys(2'000'000, 39);
+	
+	cout << "\nbench: lookups in a frozen snapshot\n";
+	cout << "keys\tfrozen_bytes\tnode_find_ns\tsorted_vector_ns\tfrozen_ns\tfreeze_ms\n";
+	
+	for (int size : sizes) {
+		RedBlackTree<int> tree = make_tree(size, 40);
+		
+		FrozenRedBlackTree<int> frozen;
+		double freeze_ms = time_ms([&]() {
+			frozen = FrozenRedBlackTree<int>{tree};
+		});
+		std::vector<int> sorted(tree.size());
+		tree.root->inorder_to_buf(sorted.data());
+		
+		long long checksum[3] = {};
+		double node_ms = time_ms([&]() {
+			for (int key : lookups) {
+				auto found = tree.lower_bound(key);
+				checksum[0] += found != tree.end() ? *found : 0;
+			}
+		});
+		double vector_ms = time_ms([&]() {
+			for (int key : lookups) {
+				auto found = std::lower_bound(sorted.begin(), sorted.end(), key);
+				checksum[1] += found != sorted.end() ? *found : 0;
+			}
+		});
+		double frozen_ms = time_ms([&]() {
+			for (int key : lookups) {
+				const int *found = frozen.lower_bound(key);
+				checksum[2] += found ? *found : 0;
+			}
+		});
+		
+		bool same = checksum[0] == checksum[1] && checksum[1] == checksum[2];
+		cout << tree.size() << "\t" << frozen.keys.size() * sizeof(int) << "\t" << node_ms * 1e6 / lookups.size() << "\t"
+			 << vector_ms * 1e6 / lookups.size() << "\t" << frozen_ms * 1e6 / lookups.size() << "\t" << freeze_ms
+			 << (same ? "" : "\tERROR: results differ") << "\n";
+		tree.clear();
+	}
+	
+	return;
+}
+
+
+/*
+  one find() at a time vs. find_many over the same keys, half of them present.
+  the tree is built by random add() calls, so neighbouring nodes don't share cache lines.
+*/
+void bench_find_many() {
+	int sizes[] = {100'000, 1'000'000, 8'000'000, 24'000'000};
+	
+	cout << "\nbench: find_many, groups of " << RedBlackTree<int>::find_many_group_size << "\n";
+	cout << "keys\tfind_ns\tfind_many_ns\tspeedup\n";
+	
+	for (int size : sizes) {
+		std::vector<int> keys = generate_keys(size, 41);
+		RedBlackTree<int> tree;
+		for (int key : keys) {
+			tree.add(key);
+		}
+		std::vector<int> lookups = generate_keys(2'000'000, 42);
+		for (int i = 0 ; i < (int)lookups.size() ; i += 2) {
+			lookups[i] = keys[lookups[i] % size];
+		}
+		std::vector<RedBlackTree<int>::iterator> results(lookups.size());
+		
+		int found[2] = {};
+		double find_ms = time_ms([&]() {
+			for (int key : lookups) {
+				found[0] += tree.find(key) != tree.end();
+			}
+		});
+		double many_ms = time_ms([&]() {
+			tree.find_many(lookups, results);
+		});
+		for (auto result : results) {
+			found[1] += result != tree.end();
+		}
+		
+		cout << size << "\t" << find_ms * 1e6 / lookups.size() << "\t" << many_ms * 1e6 / lookups.size() << "\t"
+			 << find_ms / many_ms << (found[0] == found[1] ? "" : "\tERROR: results differ") << "\n";
+		tree.clear();
+	}
+	
+	return;
+}
+//StatsPolicy keeps the default, top-down remove
+struct StatsBottomUpRemovePolicy : StatsPolicy {
+	static constexpr bool bottom_up_remove = true;
+};
+
+template<typename Policy>
+void remove_path_row(const char *path, const std::vector<int>& insert_order, const std::vector<int>& remove_order) {
+	using Tree = RedBlackTree<int, Policy>;
+	Tree tree;
+	for (int key : insert_order) {
+		tree.add(key);
+	}
+	tree.reset_stats();
+	double remove_ms = time_ms([&]() {
+		for (int key : remove_order) {
+			delete tree.remove(key);
+		}
+	});
+	RedBlackTreeStats stats = tree.stats();
+	double removes = (double)remove_order.size();
+	cout << remove_order.size() << "\t" << path << "\t" << remove_ms * 1e6 / removes << "\t" << stats.rotations() / removes
+		 << "\t" << (stats.flip_colors_with_children + stats.flip_colors_with_parent) / removes
+		 << (tree.root ? "\tERROR: keys left" : "") << "\n";
+	return;
+}
+
+void bench_remove_paths() {
+	int sizes[] = {100'000, 1'000'000};
+	
+	cout << "\nbench: remove, top-down vs bottom-up, all keys in random order\n";
+	cout << "keys\tpath\tremove_ns\trotations_per_remove\tflips_per_remove\n";
+	
+	for (int size : sizes) {
+		std::vector<int> keys = generate_keys(size, 43);
+		std::sort(keys.begin(), keys.end());
+		keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		std::vector<int> insert_order = keys;
+		std::vector<int> remove_order = keys;
+		std::mt19937 gen{44};
+		std::shuffle(insert_order.begin(), insert_order.end(), gen);
+		std::shuffle(remove_order.begin(), remove_order.end(), gen);
+		
+		remove_path_row<StatsPolicy>("top-down", insert_order, remove_order);
+		remove_path_row<StatsBottomUpRemovePolicy>("bottom-up", insert_order, remove_order);
+	}
+	
+	return;
+}
+struct FingerInsertPolicy : DefaultTreePolicy {
+	static constexpr bool finger_insert = true;
+};
+
+template<typename Policy>
+double insert_ns(const std::vector<int>& keys) {
+	RedBlackTree<int, Policy> tree;
+	double ms = time_ms([&]() {
+		for (int key : keys) {
+			tree.add(key);
+		}
+	});
+	tree.clear();
+	return ms * 1e6 / keys.size();
+}
+
+void bench_finger_insert() {
+	const int count = 2'000'000;
+	std::mt19937 gen{45};
+	
+	std::vector<int> ascending(count), nearly_sorted(count), random = generate_keys(count, 46);
+	for (int i = 0 ; i < count ; ++i) {
+		ascending[i] = i;
+		//timestamps arriving slightly out of order
+		nearly_sorted[i] = 4 * i + (int)(gen() % 64);
+	}
+	
+	cout << "\nbench: add from the root vs finger insert, " << count << " keys\n";
+	cout << "pattern\tadd_ns\tfinger_ns\tspeedup\n";
+	
+	std::pair<const char *, std::vector<int> *> patterns[] = {{"ascending", &ascending}, {"nearly sorted", &nearly_sorted}, {"random", &random}};
+	for (auto [name, keys] : patterns) {
+		double root_ns = insert_ns<DefaultTreePolicy>(*keys);
+		double finger_ns = insert_ns<FingerInsertPolicy>(*keys);
+		cout << name << "\t" << root_ns << "\t" << finger_ns << "\t" << root_ns / finger_ns << "\n";
+	}
+	
+	return;
+}
+void bench_dump() {
+	int sizes[] = {1'000'000, 4'000'000};
+	
+	cout << "\nbench: dump, StringBuffer vs DumpWriter\n";
+	cout << "keys\tMB\tstring_buffer_ms\tdump_string_ms\tdump_fd_ms\n";
+	
+	int null_fd = open("/dev/null", O_WRONLY);
+	for (int size : sizes) {
+		RedBlackTree<int> tree = make_tree(size, 47);
+		
+		std::string text;
+		double string_ms = time_ms([&]() {
+			text = tree.dump();
+		});
+		double fd_ms = time_ms([&]() {
+			tree.dump(null_fd);
+		});
+		
+		StringBuffer buf{(int)text.size() + 1};
+		double buffer_ms = time_ms([&]() {
+			traverse_and_print_nodes_to<int>(&buf, tree.root);
+		});
+		
+		cout << size << "\t" << text.size() / 1e6 << "\t" << buffer_ms << "\t" << string_ms << "\t" << fd_ms
+			 << (text == buf.base ? "" : "\tERROR: outputs differ") << "\n";
+		tree.clear();
+	}
+	close(null_fd);
+	
+	return;
+}
+
+
+/*
+  writes per second with 1 to 8 threads, each adding and removing random keys:
+  one RedBlackTree behind a mutex vs ShardedRedBlackTree, which starts with one shard and splits as it goes.
+*/
+template<typename Add, typename Remove>
+double writes_per_s(int writer_count, Add&& add, Remove&& remove) {
+	auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+	std::atomic<long long> total_writes{0};
+	
+	std::vector<std::thread> writers;
+	double elapsed_ms = time_ms([&]() {
+		for (int t = 0 ; t < writer_count ; ++t) {
+			writers.emplace_back([&, t]() {
+				std::vector<int> keys = generate_keys(1 << 16, 200 + t);
+				long long writes = 0;
+				while (std::chrono::steady_clock::now() < until) {
+					//two adds for each remove, the set keeps growing
+					for (int i = 0 ; i < 255 ; i += 3) {
+						add(keys[(writes + i) & 0xffff]);
+						add(keys[(writes + i + 1) & 0xffff] ^ 1);
+						remove(keys[(writes + i + 2) & 0xffff]);
+					}
+					writes += 255;
+				}
+				total_writes += writes;
+			});
+		}
+		for (std::thread& thread : writers) {
+			thread.join();
+		}
+	});
+	
+	double result = total_writes / (elapsed_ms * 1e-3);
+	return result;
+}
+
+void bench_sharded_writers() {
+	cout << "\nbench: concurrent writers, " << std::thread::hardware_concurrency() << " hardware threads\n";
+	cout << "writers\tmutex_writes_per_s\tsharded_writes_per_s\tshards\n";
+	
+	for (int writer_count : {1, 2, 4, 8}) {
+		RedBlackTree<int> locked;
+		std::mutex lock;
+		double mutex_rate = writes_per_s(writer_count,
+			[&](int key) {
+				std::lock_guard<std::mutex> guard{lock};
+				locked.add(key);
+			},
+			[&](int key) {
+				std::lock_guard<std::mutex> guard{lock};
+				delete locked.remove_bottom_up(key);
+			});
+		locked.clear();
+		
+		ShardedRedBlackTree<int> sharded;
+		double sharded_rate = writes_per_s(writer_count,
+			[&](int key) { sharded.add(key); },
+			[&](int key) { sharded.remove(key); });
+		
+		cout << writer_count << "\t" << mutex_rate << "\t" << sharded_rate << "\t" << sharded.shard_count() << "\n";
+	}
+	
+	return;
+}
+
+
+/*
+  RedBlackTree against std::set and a sorted std::vector, workload by workload, from 1K keys up to max_keys.
+  each measurement runs in a child process, so peak RSS is that measurement's own:
+  the child's high-water mark minus what it had resident when it started.
+  
+  output is tab separated, one record per line after the header, "-" where a value doesn't apply:
+  height is the longest root-to-leaf path of RedBlackTree, the other containers don't expose theirs.
+  run "Benchmark_red_black_tree baselines [max_keys]" for this suite alone.
+*/
+enum class Workload { insert_random, insert_sorted, insert_reverse, insert_zipf, lookup_hit, lookup_miss, churn, range_scan };
+
+const char *workload_names[] = {"insert_random", "insert_sorted", "insert_reverse", "insert_zipf", "lookup_hit", "lookup_miss", "churn", "range_scan"};
+
+//the containers behind one interface. all keys are ints
+struct RedBlackTreeSubject {
+	static constexpr const char *name = "RedBlackTree";
+	RedBlackTree<int> tree;
+	
+	void build(const std::vector<int>& sorted) { tree.assign_sorted(sorted.begin(), sorted.end()); }
+	void insert(int key) { tree.add(key); }
+	void erase(int key) { delete tree.remove_bottom_up(key); }
+	bool contains(int key) const { return tree.find(key) != tree.end(); }
+	long long scan(int from, int count) const {
+		long long sum = 0;
+		for (auto it = tree.lower_bound(from) ; it != tree.end() && count-- > 0 ; ++it) {
+			sum += *it;
+		}
+		return sum;
+	}
+	int height() const { return tree.validate().height; }
+	~RedBlackTreeSubject() { tree.clear(); }
+};
+
+struct StdSetSubject {
+	static constexpr const char *name = "std::set";
+	std::set<int> tree;
+	
+	void build(const std::vector<int>& sorted) { tree.insert(sorted.begin(), sorted.end()); }
+	void insert(int key) { tree.insert(key); }
+	void erase(int key) { tree.erase(key); }
+	bool contains(int key) const { return tree.find(key) != tree.end(); }
+	long long scan(int from, int count) const {
+		long long sum = 0;
+		for (auto it = tree.lower_bound(from) ; it != tree.end() && count-- > 0 ; ++it) {
+			sum += *it;
+		}
+		return sum;
+	}
+	int height() const { return -1; }
+};
+
+//every insert and erase moves half the keys on average
+struct SortedVectorSubject {
+	static constexpr const char *name = "sorted_vector";
+	static constexpr int max_write_keys = 200'000; //quadratic beyond
+	std::vector<int> keys;
+	
+	void build(const std::vector<int>& sorted) { keys = sorted; }
+	void insert(int key) {
+		auto it = std::lower_bound(keys.begin(), keys.end(), key);
+		if (it == keys.end() || *it != key) {
+			keys.insert(it, key);
+		}
+	}
+	void erase(int key) {
+		auto it = std::lower_bound(keys.begin(), keys.end(), key);
+		if (it != keys.end() && *it == key) {
+			keys.erase(it);
+		}
+	}
+	bool contains(int key) const { return std::binary_search(keys.begin(), keys.end(), key); }
+	long long scan(int from, int count) const {
+		long long sum = 0;
+		for (auto it = std::lower_bound(keys.begin(), keys.end(), from) ; it != keys.end() && count-- > 0 ; ++it) {
+			sum += *it;
+		}
+		return sum;
+	}
+	int height() const { return -1; }
+};
+
+struct BaselineResult {
+	double ns_per_op;
+	long peak_rss_kb;
+	int height;
+};
+
+long resident_kb() {
+	long pages = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+			resident = 0;
+		}
+		fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ *  keys of a Zipf distribution with exponent 1 over size ranks: rank r comes up about as often as 1/r.
+ *  the cumulative weight of ranks below r grows like log r, so n^u for uniform u in [0, 1) is close enough.
+ *  ranks are scattered over the key space, the hot keys aren't neighbours.
+ */
+std::vector<int> generate_zipf_keys(int count, int size, unsigned seed) {
+	std::mt19937 gen{seed};
+	std::uniform_real_distribution<> unit{0.0, 1.0};
+	std::vector<int> result(count);
+	for (int& key : result) {
+		unsigned rank = (unsigned)std::pow((double)size, unit(gen));
+		key = (int)((rank * 2654435761u) & 0x7fff'ffff);
+	}
+	return result;
+}
+
+template<typename Subject>
+BaselineResult run_workload(Workload workload, int size) {
+	long rss_before = resident_kb();
+	Subject subject;
+	//stored keys are even, so odd keys are sure misses
+	std::vector<int> keys = generate_keys(size, 60, 0x3fff'ffff);
+	for (int& key : keys) {
+		key *= 2;
+	}
+	//the reads and the churn time at most this many operations, whatever the size
+	const int ops = std::min(size, 1'000'000);
+	
+	std::vector<int> sorted;
+	auto build = [&]() {
+		sorted = keys;
+		std::sort(sorted.begin(), sorted.end());
+		sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+		subject.build(sorted);
+	};
+	
+	long long checksum = 0;
+	long long op_count = workload <= Workload::insert_zipf ? size : ops;
+	double ms = 0;
+	switch (workload) {
+	case Workload::insert_random:
+		ms = time_ms([&]() {
+			for (int key : keys) subject.insert(key);
+		});
+		break;
+	case Workload::insert_sorted:
+	case Workload::insert_reverse:
+		std::sort(keys.begin(), keys.end());
+		if (workload == Workload::insert_reverse) {
+			std::reverse(keys.begin(), keys.end());
+		}
+		ms = time_ms([&]() {
+			for (int key : keys) subject.insert(key);
+		});
+		break;
+	case Workload::insert_zipf:
+		keys = generate_zipf_keys(size, size, 61);
+		ms = time_ms([&]() {
+			for (int key : keys) subject.insert(key);
+		});
+		break;
+	case Workload::lookup_hit:
+	case Workload::lookup_miss: {
+		build();
+		std::vector<int> lookups = generate_keys(ops, 62);
+		for (int& key : lookups) {
+			key = workload == Workload::lookup_hit ? sorted[(unsigned)key % sorted.size()] : (key | 1);
+		}
+		ms = time_ms([&]() {
+			for (int key : lookups) checksum += subject.contains(key);
+		});
+		break;
+	}
+	case Workload::churn: {
+		//each operation removes a stored key or adds a new one, the size stays put
+		build();
+		std::vector<int> fresh = generate_keys(ops / 2, 63, 0x3fff'ffff);
+		ms = time_ms([&]() {
+			for (int i = 0 ; i < ops / 2 ; ++i) {
+				subject.erase(keys[i]);
+				subject.insert(fresh[i] * 2);
+			}
+		});
+		break;
+	}
+	case Workload::range_scan: {
+		//scans of 100 keys from random starting points, per key visited
+		build();
+		std::vector<int> starts = generate_keys(std::max(1, ops / 100), 64);
+		ms = time_ms([&]() {
+			for (int start : starts) checksum += subject.scan(start, 100);
+		});
+		op_count = (long long)starts.size() * 100;
+		break;
+	}
+	}
+	
+	struct rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	BaselineResult result{ms * 1e6 / op_count, std::max(0L, usage.ru_maxrss - rss_before), subject.height()};
+	//NOTE: keeps the reads from being optimized away
+	result.height += checksum == -1;
+	return result;
+}
+
+template<typename Subject>
+void bench_baseline(Workload workload, int size) {
+	bool is_write = workload <= Workload::insert_zipf || workload == Workload::churn;
+	if constexpr (std::is_same_v<Subject, SortedVectorSubject>) {
+		if (is_write && size > Subject::max_write_keys) {
+			return;
+		}
+	}
+	
+	int pipe_fds[2];
+	if (pipe(pipe_fds) != 0) {
+		return;
+	}
+	cout.flush();
+	pid_t child = fork();
+	if (child == 0) {
+		close(pipe_fds[0]);
+		BaselineResult result = run_workload<Subject>(workload, size);
+		ssize_t written = write(pipe_fds[1], &result, sizeof(result));
+		_exit(written == (ssize_t)sizeof(result) ? 0 : 1);
+	}
+	close(pipe_fds[1]);
+	BaselineResult result{};
+	bool ok = read(pipe_fds[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+	close(pipe_fds[0]);
+	int status = 0;
+	waitpid(child, &status, 0);
+	
+	cout << workload_names[(int)workload] << "\t" << Subject::name << "\t" << size << "\t";
+	if (ok) {
+		cout << result.ns_per_op << "\t" << result.peak_rss_kb << "\t";
+		if (result.height >= 0) cout << result.height; else cout << "-";
+	} else {
+		cout << "-\t-\t-\tFAILED";
+	}
+	cout << "\n";
+	return;
+}
+
+void bench_baselines(long long max_keys = 1'000'000) {
+	cout << "\nbench: RedBlackTree vs std::set vs sorted vector\n";
+	cout << "workload\tcontainer\tkeys\tns_per_op\tpeak_rss_kb\theight\n";
+	
+	for (int w = 0 ; w <= (int)Workload::range_scan ; ++w) {
+		for (long long size = 1000 ; size <= max_keys ; size *= 10) {
+			bench_baseline<RedBlackTreeSubject>((Workload)w, (int)size);
+			bench_baseline<StdSetSubject>((Workload)w, (int)size);
+			bench_baseline<SortedVectorSubject>((Workload)w, (int)size);
+		}
+	}
+	
+	return;
+}
+
+
+/*
+  rebalancing cost by key distribution, from the counters of StatsPolicy:
+  per add rotations, color flips and the depth of the search, per remove (bottom-up, random order)
+  the repairs and rotations. add_ns without and with the counters shows what counting costs.
+*/
+void bench_rebalancing_stats() {
+	const int count = 1'000'000;
+	std::mt19937 gen{65};
+	
+	std::vector<int> ascending(count), descending(count), nearly_sorted(count);
+	for (int i = 0 ; i < count ; ++i) {
+		ascending[i] = i;
+		descending[i] = count - i;
+		nearly_sorted[i] = 4 * i + (int)(gen() % 64);
+	}
+	std::vector<int> random = generate_keys(count, 66);
+	std::vector<int> zipf = generate_zipf_keys(count, count, 67);
+	
+	cout << "\nbench: rebalancing per operation, " << count << " adds, then all keys removed\n";
+	cout << "pattern\tadd_ns\tstats_add_ns\trotations\tflips\tmean_depth\tmax_depth\tremove_repairs\tremove_rotations\n";
+	
+	std::pair<const char *, std::vector<int> *> patterns[] = {
+		{"ascending", &ascending}, {"descending", &descending}, {"nearly sorted", &nearly_sorted}, {"random", &random}, {"zipf", &zipf}};
+	for (auto [name, keys] : patterns) {
+		double plain_ns = insert_ns<DefaultTreePolicy>(*keys);
+		double stats_ns = insert_ns<StatsPolicy>(*keys);
+		
+		using Tree = RedBlackTree<int, StatsBottomUpRemovePolicy>;
+		Tree tree;
+		for (int key : *keys) {
+			tree.add(key);
+		}
+		RedBlackTreeStats added = tree.stats();
+		
+		std::vector<int> remove_order = *keys;
+		std::shuffle(remove_order.begin(), remove_order.end(), gen);
+		int removed = 0;
+		tree.reset_stats();
+		for (int key : remove_order) {
+			Tree::Node *node = tree.remove(key);
+			removed += node != nullptr;
+			delete node;
+		}
+		RedBlackTreeStats drained = tree.stats();
+		
+		double flips = (double)(added.flip_colors_with_children + added.flip_colors_with_parent);
+		cout << name << "\t" << plain_ns << "\t" << stats_ns << "\t" << (double)added.rotations() / count << "\t" << flips / count
+			 << "\t" << added.mean_descent_depth() << "\t" << added.max_descent_depth()
+			 << "\t" << (double)drained.fix_black_deficit / removed << "\t" << (double)drained.rotations() / removed << "\n";
+	}
+	
+	return;
+}
+
+
+/*
+  expiring the oldest k keys of a tree of timestamps: one remove per key vs one erase_range.
+  removes go bottom-up, the top-down path can't drain a tree.
+*/
+void bench_erase_range() {
+	const int size = 1'000'000;
+	std::vector<int> timestamps(size);
+	for (int i = 0 ; i < size ; ++i) {
+		timestamps[i] = 2 * i;
+	}
+	
+	cout << "\nbench: expire the oldest keys of " << size << ", remove per key vs erase_range\n";
+	cout << "expired\tremove_ms\terase_range_ms\tspeedup\n";
+	
+	for (int expired : {1000, 10'000, 100'000, 500'000}) {
+		RedBlackTree<int> one_by_one{timestamps.begin(), timestamps.end()};
+		RedBlackTree<int> ranged{timestamps.begin(), timestamps.end()};
+		int watermark = timestamps[expired];
+		
+		double remove_ms = time_ms([&]() {
+			for (int i = 0 ; i < expired ; ++i) {
+				delete one_by_one.remove(timestamps[i]);
+			}
+		});
+		int erased = 0;
+		double range_ms = time_ms([&]() {
+			erased = ranged.erase_range(std::numeric_limits<int>::min(), watermark);
+		});
+		
+		cout << expired << "\t" << remove_ms << "\t" << range_ms << "\t" << remove_ms / range_ms
+			 << (erased == expired && ranged.size() == one_by_one.size() ? "" : "\tERROR: trees differ") << "\n";
+		one_by_one.clear();
+		ranged.clear();
+	}
+	
+	return;
+}
+
+
+/*
+  the tree as a priority queue: a steady queue that adds a random key and takes the smallest out, per pair.
+  pop_min removes the cached leftmost node, the other takes the smallest key from begin() and removes it by key.
+*/
+void bench_priority_queue() {
+	const int operations = 2'000'000;
+	std::vector<int> pushed = generate_keys(operations, 68);
+	
+	cout << "\nbench: priority queue, add + take the smallest, ns per pair\n";
+	cout << "queued\tremove_begin_ns\tpop_min_ns\tspeedup\n";
+	
+	for (int queued : {1000, 100'000, 1'000'000}) {
+		std::vector<int> initial = generate_keys(queued, 69);
+		std::sort(initial.begin(), initial.end());
+		RedBlackTree<int> by_key{initial.begin(), initial.end()};
+		RedBlackTree<int> popped{initial.begin(), initial.end()};
+		
+		long long sums[2] = {};
+		double by_key_ms = time_ms([&]() {
+			for (int key : pushed) {
+				by_key.add(key);
+				RedBlackTree<int>::Node *node = by_key.remove_bottom_up(*by_key.begin());
+				sums[0] += node->key;
+				delete node;
+			}
+		});
+		double pop_ms = time_ms([&]() {
+			for (int key : pushed) {
+				popped.add(key);
+				RedBlackTree<int>::Node *node = popped.pop_min();
+				sums[1] += node->key;
+				delete node;
+			}
+		});
+		
+		cout << queued << "\t" << by_key_ms * 1e6 / operations << "\t" << pop_ms * 1e6 / operations << "\t" << by_key_ms / pop_ms
+			 << (sums[0] == sums[1] ? "" : "\tERROR: results differ") << "\n";
+		by_key.clear();
+		popped.clear();
+	}
+	
+	return;
+}
+
+
+/*
+  sustained ingest of random keys into a growing tree: add one at a time vs BufferedRedBlackTree
+  with buffers of several sizes. the buffered rate includes the final flush.
+*/
+void bench_buffered_inserts() {
+	const int count = 4'000'000;
+	std::vector<int> keys = generate_keys(count, 70);
+	
+	cout << "\nbench: sustained random inserts, " << count << " keys\n";
+	cout << "buffer\tinserts_per_us\tspeedup\n";
+	
+	RedBlackTree<int> plain;
+	double plain_ms = time_ms([&]() {
+		for (int key : keys) {
+			plain.add(key);
+		}
+	});
+	int plain_size = plain.size();
+	plain.clear();
+	cout << "none\t" << count / (plain_ms * 1e3) << "\t1\n";
+	
+	for (int capacity : {256, 1024, 4096, 16'384}) {
+		BufferedRedBlackTree<int> buffered{capacity};
+		double buffered_ms = time_ms([&]() {
+			for (int key : keys) {
+				buffered.add(key);
+			}
+			buffered.flush();
+		});
+		cout << capacity << "\t" << count / (buffered_ms * 1e3) << "\t" << plain_ms / buffered_ms
+			 << (buffered.size() == plain_size ? "" : "\tERROR: sizes differ") << "\n";
+	}
+	
+	return;
+}
+
+
+int main(int argc, char **argv) {
+	if (argc > 1 && strcmp(argv[1], "baselines") == 0) {
+		bench_baselines(argc > 2 ? atoll(argv[2]) : 1'000'000);
+		return 0;
+	}
+	
+	bench_insert_many();
+	bench_compact_layouts();
+	bench_set_operations();
+	bench_concurrent_readers();
+	bench_snapshots();
+	bench_restart();
+	bench_frozen();
+	bench_find_many();
+	bench_remove_paths();
+	bench_finger_insert();
+	bench_dump();
+	bench_sharded_writers();
+	bench_baselines();
+	bench_rebalancing_stats();
+	bench_erase_range();
+	bench_priority_queue();
+	bench_buffered_inserts();
+
+	return 0;
+}
@@ -1,8 +1,26 @@
 #include "red_black_tree.h"
+#include "red_black_map.h"
+#include "compact_red_black_tree.h"
+#include "concurrent_red_black_tree.h"
+#include "persistent_red_black_tree.h"
+#include "mapped_red_black_tree.h"
+#include "frozen_red_black_tree.h"
+#include "sharded_red_black_tree.h"
+#include "buffered_red_black_tree.h"
 
 #include<iostream>
 #include<string>
 #include<sstream>
+#include<vector>
+#include<set>
+#include<map>
+#include<random>
+#include<string_view>
+#include<tuple>
+#include<iterator>
+#include<thread>
+#include<atomic>
+#include<unordered_set>
 
 #define array_count(array) (sizeof(array)/sizeof(array[0]))
 
@@ -1363,12 +1381,1740 @@ void test_36() {
 
 
 
+template<class T>
+bool test_helper_is_left_leaning(Node<T> *tree) {
+	if (!tree) return true;
+	bool result = !(tree->right && tree->right->is_red);
+	result &= !tree->left  || tree->left->parent  == tree;
+	result &= !tree->right || tree->right->parent == tree;
+	return result && test_helper_is_left_leaning<T>(tree->left) && test_helper_is_left_leaning<T>(tree->right);
+}
+
+void test_37() {
+	bool OK = true;
+	
+	for (int count = 0 ; count < 300 ; ++count) {
+		std::vector<int> keys;
+		for (int i = 0 ; i < count ; ++i) {
+			keys.push_back(i * 2);
+			if (i % 7 == 3) keys.push_back(i * 2); //duplicates are skipped
+		}
+		
+		RBTree<int> rb{keys.begin(), keys.end()};
+		
+		int rb_count = rb.root ? rb.root->count() : 0;
+		OK &= rb_count == count;
+		OK &= !rb.root || (rb.root->is_black() && rb.root->is_root());
+		OK &= is_red_black_tree<int>(rb.root);
+		OK &= test_helper_is_left_leaning<int>(rb.root);
+		
+		std::vector<int> out(count);
+		if (rb.root) rb.root->inorder_to_buf(out.data());
+		for (int i = 0 ; i < count ; ++i) {
+			OK &= out[i] == i * 2;
+		}
+		
+		if (!OK) {
+			cout << "failed at count " << count << "\n";
+			break;
+		}
+	}
+	
+	cout << "\ntest: build from sorted keys, sizes 0 to 299\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_38() {
+	int keys[] = {1, 3, 5, 7, 9, 11, 13};
+	RBTree<int> rb = rb_from_sorted_keys(keys, array_count(keys));
+	
+	rb.add(4);
+	rb.add(0);
+	rb.add(14);
+	
+	bool OK = true;
+	int exp[] = {0, 1, 3, 4, 5, 7, 9, 11, 13, 14};
+	int out[ array_count(exp) ];
+	
+	OK &= rb.root->count() == array_count(exp);
+	rb.root->inorder_to_buf(out);
+	for (int i = 0 ; i < array_count(exp) ; ++i) {
+		OK &= out[i] == exp[i];
+	}
+	OK &= is_red_black_tree<int>(rb.root);
+	OK &= test_helper_is_left_leaning<int>(rb.root);
+	
+	int replacement[] = {2, 4};
+	rb.assign_sorted(replacement, replacement + array_count(replacement));
+	OK &= rb.root->count() == 2 && rb.root->find(2) && rb.root->find(4) && !rb.root->find(14);
+	
+	cout << "\ntest: add to a tree built from sorted keys, then reassign\n";
+	cout << "result  : " << array_to_string<int>(out, array_count(out)) << "\n";
+	cout << "expected: " << array_to_string<int>(exp, array_count(exp)) << "\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_39() {
+	bool OK = true;
+	
+	std::mt19937 gen{39};
+	std::uniform_int_distribution<> dist{0, 100000};
+	
+	std::vector<int> initial;
+	for (int i = 0 ; i < 20000 ; i += 3) {
+		initial.push_back(i * 5);
+	}
+	RBTree<int> rb{initial.begin(), initial.end()};
+	std::set<int> reference{initial.begin(), initial.end()};
+	
+	//small batches take the finger path, the last one is large enough to trigger a rebuild
+	int batch_sizes[] = {1, 10, 100, 1000, 40000};
+	for (int batch_size : batch_sizes) {
+		std::vector<int> batch;
+		for (int i = 0 ; i < batch_size ; ++i) {
+			int key = dist(gen);
+			batch.push_back(key);
+			if (i % 5 == 0) batch.push_back(key);
+		}
+		rb.insert_many(batch);
+		reference.insert(batch.begin(), batch.end());
+		
+		OK &= rb.root->count() == (int)reference.size();
+		std::vector<int> out(reference.size());
+		rb.root->inorder_to_buf(out.data());
+		OK &= std::equal(out.begin(), out.end(), reference.begin());
+		OK &= is_red_black_tree<int>(rb.root);
+		OK &= test_helper_is_left_leaning<int>(rb.root);
+	}
+	
+	RBTree<int> empty;
+	int keys[] = {5, 3, 9, 3, 1};
+	empty.insert_many(keys);
+	OK &= empty.root && empty.root->count() == 4;
+	
+	cout << "\ntest: insert_many with duplicates, finger path and rebuild path\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_40() {
+	static_assert(std::bidirectional_iterator<RBTree<int>::iterator>);
+	
+	bool OK = true;
+	
+	std::vector<int> keys;
+	for (int i = 0 ; i < 1000 ; ++i) {
+		keys.push_back(i * 3);
+	}
+	RBTree<int> rb;
+	for (int i = 0 ; i < 1000 ; ++i) {
+		rb.add(keys[(i * 7) % 1000]); //not in order
+	}
+	
+	std::vector<int> forward{rb.begin(), rb.end()};
+	OK &= forward == keys;
+	
+	std::vector<int> backward;
+	for (auto it = rb.end() ; it != rb.begin() ; ) {
+		backward.push_back(*--it);
+	}
+	OK &= std::equal(backward.rbegin(), backward.rend(), keys.begin(), keys.end());
+	
+	//range [100, 200): 100, 102 (no), ... keys are multiples of 3 -> 102..198
+	int in_range = 0;
+	for (auto it = rb.lower_bound(100), last = rb.lower_bound(200) ; it != last ; ++it) {
+		OK &= *it >= 100 && *it < 200 && *it % 3 == 0;
+		++in_range;
+	}
+	OK &= in_range == 33;
+	
+	OK &= *rb.lower_bound(9) == 9;
+	OK &= *rb.upper_bound(9) == 12;
+	OK &= *rb.lower_bound(-5) == 0;
+	OK &= rb.lower_bound(3000) == rb.end();
+	OK &= rb.upper_bound(2997) == rb.end();
+	
+	auto [first, last] = rb.equal_range(30);
+	OK &= std::distance(first, last) == 1 && *first == 30;
+	auto [none_first, none_last] = rb.equal_range(31);
+	OK &= none_first == none_last && *none_first == 33;
+	
+	RBTree<int> empty;
+	OK &= empty.begin() == empty.end();
+	OK &= empty.lower_bound(1) == empty.end();
+	
+	cout << "\ntest: iterate in both directions, lower_bound, upper_bound, equal_range\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+template<class T, class Policy>
+bool test_helper_sizes_match(typename RedBlackTree<T, Policy>::Node *tree) {
+	if (!tree) return true;
+	int expected = 1;
+	expected += tree->left  ? tree->left->subtree_size  : 0;
+	expected += tree->right ? tree->right->subtree_size : 0;
+	bool result = tree->subtree_size == expected;
+	return result && test_helper_sizes_match<T, Policy>(tree->left) && test_helper_sizes_match<T, Policy>(tree->right);
+}
+
+void test_41() {
+	using OSTree = RedBlackTree<int, OrderStatisticPolicy>;
+	bool OK = true;
+	
+	std::mt19937 gen{41};
+	std::uniform_int_distribution<> dist{0, 5000};
+	
+	OSTree rb;
+	std::set<int> reference;
+	for (int i = 0 ; i < 2000 ; ++i) {
+		int key = dist(gen);
+		rb.add(key);
+		reference.insert(key);
+	}
+	std::vector<int> sorted{reference.begin(), reference.end()};
+	
+	OK &= test_helper_sizes_match<int, OrderStatisticPolicy>(rb.root);
+	OK &= rb.size() == (int)sorted.size();
+	
+	for (int i = 0 ; i < (int)sorted.size() ; i += 17) {
+		OK &= *rb.select(i) == sorted[i];
+		OK &= rb.rank(sorted[i]) == i;
+		OK &= rb.rank(sorted[i] + 1) == (int)(std::lower_bound(sorted.begin(), sorted.end(), sorted[i] + 1) - sorted.begin());
+	}
+	OK &= rb.select(-1) == rb.end();
+	OK &= rb.select(rb.size()) == rb.end();
+	
+	int low = 1000, high = 2500;
+	int expected_in_range = std::distance(reference.lower_bound(low), reference.lower_bound(high));
+	OK &= rb.count_range(low, high) == expected_in_range;
+	OK &= rb.count_range(high, low) == 0;
+	
+	OSTree bulk{sorted.begin(), sorted.end()};
+	OK &= test_helper_sizes_match<int, OrderStatisticPolicy>(bulk.root);
+	OK &= bulk.size() == (int)sorted.size();
+	
+	cout << "\ntest: order statistics: size, rank, select, count_range\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_42() {
+	using OSTree = RedBlackTree<int, OrderStatisticPolicy>;
+	bool OK = true;
+	
+	//same keys and removal order as test_36
+	OSTree rb{0};
+	int keys[] = {-5, -10, -3, -11, 5, 2, 1, 4, 9};
+	for (int key : keys) {
+		rb.add(key);
+	}
+	
+	int removals[] = {9, -5, -10, 2, 4, -3, 1, 5};
+	int expected_size = 1 + array_count(keys);
+	for (int key : removals) {
+		rb.remove(key);
+		--expected_size;
+		OK &= rb.size() == expected_size;
+		OK &= test_helper_sizes_match<int, OrderStatisticPolicy>(rb.root);
+		OK &= rb.rank(key) == (int)std::distance(rb.begin(), rb.lower_bound(key));
+	}
+	
+	cout << "\ntest: subtree sizes stay correct while removing\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+struct SumPolicy : DefaultTreePolicy {
+	using Augment = SumAugment<int, long long>;
+};
+
+struct MaxSizePolicy : DefaultTreePolicy {
+	static constexpr bool track_size = true;
+	using Augment = MaxAugment<int>;
+};
+
+template<class T, class Policy>
+bool test_helper_aggregates_match(typename RedBlackTree<T, Policy>::Node *tree) {
+	using Augment = typename Policy::Augment;
+	if (!tree) return true;
+	auto expected = Augment::from_key(tree->key);
+	if (tree->left) expected = Augment::combine(tree->left->aggregate, expected);
+	if (tree->right) expected = Augment::combine(expected, tree->right->aggregate);
+	bool result = tree->aggregate == expected;
+	return result && test_helper_aggregates_match<T, Policy>(tree->left) && test_helper_aggregates_match<T, Policy>(tree->right);
+}
+
+void test_43() {
+	bool OK = true;
+	
+	std::mt19937 gen{43};
+	std::uniform_int_distribution<> dist{-3000, 3000};
+	
+	RedBlackTree<int, SumPolicy> sums;
+	RedBlackTree<int, MaxSizePolicy> maxes;
+	std::set<int> reference;
+	for (int i = 0 ; i < 1500 ; ++i) {
+		int key = dist(gen);
+		sums.add(key);
+		maxes.add(key);
+		reference.insert(key);
+	}
+	OK &= test_helper_aggregates_match<int, SumPolicy>(sums.root);
+	OK &= test_helper_aggregates_match<int, MaxSizePolicy>(maxes.root);
+	OK &= test_helper_sizes_match<int, MaxSizePolicy>(maxes.root);
+	
+	for (int i = 0 ; i < 200 ; ++i) {
+		int low = dist(gen);
+		int high = low + dist(gen) / 4;
+		long long expected_sum = 0;
+		int expected_max = std::numeric_limits<int>::lowest();
+		for (auto it = reference.lower_bound(low) ; it != reference.end() && *it < high ; ++it) {
+			expected_sum += *it;
+			expected_max = *it;
+		}
+		OK &= sums.aggregate_range(low, high) == expected_sum;
+		OK &= maxes.aggregate_range(low, high) == expected_max;
+	}
+	
+	long long total = 0;
+	for (int key : reference) total += key;
+	OK &= sums.aggregate() == total;
+	OK &= maxes.aggregate() == *reference.rbegin();
+	
+	//remove path, same keys and removal order as test_36
+	RedBlackTree<int, SumPolicy> small{0};
+	int keys[] = {-5, -10, -3, -11, 5, 2, 1, 4, 9};
+	for (int key : keys) {
+		small.add(key);
+	}
+	int removals[] = {9, -5, -10, 2, 4, -3, 1, 5};
+	long long expected_sum = -8;
+	for (int key : removals) {
+		small.remove(key);
+		expected_sum -= key;
+		OK &= small.aggregate() == expected_sum;
+		OK &= test_helper_aggregates_match<int, SumPolicy>(small.root);
+	}
+	
+	cout << "\ntest: sum and max augments, aggregate_range\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+static int test_44_comparisons = 0;
+
+//a key type from before <=>: only < and ==
+struct LessOnlyKey {
+	int value;
+	bool operator<(const LessOnlyKey& other) const { return value < other.value; }
+	bool operator==(const LessOnlyKey& other) const { return value == other.value; }
+};
+
+struct CountingCompare {
+	using is_transparent = void;
+	template<typename A, typename B>
+	auto operator()(const A& a, const B& b) const {
+		++test_44_comparisons;
+		return a <=> b;
+	}
+};
+
+void test_44() {
+	bool OK = true;
+	
+	RedBlackMap<std::string, int> map;
+	const char *words[] = {"pear", "apple", "fig", "kiwi", "banana", "cherry", "date", "grape"};
+	for (int i = 0 ; i < array_count(words) ; ++i) {
+		OK &= map.insert(words[i], i);
+	}
+	OK &= !map.insert("fig", 100);
+	OK &= map.size() == array_count(words);
+	
+	//heterogeneous lookups, no std::string is built
+	std::string_view view = "kiwi";
+	OK &= map.find(view) && *map.find(view) == 3;
+	OK &= map.find("fig") && *map.find("fig") == 2;
+	OK &= !map.find("plum");
+	OK &= map.contains(std::string_view{"date"});
+	
+	map.insert_or_assign("fig", 20);
+	map["plum"] = 8;
+	map["pear"] += 10;
+	OK &= *map.find("fig") == 20 && *map.find("plum") == 8 && *map.find("pear") == 10;
+	
+	std::string in_order;
+	for (const auto& entry : map) {
+		in_order += entry.key + " ";
+	}
+	OK &= in_order == "apple banana cherry date fig grape kiwi pear plum ";
+	OK &= map.lower_bound("c")->key == "cherry";
+	OK &= map.upper_bound(std::string_view{"fig"})->key == "grape";
+	
+	OK &= map.erase("banana");
+	OK &= !map.erase("banana");
+	OK &= !map.contains("banana") && map.size() == array_count(words);
+	
+	//random inserts and erases, erasing in key order included
+	RedBlackMap<std::string, int> churned;
+	std::map<std::string, int> reference;
+	std::mt19937 gen{44};
+	std::uniform_int_distribution<> dist{0, 199};
+	for (int i = 0 ; i < 4000 ; ++i) {
+		int number = dist(gen);
+		std::string key = "key" + std::to_string(number);
+		if (gen() % 3 == 0) {
+			OK &= churned.erase(key) == (reference.erase(key) == 1);
+		} else {
+			OK &= churned.insert(key, number) == reference.emplace(key, number).second;
+		}
+	}
+	for (int i = 0 ; i < 50 ; ++i) {
+		churned.insert("ordered" + std::to_string(100 + i), i);
+		reference.emplace("ordered" + std::to_string(100 + i), i);
+	}
+	for (int i = 0 ; i < 50 ; ++i) {
+		OK &= churned.erase("ordered" + std::to_string(100 + i));
+		reference.erase("ordered" + std::to_string(100 + i));
+	}
+	OK &= (bool)churned.tree.validate();
+	OK &= churned.size() == (int)reference.size();
+	auto expected = reference.begin();
+	for (const auto& entry : churned) {
+		OK &= expected != reference.end() && entry.key == expected->first && entry.value == expected->second;
+		++expected;
+	}
+	OK &= expected == reference.end();
+	churned.clear();
+	map.clear();
+	
+	//one three-way comparison per level
+	RedBlackMap<int, int, CountingCompare> counted;
+	for (int i = 0 ; i < 1000 ; ++i) {
+		counted.insert(i, -i);
+	}
+	int depth = 0;
+	for (auto *node = counted.tree.root->find(777) ; node->parent ; node = node->parent) {
+		++depth;
+	}
+	test_44_comparisons = 0;
+	OK &= *counted.find(777) == -777;
+	int lookup_comparisons = test_44_comparisons;
+	OK &= lookup_comparisons == depth + 1;
+	
+	//a miss descends once: the path to the new key's parent, then two comparisons there to attach it.
+	//a find first and insert_below from the root took the path twice
+	for (int new_key : {1000, 1001}) {
+		int parent_depth = 0;
+		for (auto *node = counted.tree.max_node() ; node->parent ; node = node->parent) {
+			++parent_depth;
+		}
+		test_44_comparisons = 0;
+		if (new_key == 1000) {
+			counted.insert_or_assign(new_key, -new_key);
+		} else {
+			counted[new_key] = -new_key;
+		}
+		OK &= test_44_comparisons == parent_depth + 3 && *counted.find(new_key) == -new_key;
+	}
+	
+	//the default comparison falls back to < for keys without <=>
+	RBTree<LessOnlyKey> old_style;
+	RedBlackMap<LessOnlyKey, int> old_style_map;
+	for (int key : {5, 1, 4, 2, 3}) {
+		old_style.add(LessOnlyKey{key});
+		old_style_map.insert(LessOnlyKey{key}, 10 * key);
+	}
+	OK &= old_style.validate() && old_style.min_node()->key.value == 1 && old_style.find(LessOnlyKey{4}) != old_style.end();
+	delete old_style.remove(LessOnlyKey{4});
+	OK &= old_style.find(LessOnlyKey{4}) == old_style.end() && old_style.size() == 4;
+	OK &= *old_style_map.find(LessOnlyKey{3}) == 30 && old_style_map.size() == 5;
+	old_style.clear();
+	old_style_map.clear();
+	
+	cout << "\ntest: RedBlackMap with heterogeneous lookup and three-way comparison\n";
+	cout << "comparisons for a lookup at depth " << depth << ": " << lookup_comparisons << "\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+//@return black height, or -1 if the subtree is not a valid left-leaning red-black tree
+template<class Tree>
+int test_helper_compact_black_height(Tree& tree, typename Tree::Handle node, typename Tree::Handle parent) {
+	if (node == Tree::null) return 0;
+	auto& nodes = tree.nodes;
+	if (nodes.parent(node) != parent) return -1;
+	auto left = nodes.left(node);
+	auto right = nodes.right(node);
+	if (right != Tree::null && nodes.is_red(right)) return -1;
+	if (nodes.is_red(node) && left != Tree::null && nodes.is_red(left)) return -1;
+	int left_height = test_helper_compact_black_height(tree, left, node);
+	int right_height = test_helper_compact_black_height(tree, right, node);
+	if (left_height < 0 || left_height != right_height) return -1;
+	return left_height + (nodes.is_red(node) ? 0 : 1);
+}
+
+template<template<typename> class Layout>
+bool test_helper_compact_tree() {
+	using Tree = CompactRedBlackTree<int, Layout>;
+	bool OK = true;
+	
+	std::mt19937 gen{45};
+	std::uniform_int_distribution<> dist{0, 20000};
+	
+	Tree tree;
+	std::set<int> reference;
+	for (int i = 0 ; i < 5000 ; ++i) {
+		int key = dist(gen);
+		OK &= tree.add(key) == reference.insert(key).second;
+	}
+	OK &= tree.size() == (int)reference.size();
+	OK &= !tree.nodes.is_red(tree.root);
+	OK &= test_helper_compact_black_height(tree, tree.root, Tree::null) > 0;
+	OK &= std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+	
+	for (int i = 0 ; i < 500 ; ++i) {
+		int key = dist(gen);
+		OK &= tree.contains(key) == (reference.count(key) == 1);
+		auto expected = reference.lower_bound(key);
+		auto found = tree.lower_bound(key);
+		OK &= (expected == reference.end()) ? found == tree.end() : *found == *expected;
+	}
+	
+	//random removes mixed with adds, then everything out in key order
+	for (int i = 0 ; i < 20000 ; ++i) {
+		int key = dist(gen);
+		if (i % 2 == 0) {
+			OK &= tree.remove(key) == (reference.erase(key) == 1);
+		} else {
+			OK &= tree.add(key) == reference.insert(key).second;
+		}
+		if (i % 1000 == 0) {
+			OK &= test_helper_compact_black_height(tree, tree.root, Tree::null) > 0;
+			OK &= tree.root == Tree::null || !tree.nodes.is_red(tree.root);
+		}
+	}
+	OK &= tree.size() == (int)reference.size();
+	OK &= std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+	
+	std::vector<int> sorted{reference.begin(), reference.end()};
+	Tree drained{sorted.begin(), sorted.end()};
+	for (int i = 0 ; i < (int)sorted.size() ; ++i) {
+		OK &= drained.remove(sorted[i]) && !drained.remove(sorted[i]);
+		if (i % 512 == 0) {
+			OK &= test_helper_compact_black_height(drained, drained.root, Tree::null) >= 0;
+			OK &= std::equal(drained.begin(), drained.end(), sorted.begin() + i + 1, sorted.end());
+		}
+	}
+	OK &= drained.size() == 0 && drained.root == Tree::null;
+	
+	Tree bulk{sorted.begin(), sorted.end()};
+	OK &= test_helper_compact_black_height(bulk, bulk.root, Tree::null) > 0;
+	OK &= std::equal(bulk.begin(), bulk.end(), sorted.begin(), sorted.end());
+	bulk.add(-1);
+	OK &= *bulk.begin() == -1 && bulk.size() == (int)sorted.size() + 1;
+	
+	tree.clear();
+	OK &= tree.size() == 0 && tree.begin() == tree.end();
+	bulk.clear();
+	
+	return OK;
+}
+
+void test_45() {
+	bool OK = true;
+	
+	OK &= test_helper_compact_tree<PackedPointerLayout>();
+	OK &= test_helper_compact_tree<IndexPoolLayout>();
+	
+	size_t regular_bytes = sizeof(RBTree<int>::Node);
+	size_t packed_bytes = CompactRedBlackTree<int, PackedPointerLayout>::node_bytes;
+	size_t index_bytes = CompactRedBlackTree<int, IndexPoolLayout>::node_bytes;
+	OK &= packed_bytes < regular_bytes;
+	OK &= index_bytes * 2 <= regular_bytes;
+	
+	cout << "\ntest: compact trees, color bit in parent pointer and 32-bit index pool, add and remove against std::set\n";
+	cout << "bytes per int node: " << regular_bytes << " regular, " << packed_bytes << " packed pointer, " << index_bytes << " index pool\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+template<class Policy>
+bool test_helper_tree_matches_set(RedBlackTree<int, Policy>& tree, const std::set<int>& expected) {
+	using Tree = RedBlackTree<int, Policy>;
+	bool result = std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+	result &= !tree.root || (tree.root->is_black() && !tree.root->parent);
+	result &= is_red_black_tree<int, Policy>(tree.root);
+	
+	std::vector<typename Tree::Node *> pending{tree.root};
+	while (!pending.empty()) {
+		typename Tree::Node *node = pending.back();
+		pending.pop_back();
+		if (!node) continue;
+		result &= !(node->right && node->right->is_red);
+		result &= !node->left  || node->left->parent  == node;
+		result &= !node->right || node->right->parent == node;
+		pending.push_back(node->left);
+		pending.push_back(node->right);
+	}
+	if constexpr (Policy::track_size) {
+		result &= test_helper_sizes_match<int, Policy>(tree.root);
+	}
+	return result;
+}
+
+void test_46() {
+	bool OK = true;
+	using OSTree = RedBlackTree<int, OrderStatisticPolicy>;
+	std::mt19937 gen{46};
+	
+	//join trees of very different black heights, in both directions
+	for (int left_count : {0, 1, 2, 7, 100, 5000}) {
+		for (int right_count : {0, 1, 3, 60, 4000}) {
+			std::set<int> left_keys, right_keys;
+			std::uniform_int_distribution<> dist{0, 100'000};
+			while ((int)left_keys.size() < left_count) left_keys.insert(dist(gen));
+			while ((int)right_keys.size() < right_count) right_keys.insert(200'000 + dist(gen));
+			
+			OSTree left, right;
+			for (int key : left_keys) left.add(key);
+			for (int key : right_keys) right.add(key);
+			
+			OSTree joined = OSTree::join(left, 150'000, right);
+			std::set<int> expected = left_keys;
+			expected.insert(right_keys.begin(), right_keys.end());
+			expected.insert(150'000);
+			OK &= test_helper_tree_matches_set(joined, expected);
+			OK &= joined.size() == (int)expected.size() && !left.root && !right.root;
+			
+			//split at a present and at an absent key
+			for (int split_key : {150'000, 50'000, 200'001}) {
+				bool found = false;
+				OSTree greater = joined.split(split_key, &found);
+				OK &= found == (expected.count(split_key) == 1);
+				std::set<int> expected_less{expected.begin(), expected.lower_bound(split_key)};
+				std::set<int> expected_greater{expected.upper_bound(split_key), expected.end()};
+				OK &= test_helper_tree_matches_set(joined, expected_less);
+				OK &= test_helper_tree_matches_set(greater, expected_greater);
+				
+				joined = OSTree::join(joined, split_key, greater);
+				expected.insert(split_key);
+				OK &= test_helper_tree_matches_set(joined, expected);
+			}
+			joined.clear();
+		}
+	}
+	
+	//set operations, including overlapping and disjoint inputs and inputs large enough to fork
+	for (auto [first_count, second_count, range] : {std::tuple{0, 50, 100}, {50, 0, 100}, {300, 200, 400}, {10, 20'000, 50'000}, {60'000, 40'000, 100'000}, {30'000, 30'000, 10'000'000}}) {
+		std::uniform_int_distribution<> dist{0, range};
+		std::set<int> first_keys, second_keys;
+		while ((int)first_keys.size() < first_count) first_keys.insert(dist(gen));
+		while ((int)second_keys.size() < second_count) second_keys.insert(dist(gen));
+		
+		std::set<int> expected_union, expected_intersection, expected_difference;
+		std::set_union(first_keys.begin(), first_keys.end(), second_keys.begin(), second_keys.end(), std::inserter(expected_union, expected_union.end()));
+		std::set_intersection(first_keys.begin(), first_keys.end(), second_keys.begin(), second_keys.end(), std::inserter(expected_intersection, expected_intersection.end()));
+		std::set_difference(first_keys.begin(), first_keys.end(), second_keys.begin(), second_keys.end(), std::inserter(expected_difference, expected_difference.end()));
+		
+		OSTree first{first_keys.begin(), first_keys.end()};
+		OSTree second{second_keys.begin(), second_keys.end()};
+		OSTree united = OSTree::set_union(first, second);
+		OK &= test_helper_tree_matches_set(united, expected_union) && !first.root && !second.root;
+		united.clear();
+		
+		first.assign_sorted(first_keys.begin(), first_keys.end());
+		second.assign_sorted(second_keys.begin(), second_keys.end());
+		OSTree common = OSTree::set_intersection(first, second);
+		OK &= test_helper_tree_matches_set(common, expected_intersection);
+		common.clear();
+		
+		RBTree<int> plain_first{first_keys.begin(), first_keys.end()};
+		RBTree<int> plain_second{second_keys.begin(), second_keys.end()};
+		RBTree<int> difference = RBTree<int>::set_difference(plain_first, plain_second);
+		OK &= test_helper_tree_matches_set(difference, expected_difference);
+		difference.clear();
+		
+		//fork three levels deep no matter how many hardware threads there are
+		first.assign_sorted(first_keys.begin(), first_keys.end());
+		second.assign_sorted(second_keys.begin(), second_keys.end());
+		OSTree forked = OSTree::set_union(first, second, 3);
+		OK &= test_helper_tree_matches_set(forked, expected_union);
+		forked.clear();
+	}
+	
+	cout << "\ntest: join, split and join-based set union, intersection, difference\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+//@return black height, or -1 if the subtree is not a valid left-leaning red-black tree
+template<class PathNode>
+int test_helper_path_copying_black_height(const PathNode *node, const int *low, const int *high) {
+	if (!node) return 0;
+	if ((low && node->key <= *low) || (high && node->key >= *high)) return -1;
+	if (node->right && node->right->is_red) return -1;
+	if (node->is_red && node->left && node->left->is_red) return -1;
+	int left_height = test_helper_path_copying_black_height(node->left, low, &node->key);
+	int right_height = test_helper_path_copying_black_height(node->right, &node->key, high);
+	if (left_height < 0 || left_height != right_height) return -1;
+	return left_height + (node->is_red ? 0 : 1);
+}
+
+void test_47() {
+	bool OK = true;
+	ConcurrentRedBlackTree<int> tree;
+	std::set<int> expected;
+	std::mt19937 gen{47};
+	std::uniform_int_distribution<> dist{0, 3000};
+	
+	auto reader = tree.reader();
+	auto matches = [&]() {
+		std::vector<int> keys;
+		reader.for_each([&](int key) { keys.push_back(key); });
+		const auto *root = tree.root.load();
+		return test_helper_path_copying_black_height(root, (const int *)nullptr, (const int *)nullptr) >= 0
+			&& !(root && root->is_red)
+			&& std::equal(keys.begin(), keys.end(), expected.begin(), expected.end())
+			&& tree.size() == (int)expected.size();
+	};
+	
+	for (int i = 0 ; i < 20'000 ; ++i) {
+		int key = dist(gen);
+		if (gen() % 2) {
+			OK &= tree.add(key) == expected.insert(key).second;
+		} else {
+			OK &= tree.remove(key) == (expected.erase(key) == 1);
+		}
+		if (i % 500 == 0) {
+			OK &= matches();
+		}
+	}
+	OK &= matches();
+	OK &= reader.contains(*expected.begin()) && !reader.contains(-1);
+	OK &= reader.find(*expected.begin()) == *expected.begin();
+	OK &= reader.lower_bound(-1) == *expected.begin() && !reader.lower_bound(3001);
+	
+	//a pinned version stays intact while the writer replaces it
+	std::vector<int> snapshot_keys{expected.begin(), expected.end()};
+	const auto *pinned = reader.pin();
+	for (int i = 0 ; i < 5000 ; ++i) {
+		int key = dist(gen);
+		(gen() % 2) ? tree.add(key) : tree.remove(key);
+	}
+	bool has_held_back = !tree.limbo.empty();
+	std::vector<int> seen;
+	std::vector<const ConcurrentRedBlackTree<int>::Node *> pending{pinned};
+	while (!pending.empty()) {
+		const auto *node = pending.back();
+		pending.pop_back();
+		if (!node) continue;
+		seen.push_back(node->key);
+		pending.push_back(node->left);
+		pending.push_back(node->right);
+	}
+	std::sort(seen.begin(), seen.end());
+	OK &= seen == snapshot_keys && has_held_back;
+	reader.unpin();
+	tree.add(-5);
+	tree.remove(-5);
+	OK &= tree.limbo.empty();
+	
+	//readers never miss keys that stay in the tree while the writer churns around them
+	ConcurrentRedBlackTree<int> shared;
+	for (int key = 0 ; key < 20'000 ; key += 2) {
+		shared.add(key);
+	}
+	std::atomic<bool> is_done{false};
+	std::atomic<int> misses{0};
+	std::vector<std::thread> readers;
+	for (int t = 0 ; t < 4 ; ++t) {
+		readers.emplace_back([&, t]() {
+			auto handle = shared.reader();
+			std::mt19937 reader_gen(t);
+			while (!is_done.load()) {
+				int key = 2 * (int)(reader_gen() % 10'000);
+				misses += handle.contains(key) ? 0 : 1;
+			}
+		});
+	}
+	std::mt19937 writer_gen{48};
+	for (int i = 0 ; i < 20'000 ; ++i) {
+		int odd_key = 2 * (int)(writer_gen() % 10'000) + 1;
+		(i % 2) ? shared.add(odd_key) : shared.remove(odd_key);
+	}
+	is_done = true;
+	for (std::thread& thread : readers) {
+		thread.join();
+	}
+	OK &= misses == 0;
+	
+	cout << "\ntest: concurrent readers, path copying writer, epoch reclamation\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+template<class PathNode>
+void test_helper_collect_nodes(const PathNode *node, std::unordered_set<const PathNode *>& out) {
+	if (!node || !out.insert(node).second) return;
+	test_helper_collect_nodes(node->left, out);
+	test_helper_collect_nodes(node->right, out);
+}
+
+void test_48() {
+	bool OK = true;
+	using Tree = PersistentRedBlackTree<int>;
+	Tree tree;
+	std::set<int> expected;
+	std::vector<std::pair<Tree::Snapshot, std::set<int>>> versions;
+	std::mt19937 gen{48};
+	std::uniform_int_distribution<> dist{0, 2000};
+	
+	for (int i = 0 ; i < 20'000 ; ++i) {
+		int key = dist(gen);
+		if (gen() % 3) {
+			OK &= tree.add(key) == expected.insert(key).second;
+		} else {
+			OK &= tree.remove(key) == (expected.erase(key) == 1);
+		}
+		if (i % 1000 == 0) {
+			versions.push_back({tree.snapshot(), expected});
+		}
+	}
+	OK &= test_helper_path_copying_black_height(tree.root, (const int *)nullptr, (const int *)nullptr) >= 0;
+	OK &= std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+	
+	//every snapshot still shows its own version
+	for (auto& [snapshot, keys] : versions) {
+		OK &= snapshot.size() == (int)keys.size();
+		OK &= std::equal(snapshot.begin(), snapshot.end(), keys.begin(), keys.end());
+		OK &= test_helper_path_copying_black_height(snapshot.root, (const int *)nullptr, (const int *)nullptr) >= 0;
+	}
+	OK &= versions[3].first.contains(*versions[3].second.begin());
+	OK &= *versions[3].first.lower_bound(-1) == *versions[3].second.begin();
+	
+	//one add after a snapshot copies about one path, the rest is shared
+	Tree::Snapshot before = tree.snapshot();
+	int height = 0;
+	for (const Tree::Node *node = tree.root ; node ; node = node->left) ++height;
+	tree.add(5000);
+	std::unordered_set<const Tree::Node *> nodes;
+	test_helper_collect_nodes<Tree::Node>(before.root, nodes);
+	int before_count = (int)nodes.size();
+	test_helper_collect_nodes<Tree::Node>(tree.root, nodes);
+	int copied = (int)nodes.size() - before_count;
+	OK &= copied > 0 && copied <= 3 * height;
+	OK &= !before.contains(5000) && tree.contains(5000);
+	
+	//a tree continued from a snapshot leaves the snapshot and the original tree alone
+	Tree branch{versions[5].first};
+	for (int key = 0 ; key < 2000 ; key += 3) {
+		branch.remove(key);
+	}
+	OK &= std::equal(versions[5].first.begin(), versions[5].first.end(), versions[5].second.begin(), versions[5].second.end());
+	expected.insert(5000);
+	OK &= std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+	
+	versions.clear();
+	OK &= tree.root->references == 1;
+	
+	cout << "\ntest: persistent tree, snapshots share all but the copied paths\n";
+	cout << "nodes copied by one add after a snapshot: " << copied << ", height " << height << "\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_49() {
+	bool OK = true;
+	const char *path = "/tmp/UnitTest_red_black_tree_49.bin";
+	
+	std::mt19937 gen{49};
+	std::set<int> expected;
+	RBTree<int> tree;
+	for (int i = 0 ; i < 50'000 ; ++i) {
+		int key = (int)(gen() % 1'000'000);
+		expected.insert(key);
+		tree.add(key);
+	}
+	OK &= tree.save(path);
+	
+	RBTree<int> loaded;
+	OK &= loaded.load(path);
+	OK &= std::equal(loaded.begin(), loaded.end(), expected.begin(), expected.end());
+	OK &= is_red_black_tree<int>(loaded.root);
+	
+	MappedRedBlackTree<int> mapped;
+	OK &= mapped.open(path);
+	OK &= mapped.size() == (int)expected.size();
+	OK &= std::equal(mapped.begin(), mapped.end(), expected.begin(), expected.end());
+	for (int i = 0 ; i < 1000 ; ++i) {
+		int key = (int)(gen() % 1'000'000);
+		OK &= mapped.contains(key) == expected.contains(key);
+		auto low = mapped.lower_bound(key);
+		auto expected_low = expected.lower_bound(key);
+		OK &= (low == mapped.end()) == (expected_low == expected.end());
+		if (low != mapped.end() && expected_low != expected.end()) OK &= *low == *expected_low;
+	}
+	mapped.close();
+	
+	//a flipped bit in a key fails the checksum, the tree keeps its contents
+	FILE *file = fopen(path, "r+b");
+	fseek(file, sizeof(RedBlackTreeFileHeader) + 4 * 1234, SEEK_SET);
+	int key = 0;
+	fread(&key, sizeof(key), 1, file);
+	key ^= 1 << 7;
+	fseek(file, sizeof(RedBlackTreeFileHeader) + 4 * 1234, SEEK_SET);
+	fwrite(&key, sizeof(key), 1, file);
+	fclose(file);
+	OK &= !loaded.load(path);
+	OK &= loaded.size() == (int)expected.size();
+	OK &= !mapped.open(path);
+	OK &= mapped.open(path, false); //trusting the file skips the full read
+	
+	//another key type, a truncated file and an empty tree
+	RedBlackTree<long long> wider;
+	OK &= !wider.load(path);
+	truncate(path, sizeof(RedBlackTreeFileHeader) + 10);
+	OK &= !loaded.load(path);
+	RBTree<int> empty;
+	OK &= empty.save(path) && loaded.load(path) && loaded.size() == 0 && !loaded.root;
+	OK &= !loaded.load("/nonexistent/directory/file.bin");
+	remove(path);
+	
+	cout << "\ntest: binary save, load and memory-mapped lookups\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_50() {
+	bool OK = true;
+	std::mt19937 gen{50};
+	
+	for (int count : {0, 1, 2, 3, 7, 8, 15, 16, 17, 1000, 65'537}) {
+		std::set<int> expected;
+		while ((int)expected.size() < count) {
+			expected.insert((int)(gen() % (4 * count + 1)));
+		}
+		RBTree<int> tree{expected.begin(), expected.end()};
+		FrozenRedBlackTree<int> frozen{tree};
+		OK &= frozen.size() == count;
+		
+		for (int key = -1 ; key <= 4 * count + 1 ; key += (count > 1000 ? 7 : 1)) {
+			auto expected_low = expected.lower_bound(key);
+			const int *low = frozen.lower_bound(key);
+			OK &= (low == nullptr) == (expected_low == expected.end());
+			if (low && expected_low != expected.end()) OK &= *low == *expected_low;
+			OK &= frozen.contains(key) == expected.contains(key);
+		}
+		tree.clear();
+	}
+	
+	std::vector<std::string> words{"ant", "bee", "cat", "dog", "eel", "fox", "gnu"};
+	RedBlackTree<std::string> word_tree{words.begin(), words.end()};
+	FrozenRedBlackTree<std::string> frozen_words{word_tree};
+	OK &= *frozen_words.lower_bound(std::string("cow")) == "dog";
+	OK &= frozen_words.find(std::string("eel")) && !frozen_words.find(std::string("elk"));
+	OK &= frozen_words.lower_bound(std::string("zebra")) == nullptr;
+	
+	cout << "\ntest: frozen Eytzinger snapshot, branch-free lower_bound\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_51() {
+	bool OK = true;
+	std::mt19937 gen{51};
+	
+	RBTree<int> tree;
+	for (int i = 0 ; i < 30'000 ; ++i) {
+		tree.add((int)(gen() % 100'000));
+	}
+	
+	//lengths that leave partial groups, keys present and absent, repeated keys
+	for (int count : {0, 1, 15, 16, 17, 1000}) {
+		std::vector<int> keys(count);
+		for (int& key : keys) {
+			key = (int)(gen() % 100'000);
+		}
+		if (count > 2) keys[1] = keys[0];
+		std::vector<RBTree<int>::iterator> results(count);
+		tree.find_many(keys, results);
+		for (int i = 0 ; i < count ; ++i) {
+			OK &= results[i] == tree.find(keys[i]);
+		}
+	}
+	
+	RBTree<int> empty;
+	std::vector<int> keys{1, 2, 3};
+	std::vector<RBTree<int>::iterator> results(3);
+	empty.find_many(keys, results);
+	OK &= results[0] == empty.end() && results[2] == empty.end();
+	
+	cout << "\ntest: find_many, interleaved lookups with prefetching\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+struct BottomUpRemovePolicy : DefaultTreePolicy {
+	static constexpr bool track_size = true;
+	using Augment = SumAugment<int, long long>;
+	static constexpr bool bottom_up_remove = true;
+	static constexpr bool collect_stats = true;
+};
+
+void test_52() {
+	bool OK = true;
+	using Tree = RedBlackTree<int, BottomUpRemovePolicy>;
+	std::mt19937 gen{52};
+	
+	//removals mixed with insertions, absent keys included, checked against std::set after every step
+	for (int round = 0 ; round < 20 && OK ; ++round) {
+		Tree tree;
+		std::set<int> expected;
+		int key_range = round < 10 ? 40 : 2000;
+		for (int step = 0 ; step < 3000 && OK ; ++step) {
+			int key = (int)(gen() % key_range);
+			if (gen() % 3 == 0) {
+				tree.add(key);
+				expected.insert(key);
+			} else {
+				Tree::Node *removed = tree.remove(key);
+				OK &= (removed != nullptr) == (expected.erase(key) == 1);
+				OK &= !removed || (removed->key == key && !removed->parent && !removed->left && !removed->right);
+				delete removed;
+			}
+			OK &= test_helper_tree_matches_set(tree, expected);
+			OK &= test_helper_aggregates_match<int, BottomUpRemovePolicy>(tree.root);
+		}
+		tree.clear();
+	}
+	
+	//draining a large tree in random order rotates a constant number of times per removal on average
+	std::vector<int> keys(100'000);
+	for (int i = 0 ; i < (int)keys.size() ; ++i) {
+		keys[i] = i;
+	}
+	Tree tree{keys.begin(), keys.end()};
+	std::shuffle(keys.begin(), keys.end(), gen);
+	tree.reset_stats();
+	for (int key : keys) {
+		delete tree.remove(key);
+	}
+	long long rotations = tree.stats().rotations();
+	OK &= !tree.root && rotations < 2 * (long long)keys.size();
+	
+	cout << "\ntest: bottom-up remove, random removals against std::set\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+struct FingerPolicy : DefaultTreePolicy {
+	static constexpr bool track_size = true;
+	static constexpr bool finger_insert = true;
+	static constexpr bool bottom_up_remove = true;
+	using Compare = CountingCompare;
+};
+
+void test_53() {
+	bool OK = true;
+	using Tree = RedBlackTree<int, FingerPolicy>;
+	std::mt19937 gen{53};
+	
+	//ascending, descending, nearly sorted with duplicates, random; removals in between forget the finger
+	for (int pattern = 0 ; pattern < 4 && OK ; ++pattern) {
+		Tree tree;
+		std::set<int> expected;
+		for (int i = 0 ; i < 5000 && OK ; ++i) {
+			int key = pattern == 0 ? i : pattern == 1 ? -i : pattern == 2 ? i + (int)(gen() % 20) : (int)(gen() % 10'000);
+			tree.add(key);
+			expected.insert(key);
+			OK &= tree.finger && tree.finger->key == key;
+			if (i % 97 == 0) {
+				delete tree.remove(*expected.begin());
+				expected.erase(expected.begin());
+			}
+			if (i % 500 == 0) {
+				OK &= test_helper_tree_matches_set(tree, expected);
+			}
+		}
+		OK &= test_helper_tree_matches_set(tree, expected);
+		tree.clear();
+	}
+	
+	//an ascending stream compares a constant number of times per key instead of about log2(n)
+	Tree ascending;
+	test_44_comparisons = 0;
+	for (int i = 0 ; i < 100'000 ; ++i) {
+		ascending.add(i);
+	}
+	OK &= test_44_comparisons < 4 * 100'000;
+	OK &= ascending.size() == 100'000;
+	ascending.clear();
+	
+	//explicit hints, from iterators anywhere in the tree
+	RBTree<int> tree;
+	std::set<int> expected;
+	for (int i = 0 ; i < 3000 ; ++i) {
+		int key = (int)(gen() % 5000);
+		RBTree<int>::iterator hint = i % 3 == 0 ? tree.end() : tree.lower_bound((int)(gen() % 5000));
+		RBTree<int>::iterator added = tree.add_hint(hint, key);
+		expected.insert(key);
+		OK &= added != tree.end() && *added == key;
+	}
+	OK &= test_helper_tree_matches_set(tree, expected);
+	
+	cout << "\ntest: finger insert and add_hint\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_54() {
+	bool OK = true;
+	std::mt19937 gen{54};
+	
+	//same text as the StringBuffer printer
+	RBTree<int> tree;
+	for (int i = 0 ; i < 2000 ; ++i) {
+		tree.add((int)(gen() % 100'000) - 50'000);
+	}
+	StringBuffer buf{1 << 16};
+	OK &= traverse_and_print_nodes_to<int>(&buf, tree.root);
+	std::string text = tree.dump();
+	OK &= text == buf.base;
+	
+	std::vector<char> out(text.size() + 1);
+	OK &= tree.to_string(out.data(), (int)out.size()) && text == out.data();
+	OK &= !tree.to_string(out.data(), (int)text.size());
+	
+	//through a file descriptor
+	const char *path = "/tmp/UnitTest_red_black_tree_54.txt";
+	FILE *file = fopen(path, "w+");
+	OK &= file && tree.dump(fileno(file));
+	std::string from_file(text.size() + 1, '\0');
+	if (file) {
+		rewind(file);
+		from_file.resize(fread(from_file.data(), 1, from_file.size(), file));
+		fclose(file);
+	}
+	remove(path);
+	OK &= from_file == text;
+	
+	RedBlackTree<std::string> words;
+	for (const char *word : {"b", "a", "c"}) {
+		words.add(word);
+	}
+	OK &= words.dump() == "b\n|a\n|c\n";
+	OK &= RBTree<int>{}.dump().empty();
+	
+	//a chain far deeper than any balanced tree. the indentation makes the text quadratic in the depth
+	const int depth = 5000;
+	RBTree<int> chain;
+	Node<int> *bottom = nullptr;
+	for (int i = 0 ; i < depth ; ++i) {
+		Node<int> *node = new Node<int>{i};
+		if (bottom) {
+			bottom->right = node;
+			node->parent = bottom;
+		} else {
+			chain.root = node;
+		}
+		bottom = node;
+	}
+	text = chain.dump();
+	OK &= std::count(text.begin(), text.end(), '\n') == depth;
+	std::string last_line = std::string(depth - 2, ' ') + "|" + std::to_string(depth - 1) + "\n";
+	OK &= text.size() > last_line.size() && text.compare(text.size() - last_line.size(), last_line.size(), last_line) == 0;
+	while (bottom) {
+		Node<int> *above = bottom->parent;
+		delete bottom;
+		bottom = above;
+	}
+	
+	cout << "\ntest: dump through DumpWriter, string and file descriptor, deep trees\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_55() {
+	bool OK = true;
+	using OSTree = RedBlackTree<int, OrderStatisticPolicy>;
+	using OSNode = OSTree::Node;
+	
+	std::vector<int> keys(1000);
+	for (int i = 0 ; i < (int)keys.size() ; ++i) {
+		keys[i] = 3 * i;
+	}
+	OSTree tree{keys.begin(), keys.end()};
+	RedBlackTreeValidation valid = tree.validate();
+	OK &= (bool)valid && valid.count == 1000 && valid.black_height > 0;
+	//no path has two reds in a row
+	OK &= valid.height >= valid.black_height && valid.height <= 2 * valid.black_height;
+	RBTree<int> pair;
+	pair.add(1);
+	pair.add(2);
+	OK &= pair.validate().height == 2 && RBTree<int>{}.validate().height == 0;
+	pair.clear();
+	
+	//break one rule at a time, the validator must name it
+	auto expect_failure = [&](const char *expected, const void *at) {
+		RedBlackTreeValidation result = tree.validate();
+		bool matches = !result && std::string_view{result.failure} == expected && (!at || result.node == at);
+		if (!matches) {
+			cout << "expected \"" << expected << "\", got \"" << (result.failure ? result.failure : "valid") << "\"\n";
+		}
+		return matches;
+	};
+	OSNode *node = tree.root->left->right;
+	
+	std::swap(node->key, node->left->key);
+	OK &= expect_failure("keys out of order", nullptr);
+	std::swap(node->key, node->left->key);
+	
+	OSNode *child_parent = node->left->parent;
+	node->left->parent = tree.root;
+	OK &= expect_failure("child's parent link doesn't point back", node);
+	node->left->parent = child_parent;
+	
+	//the top levels of a tree built from sorted keys are black
+	OSNode *black = tree.root->left;
+	black->is_red = black->left->is_red = true;
+	OK &= expect_failure("red node with a red child", black);
+	black->is_red = black->left->is_red = false;
+	
+	OSNode *bottom = tree.root->rightmost();
+	bottom->is_red = !bottom->is_red;
+	OK &= !tree.validate();
+	bottom->is_red = !bottom->is_red;
+	
+	node->subtree_size += 1;
+	OK &= expect_failure("subtree_size is stale", node);
+	node->subtree_size -= 1;
+	
+	tree.root->is_red = true;
+	OK &= expect_failure("root is red", tree.root);
+	tree.root->is_red = false;
+	OK &= (bool)tree.validate();
+	
+	//a valid red-black tree, but not a left-leaning one
+	RBTree<int> leaning{1};
+	leaning.root->debug_add_right(2, true);
+	OK &= is_red_black_tree<int>(leaning.root);
+	OK &= std::string_view{leaning.validate().failure ? leaning.validate().failure : ""} == "red right child";
+	
+	//a subtree put in from outside: the cached nodes are stale until update_root finds them again
+	RBTree<int> grafted{1};
+	RBTree<int> donor{0};
+	grafted.root->left = donor.root;
+	donor.root->parent = grafted.root;
+	donor.root->is_red = true;
+	donor.root = nullptr;
+	OK &= std::string_view{grafted.validate().failure ? grafted.validate().failure : ""} == "cached first or last node is stale";
+	OK &= !grafted.cached_nodes_plausible();
+	grafted.update_root();
+	OK &= grafted.validate() && grafted.min_node()->key == 0 && grafted.cached_nodes_plausible();
+	grafted.clear();
+	
+	OK &= (bool)RBTree<int>{}.validate();
+	
+	//O(n): a tree with millions of keys validates in well under a second
+	std::vector<int> many(4'000'000);
+	for (int i = 0 ; i < (int)many.size() ; ++i) {
+		many[i] = i;
+	}
+	OSTree large{many.begin(), many.end()};
+	RedBlackTreeValidation large_result = large.validate();
+	OK &= (bool)large_result && large_result.count == (int)many.size();
+	large.clear();
+	tree.clear();
+	
+	cout << "\ntest: validate, one pass over the tree, and the failures it names\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+struct MultisetSizePolicy : MultisetPolicy {
+	static constexpr bool track_size = true;
+};
+
+void test_56() {
+	bool OK = true;
+	using Tree = RedBlackTree<int, MultisetSizePolicy>;
+	std::mt19937 gen{56};
+	
+	Tree tree;
+	std::multiset<int> expected;
+	for (int step = 0 ; step < 20'000 && OK ; ++step) {
+		int key = (int)(gen() % 300);
+		switch (gen() % 4) {
+		case 0:
+		case 1:
+			tree.insert(key);
+			expected.insert(key);
+			break;
+		case 2:
+			tree.add(key); //counts as well
+			expected.insert(key);
+			break;
+		default:
+			auto found = expected.find(key);
+			OK &= tree.erase_one(key) == (found != expected.end());
+			if (found != expected.end()) expected.erase(found);
+			break;
+		}
+		OK &= tree.count(key) == (int)expected.count(key);
+		if (step % 1000 == 0) {
+			OK &= (bool)tree.validate();
+			std::set<int> distinct{expected.begin(), expected.end()};
+			OK &= tree.size() == (int)distinct.size();
+			OK &= std::equal(tree.begin(), tree.end(), distinct.begin(), distinct.end());
+			for (int key : distinct) {
+				OK &= tree.count(key) == (int)expected.count(key);
+			}
+		}
+	}
+	
+	std::vector<int> batch{5, 5, 5, 1000, 1000};
+	tree.insert_many(batch);
+	expected.insert(batch.begin(), batch.end());
+	OK &= tree.count(5) == (int)expected.count(5) && tree.count(1000) == 2 && tree.count(-1) == 0;
+	tree.clear();
+	
+	//sets answer 0 or 1
+	RBTree<int> set;
+	set.add(3);
+	set.insert(3);
+	OK &= set.count(3) == 1 && set.count(4) == 0 && set.size() == 1;
+	
+	//the count takes no space unless the policy asks for it
+	OK &= std::is_same_v<decltype(RBTree<int>::Node::multiplicity), NoField>;
+	
+	cout << "\ntest: multiset policy, insert, erase_one, count\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
 /*TODO
   a test where the target is found but then becomes left red child of 3-4-leaf.
   a test where the target is already a red child of a 3-4-leaf
   figure out all cases where it can happen that target is in the leaf, but current != target, i.e. target is red in a 3-4 node and current is the black or the other red one.
   */                                                            
 
+void test_57() {
+	bool OK = true;
+	using Sharded = ShardedRedBlackTree<int>;
+	
+	//one thread against std::set: routing, splits and scans across shard boundaries
+	Sharded single;
+	std::set<int> expected;
+	std::mt19937 gen{57};
+	for (int i = 0 ; i < 60'000 ; ++i) {
+		int key = (int)(gen() % 20'000);
+		if (gen() % 3) {
+			OK &= single.add(key) == expected.insert(key).second;
+		} else {
+			OK &= single.remove(key) == (expected.erase(key) == 1);
+		}
+	}
+	OK &= single.shard_count() > 1 && single.size() == (int)expected.size();
+	std::vector<int> keys;
+	single.for_each([&](int key) { keys.push_back(key); });
+	OK &= std::equal(keys.begin(), keys.end(), expected.begin(), expected.end());
+	keys.clear();
+	single.scan(5000, 15'000, [&](int key) { keys.push_back(key); });
+	OK &= std::equal(keys.begin(), keys.end(), expected.lower_bound(5000), expected.lower_bound(15'000));
+	OK &= single.lower_bound(-1) == *expected.begin() && !single.lower_bound(20'000);
+	OK &= single.contains(*expected.begin()) && !single.contains(-1);
+	
+	//every shard covers exactly the range the layout gives it, and holds a valid tree
+	const Sharded::Layout *layout = single.layout.load();
+	for (int i = 0 ; i < (int)layout->shards.size() ; ++i) {
+		const Sharded::Shard *shard = layout->shards[i];
+		OK &= (bool)shard->tree.validate() && shard->tree.size() == shard->key_count.load();
+		OK &= i == 0 ? !shard->low : shard->low == layout->lower_keys[i - 1];
+		OK &= i + 1 == (int)layout->shards.size() ? !shard->high : shard->high == layout->lower_keys[i];
+	}
+	
+	//given boundaries
+	std::vector<int> boundaries{100, 200};
+	Sharded preset{boundaries};
+	for (int key : {250, 5, 150, 100, 199, 200}) {
+		preset.add(key);
+	}
+	keys.clear();
+	preset.for_each([&](int key) { keys.push_back(key); });
+	OK &= preset.shard_count() == 3 && keys == std::vector<int>{5, 100, 150, 199, 200, 250};
+	
+	//writers on disjoint key sets, a scanner checks that keys nobody touches are always seen
+	Sharded shared;
+	const int writers = 4, per_writer = 30'000;
+	for (int key = 0 ; key < 4 * writers * per_writer ; key += 4) {
+		shared.add(key);
+	}
+	std::atomic<bool> is_done{false};
+	std::atomic<int> misses{0};
+	std::thread scanner([&]() {
+		while (!is_done.load()) {
+			int next = 0;
+			shared.for_each([&](int key) {
+				if (key % 4 == 0) {
+					misses += key == next ? 0 : 1;
+					next = key + 4;
+				}
+			});
+		}
+	});
+	std::vector<std::thread> threads;
+	for (int t = 0 ; t < writers ; ++t) {
+		threads.emplace_back([&, t]() {
+			//keys 4k + 1 are added, keys 4k + 2 added and then removed again
+			for (int i = 0 ; i < per_writer ; ++i) {
+				int key = 4 * (t + writers * i);
+				shared.add(key + 1);
+				shared.add(key + 2);
+			}
+			for (int i = 0 ; i < per_writer ; ++i) {
+				shared.remove(4 * (t + writers * i) + 2);
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	is_done = true;
+	scanner.join();
+	
+	keys.clear();
+	shared.for_each([&](int key) { keys.push_back(key); });
+	bool matches = (int)keys.size() == 2 * writers * per_writer;
+	for (int i = 0 ; matches && i < (int)keys.size() ; ++i) {
+		matches = keys[i] == 4 * (i / 2) + i % 2;
+	}
+	OK &= matches && misses == 0 && shared.size() == 2 * writers * per_writer && shared.shard_count() > 1;
+	
+	cout << "\ntest: sharded tree, concurrent writers, splits, ordered scans\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+struct StatsBottomUpPolicy : StatsPolicy {
+	static constexpr bool bottom_up_remove = true;
+};
+
+void test_58() {
+	bool OK = true;
+	using Tree = RedBlackTree<int, StatsBottomUpPolicy>;
+	const int count = 1000;
+	
+	Tree tree;
+	for (int key = 0 ; key < count ; ++key) {
+		tree.add(key);
+	}
+	RedBlackTreeStats stats = tree.stats();
+	//the first key becomes the root without a search
+	OK &= stats.descents == count - 1 && stats.rotations() > 0 && stats.flip_colors_with_children > 0;
+	OK &= stats.rotate_left > 0 && stats.lend == 0 && stats.fix_black_deficit == 0;
+	
+	long long by_depth = 0;
+	for (long long descents : stats.descents_by_depth) {
+		by_depth += descents;
+	}
+	OK &= by_depth == stats.descents;
+	
+	//looking up every key reaches the deepest node, and the mean depth lies below
+	int height = tree.validate().height;
+	tree.reset_stats();
+	for (int key = 0 ; key < count ; ++key) {
+		OK &= tree.find(key) != tree.end();
+	}
+	stats = tree.stats();
+	OK &= stats.descents == count && stats.max_descent_depth() == height && stats.rotations() == 0;
+	OK &= stats.mean_descent_depth() > 1 && stats.mean_descent_depth() < height;
+	
+	//a missing key compares all the way down
+	tree.reset_stats();
+	OK &= tree.find(count) == tree.end();
+	stats = tree.stats();
+	OK &= stats.descents == 1 && stats.descent_steps >= tree.validate().black_height;
+	
+	//each tree counts its own work
+	Tree other;
+	other.add(1);
+	OK &= other.stats().descents == 0 && tree.stats().descents == 1;
+	
+	tree.reset_stats();
+	for (int key = 0 ; key < count ; ++key) {
+		delete tree.remove(key);
+	}
+	stats = tree.stats();
+	OK &= stats.descents == count && stats.fix_black_deficit > 0 && !tree.root;
+	
+	//forked set operations count from several threads, and lose nothing
+	std::vector<int> evens, thirds;
+	for (int key = 0 ; key < 300'000 ; ++key) {
+		if (key % 2 == 0) evens.push_back(key);
+		if (key % 3 == 0) thirds.push_back(key);
+	}
+	long long rotations[2] = {};
+	for (int fork_depth : {0, 4}) {
+		Tree first{evens.begin(), evens.end()};
+		Tree second{thirds.begin(), thirds.end()};
+		Tree united = Tree::set_union(first, second, fork_depth);
+		rotations[fork_depth > 0] = united.stats().rotations();
+		OK &= united.size() == 200'000;
+		united.clear();
+	}
+	OK &= rotations[0] > 0 && rotations[0] == rotations[1];
+	
+	//without the policy flag there are no counters, and they take no space
+	OK &= std::is_same_v<decltype(RBTree<int>::stats_counters), NoField>;
+	OK &= sizeof(RBTree<int>) == 4 * sizeof(void *);
+	
+	cout << "\ntest: stats policy, rebalancing counters and descent depths\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_59() {
+	bool OK = true;
+	using Tree = RedBlackTree<int, BottomUpRemovePolicy>;
+	std::mt19937 gen{59};
+	
+	Tree tree;
+	std::set<int> expected;
+	for (int round = 0 ; round < 400 && OK ; ++round) {
+		for (int i = 0 ; i < 50 ; ++i) {
+			int key = (int)(gen() % 2000);
+			tree.add(key);
+			expected.insert(key);
+		}
+		//bounds both present and absent, empty and reversed ranges included
+		int low = (int)(gen() % 2100) - 50;
+		int high = low + (int)(gen() % 300) - 20;
+		auto first = expected.lower_bound(low);
+		auto last = low < high ? expected.lower_bound(high) : first;
+		int erased = (int)std::distance(first, last);
+		expected.erase(first, last);
+		
+		OK &= tree.erase_range(low, high) == erased;
+		OK &= (bool)tree.validate() && tree.size() == (int)expected.size();
+		OK &= std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+		long long sum = 0;
+		for (int key : expected) sum += key;
+		OK &= tree.aggregate() == sum;
+	}
+	OK &= tree.erase_range(std::numeric_limits<int>::min(), std::numeric_limits<int>::max()) == (int)expected.size() && !tree.root;
+	OK &= tree.erase_range(0, 10) == 0;
+	
+	//expiry: timestamps come in ascending, everything below the watermark goes
+	RedBlackTree<int> window;
+	int watermark = 0;
+	for (int now = 0 ; now < 100'000 ; ++now) {
+		window.add(now);
+		if (now % 1000 == 999) {
+			OK &= window.erase_range(watermark, now - 4999) == std::max(0, now - 4999 - watermark);
+			watermark = std::max(watermark, now - 4999);
+		}
+	}
+	OK &= (bool)window.validate() && window.size() == 5000 && *window.begin() == 95'000;
+	window.clear();
+	
+	//all occurrences go with the node
+	RedBlackTree<int, MultisetSizePolicy> counted;
+	for (int key : {1, 2, 2, 2, 3, 4, 4}) {
+		counted.insert(key);
+	}
+	OK &= counted.erase_range(2, 4) == 2 && counted.count(2) == 0 && counted.count(4) == 2 && counted.size() == 2;
+	counted.clear();
+	
+	cout << "\ntest: erase_range with split and join\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_60() {
+	bool OK = true;
+	using Tree = RedBlackTree<int, StatsBottomUpPolicy>;
+	std::mt19937 gen{60};
+	
+	Tree tree;
+	std::set<int> expected;
+	OK &= tree.min() == tree.end() && !tree.pop_max();
+	for (int step = 0 ; step < 20'000 && OK ; ++step) {
+		int key = (int)(gen() % 5000);
+		switch (gen() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			tree.add(key);
+			expected.insert(key);
+			break;
+		case 3:
+			if (Tree::Node *node = tree.pop_min()) {
+				OK &= node->key == *expected.begin();
+				expected.erase(expected.begin());
+				delete node;
+			}
+			break;
+		case 4:
+			if (Tree::Node *node = tree.pop_max()) {
+				OK &= node->key == *expected.rbegin();
+				expected.erase(std::prev(expected.end()));
+				delete node;
+			}
+			break;
+		case 5:
+			delete tree.remove(key);
+			expected.erase(key);
+			break;
+		case 6:
+			if (step % 50 == 0) {
+				tree.erase_range(key, key + 100);
+				expected.erase(expected.lower_bound(key), expected.lower_bound(key + 100));
+			}
+			break;
+		default: {
+			std::vector<int> batch{key, key + 1, key + 7};
+			tree.insert_many(batch);
+			expected.insert(batch.begin(), batch.end());
+			break;
+		}
+		}
+		//validate also checks the cached nodes
+		if (step % 100 == 0) {
+			OK &= (bool)tree.validate();
+		}
+		OK &= expected.empty() ? tree.min() == tree.end() && tree.max() == tree.end()
+			: *tree.min() == *expected.begin() && *tree.max() == *expected.rbegin();
+	}
+	
+	//after a split both sides find their extremes again
+	Tree upper = tree.split(2500);
+	expected.erase(2500);
+	OK &= (bool)tree.validate() && (bool)upper.validate();
+	OK &= *tree.min() == *expected.begin() && *tree.max() == *std::prev(expected.lower_bound(2500));
+	OK &= *upper.min() == *expected.upper_bound(2500) && *upper.max() == *expected.rbegin();
+	upper.clear();
+	
+	//a priority queue: draining takes no searches at all
+	tree.clear();
+	for (int key : {5, 3, 9, 1, 7}) {
+		tree.add(key);
+	}
+	tree.reset_stats();
+	std::vector<int> drained;
+	while (Tree::Node *node = tree.pop_min()) {
+		drained.push_back(node->key);
+		delete node;
+	}
+	OK &= drained == std::vector<int>{1, 3, 5, 7, 9} && tree.stats().descents == 0;
+	
+	cout << "\ntest: cached min and max, pop_min, pop_max\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
+void test_61() {
+	bool OK = true;
+	std::mt19937 gen{61};
+	
+	for (int capacity : {1, 16, 1024}) {
+		BufferedRedBlackTree<int> buffered{capacity};
+		std::set<int> expected;
+		for (int step = 0 ; step < 30'000 && OK ; ++step) {
+			int key = (int)(gen() % 3000);
+			switch (gen() % 4) {
+			case 0:
+			case 1:
+				buffered.add(key);
+				expected.insert(key);
+				break;
+			case 2:
+				buffered.remove(key);
+				expected.erase(key);
+				break;
+			default:
+				//the buffer answers for keys with a pending change
+				OK &= buffered.contains(key) == (expected.count(key) == 1);
+				break;
+			}
+			OK &= (int)buffered.pending.size() < capacity;
+			if (step % 5000 == 0) {
+				RedBlackTree<int>& tree = buffered.flushed();
+				OK &= buffered.pending.empty() && (bool)tree.validate();
+				OK &= std::equal(tree.begin(), tree.end(), expected.begin(), expected.end());
+			}
+		}
+		OK &= buffered.size() == (int)expected.size();
+	}
+	
+	//the latest change of a key wins, in the buffer and once flushed
+	BufferedRedBlackTree<int> buffered;
+	buffered.add(1);
+	buffered.flush();
+	buffered.remove(1);
+	buffered.add(1);
+	buffered.remove(1);
+	buffered.add(2);
+	OK &= !buffered.contains(1) && buffered.contains(2) && buffered.pending.size() == 2;
+	OK &= buffered.size() == 1 && !buffered.contains(1);
+	
+	cout << "\ntest: buffered inserts and removes\n";
+	cout << (OK ? "OK" : "ERROR") << "\n";
+	cout << "\n";
+	
+	return;
+}
+
 int main() {
 	/*
 	test_01();
@@ -1417,6 +3163,32 @@ int main() {
 	// test_35(); //print test
 	
 	test_36();
+	
+	test_37();
+	test_38();
+	test_39();
+	test_40();
+	test_41();
+	test_42();
+	test_43();
+	test_44();
+	test_45();
+	test_46();
+	test_47();
+	test_48();
+	test_49();
+	test_50();
+	test_51();
+	test_52();
+	test_53();
+	test_54();
+	test_55();
+	test_56();
+	test_57();
+	test_58();
+	test_59();
+	test_60();
+	test_61();
 
 	return 0;
 }
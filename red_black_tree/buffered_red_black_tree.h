@@ -0,0 +1,132 @@
+#ifndef BUFFERED_RED_BLACK_TREE_H
+#define BUFFERED_RED_BLACK_TREE_H
+
+#include "red_black_tree.h"
+
+#include<vector>
+
+/*
+  RedBlackTree for bursts of writes: adds and removes wait in a small sorted buffer,
+  which goes into the tree in batches once it is full. a single change waits for one cache miss per level
+  on its way down. a batch of removes first looks up a chunk of its keys with find_many, whose searches
+  overlap their misses, and then takes out the nodes found. a batch of adds goes to insert_many in key order,
+  where each insertion climbs from the previous one and neighbouring keys share the path.
+
+  the buffer holds one pending change per key, the latest. lookups ask the buffer first, then the tree.
+  anything that needs the whole set in order (size, iteration) flushes first.
+  no multisets: a pending add of a key already pending would be lost.
+*/
+template<typename Tval, typename Policy = DefaultTreePolicy>
+struct BufferedRedBlackTree {
+	static_assert(!Policy::multiset, "the buffer keeps one change per key");
+
+	using Tree = RedBlackTree<Tval, Policy>;
+
+	static constexpr int default_capacity = 4096;
+	//removes looked up together before changing the tree. their paths must still be in cache when the changes come
+	static constexpr int flush_chunk = 256;
+
+	struct PendingChange {
+		Tval key;
+		bool is_add;
+	};
+
+	Tree tree;
+	//sorted by key, at most capacity entries
+	std::vector<PendingChange> pending;
+	int capacity;
+	//keys of a flush and their lookups, kept to reuse the allocations
+	std::vector<Tval> staged_adds;
+	std::vector<Tval> staged_removes;
+	std::vector<typename Tree::iterator> found;
+
+	void add(const Tval& new_val) { change(new_val, true); }
+	void remove(const Tval& target_key) { change(target_key, false); }
+	bool contains(const Tval& target_key) const;
+	void flush();
+
+	//the tree with every pending change applied, e.g. for ordered iteration
+	Tree& flushed() { flush(); return tree; }
+	int size() { flush(); return tree.size(); }
+
+	void change(const Tval& key, bool is_add);
+
+	explicit BufferedRedBlackTree(int capacity = default_capacity)
+		: capacity{capacity}
+	{
+		pending.reserve(capacity);
+	}
+
+	BufferedRedBlackTree(const BufferedRedBlackTree&) = delete;
+	BufferedRedBlackTree& operator=(const BufferedRedBlackTree&) = delete;
+
+	~BufferedRedBlackTree() {
+		tree.clear();
+	}
+};
+
+
+/**
+ *  records the change, replacing one pending for the same key. a full buffer is flushed
+ */
+template<typename Tval, typename Policy>
+void BufferedRedBlackTree<Tval, Policy>::change(const Tval& key, bool is_add) {
+	auto slot = std::lower_bound(pending.begin(), pending.end(), key, [](const PendingChange& change, const Tval& key) {
+		return Tree::is_less(change.key, key);
+	});
+	if (slot != pending.end() && Tree::is_equal(slot->key, key)) {
+		slot->is_add = is_add;
+		return;
+	}
+	pending.insert(slot, PendingChange{key, is_add});
+	if ((int)pending.size() >= capacity) {
+		flush();
+	}
+	return;
+}
+
+/**
+ *  @return true if the latest change of target_key added it, looks in the tree if there is none
+ */
+template<typename Tval, typename Policy>
+bool BufferedRedBlackTree<Tval, Policy>::contains(const Tval& target_key) const {
+	auto slot = std::lower_bound(pending.begin(), pending.end(), target_key, [](const PendingChange& change, const Tval& key) {
+		return Tree::is_less(change.key, key);
+	});
+	if (slot != pending.end() && Tree::is_equal(slot->key, target_key)) {
+		return slot->is_add;
+	}
+	bool result = tree.find(target_key) != tree.end();
+	return result;
+}
+
+/**
+ *  applies the pending changes: removes chunk by chunk, see flush_chunk, then all adds in one insert_many
+ */
+template<typename Tval, typename Policy>
+void BufferedRedBlackTree<Tval, Policy>::flush() {
+	staged_adds.clear();
+	staged_removes.clear();
+	for (const PendingChange& change : pending) {
+		(change.is_add ? staged_adds : staged_removes).push_back(change.key);
+	}
+	pending.clear();
+	
+	for (size_t first = 0 ; first < staged_removes.size() ; first += flush_chunk) {
+		std::span<const Tval> chunk{staged_removes.data() + first, std::min<size_t>(flush_chunk, staged_removes.size() - first)};
+		found.assign(chunk.size(), tree.end());
+		tree.find_many(chunk, found);
+		//NOTE: nodes keep their keys while others are removed, so the ones found stay valid
+		for (typename Tree::iterator node : found) {
+			if (node != tree.end()) {
+				delete tree.remove_node(node.node);
+			}
+		}
+	}
+	//NOTE: no lookups ahead for the adds. insert_many finds its own way from the previous key,
+	//and the parents a lookup found would not survive the rotations of the adds before
+	tree.insert_many(staged_adds);
+	return;
+}
+
+#endif //BUFFERED_RED_BLACK_TREE_H
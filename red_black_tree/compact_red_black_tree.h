@@ -0,0 +1,701 @@
+#ifndef COMPACT_RED_BLACK_TREE_H
+#define COMPACT_RED_BLACK_TREE_H
+
+#include "red_black_tree.h"
+
+#include<cstdint>
+
+/*
+  memory-lean variant of RedBlackTree for large sets of small keys.
+  RedBlackTree::Node carries three pointers, a bool and padding: 40 bytes for an int key.
+  the same left-leaning balancing runs here on top of a node layout that only hands out handles:
+
+  PackedPointerLayout: the color lives in bit 0 of the parent pointer      -> 32 bytes per int key
+  IndexPoolLayout:     nodes live in one contiguous pool, linked by 32-bit
+                       indices, the color lives in bit 31 of the parent index -> 16 bytes per int key
+
+  keys are never moved between nodes, handles stay valid until remove() releases their node
+  (for IndexPoolLayout: a released index is handed out again by a later add(), and the pool may grow,
+  so don't keep raw Node pointers across add()).
+*/
+
+template<typename Tval>
+struct PackedPointerLayout {
+	struct Node {
+		Tval key;
+		Node *left = nullptr;
+		Node *right = nullptr;
+		uintptr_t parent_and_color = 0;
+	};
+	static_assert(alignof(Node) >= 2, "bit 0 of a Node pointer must be free");
+
+	using Handle = Node*;
+	static constexpr Handle null = nullptr;
+	static constexpr uintptr_t red_bit = 1;
+
+	Handle allocate(const Tval& key) {
+		Handle result = new Node{key};
+		return result;
+	}
+
+	void release(Handle node) {
+		delete node;
+	}
+
+	//post-order without a stack: a node is freed once both children are gone
+	void release_all(Handle root) {
+		Handle current = root;
+		while (current) {
+			if (current->left) {
+				current = current->left;
+			} else if (current->right) {
+				current = current->right;
+			} else {
+				Handle up = parent(current);
+				if (up) {
+					if (up->left == current) up->left = nullptr;
+					else up->right = nullptr;
+				}
+				delete current;
+				current = up;
+			}
+		}
+		return;
+	}
+
+	void reserve(size_t) {}
+
+	const Tval& key(Handle node) const { return node->key; }
+	Handle left(Handle node) const { return node->left; }
+	Handle right(Handle node) const { return node->right; }
+	Handle parent(Handle node) const { return (Handle)(node->parent_and_color & ~red_bit); }
+	bool is_red(Handle node) const { return node->parent_and_color & red_bit; }
+
+	void set_left(Handle node, Handle child) { node->left = child; }
+	void set_right(Handle node, Handle child) { node->right = child; }
+
+	void set_parent(Handle node, Handle parent) {
+		node->parent_and_color = (uintptr_t)parent | (node->parent_and_color & red_bit);
+	}
+
+	void set_red(Handle node, bool red) {
+		node->parent_and_color = (node->parent_and_color & ~red_bit) | (red ? red_bit : 0);
+	}
+};
+
+template<typename Tval>
+struct IndexPoolLayout {
+	struct Node {
+		Tval key;
+		uint32_t left;
+		uint32_t right;
+		uint32_t parent_and_color;
+	};
+
+	using Handle = uint32_t;
+	static constexpr Handle null = 0x7fff'ffff; //also the largest possible node count
+	static constexpr uint32_t red_bit = 0x8000'0000;
+
+	std::vector<Node> pool;
+	std::vector<Handle> free_slots;
+
+	Handle allocate(const Tval& key) {
+		Handle result = null;
+		if (!free_slots.empty()) {
+			result = free_slots.back();
+			free_slots.pop_back();
+			pool[result] = Node{key, null, null, null};
+		} else {
+			assert(pool.size() < null);
+			result = (Handle)pool.size();
+			pool.push_back(Node{key, null, null, null});
+		}
+		return result;
+	}
+
+	void release(Handle node) {
+		free_slots.push_back(node);
+	}
+
+	void release_all(Handle) {
+		pool.clear();
+		free_slots.clear();
+		return;
+	}
+
+	void reserve(size_t count) {
+		pool.reserve(count);
+	}
+
+	const Tval& key(Handle node) const { return pool[node].key; }
+	Handle left(Handle node) const { return pool[node].left; }
+	Handle right(Handle node) const { return pool[node].right; }
+	Handle parent(Handle node) const { return pool[node].parent_and_color & ~red_bit; }
+	bool is_red(Handle node) const { return pool[node].parent_and_color & red_bit; }
+
+	void set_left(Handle node, Handle child) { pool[node].left = child; }
+	void set_right(Handle node, Handle child) { pool[node].right = child; }
+
+	void set_parent(Handle node, Handle parent) {
+		pool[node].parent_and_color = parent | (pool[node].parent_and_color & red_bit);
+	}
+
+	void set_red(Handle node, bool red) {
+		pool[node].parent_and_color = (pool[node].parent_and_color & ~red_bit) | (red ? red_bit : 0);
+	}
+};
+
+
+template<typename Tval, template<typename> class Layout = PackedPointerLayout, typename Policy = DefaultTreePolicy>
+struct CompactRedBlackTree {
+
+	using Storage = Layout<Tval>;
+	using Handle = typename Storage::Handle;
+	static constexpr Handle null = Storage::null;
+	static constexpr size_t node_bytes = sizeof(typename Storage::Node);
+
+	using Compare = typename Policy::Compare;
+
+	template<typename A, typename B>
+	static auto order(const A& a, const B& b) { return Compare{}(a, b); }
+
+	template<typename A, typename B>
+	static bool is_less(const A& a, const B& b) { return order(a, b) < 0; }
+
+	struct iterator {
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = Tval;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Tval*;
+		using reference = const Tval&;
+
+		Handle node = null; //null means end()
+		const CompactRedBlackTree *tree = nullptr;
+
+		reference operator*() const { return tree->nodes.key(node); }
+		pointer operator->() const { return &tree->nodes.key(node); }
+
+		iterator& operator++() {
+			node = tree->next(node);
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator before = *this;
+			++*this;
+			return before;
+		}
+
+		iterator& operator--() {
+			node = (node != null) ? tree->prev(node) : tree->rightmost(tree->root);
+			return *this;
+		}
+
+		iterator operator--(int) {
+			iterator before = *this;
+			--*this;
+			return before;
+		}
+
+		bool operator==(const iterator& other) const {
+			return node == other.node;
+		}
+	};
+	using const_iterator = iterator;
+
+	Storage nodes;
+	Handle root = null;
+	int count = 0;
+
+	bool add(const Tval& new_val);
+	bool remove(const Tval& target_key);
+	template<std::forward_iterator It>
+	void assign_sorted(It first, It last);
+	void clear();
+
+	template<typename Tkey = Tval>
+	iterator find(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	bool contains(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	iterator lower_bound(const Tkey& target_key) const;
+
+	int size() const { return count; }
+	iterator begin() const;
+	iterator end() const;
+
+	void rotate_left(Handle node);
+	void rotate_right(Handle node);
+	void replace_in_parent(Handle old_child, Handle new_child);
+	void fix_up_add(Handle node);
+	void remove_node(Handle target);
+	void fix_black_deficit(Handle node, bool left_is_short);
+	Handle next(Handle node) const;
+	Handle prev(Handle node) const;
+	Handle leftmost(Handle node) const;
+	Handle rightmost(Handle node) const;
+	template<typename It>
+	Handle build_sorted(It *cur, It last, int count, int height);
+
+	CompactRedBlackTree()
+	{}
+
+	template<std::forward_iterator It>
+	CompactRedBlackTree(It first, It last)
+	{
+		assign_sorted(first, last);
+	}
+};
+
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::replace_in_parent(Handle old_child, Handle new_child) {
+	Handle parent = nodes.parent(old_child);
+	if (parent == null) {
+		root = new_child;
+	} else if (nodes.left(parent) == old_child) {
+		nodes.set_left(parent, new_child);
+	} else {
+		nodes.set_right(parent, new_child);
+	}
+	if (new_child != null) {
+		nodes.set_parent(new_child, parent);
+	}
+	return;
+}
+
+//"become the left child of my right child", colors stay as they are
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::rotate_left(Handle node) {
+	Handle right = nodes.right(node);
+	assert(right != null);
+
+	Handle middle = nodes.left(right);
+	nodes.set_right(node, middle);
+	if (middle != null) {
+		nodes.set_parent(middle, node);
+	}
+
+	replace_in_parent(node, right);
+	nodes.set_left(right, node);
+	nodes.set_parent(node, right);
+	return;
+}
+
+//"become the right child of my left child", colors stay as they are
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::rotate_right(Handle node) {
+	Handle left = nodes.left(node);
+	assert(left != null);
+
+	Handle middle = nodes.right(left);
+	nodes.set_left(node, middle);
+	if (middle != null) {
+		nodes.set_parent(middle, node);
+	}
+
+	replace_in_parent(node, left);
+	nodes.set_right(left, node);
+	nodes.set_parent(node, left);
+	return;
+}
+
+//same cases as RedBlackTree::Node::fix_up_add, as a loop
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::fix_up_add(Handle node) {
+	Handle current = node;
+
+	while (true) {
+		assert(nodes.is_red(current));
+		Handle parent = nodes.parent(current);
+
+		if (parent == null) {
+			nodes.set_red(current, false);
+			break;
+		}
+
+		if (!nodes.is_red(parent)) {
+			if (nodes.left(parent) == current) {
+				break;
+			}
+			Handle sibling = nodes.left(parent);
+			if (sibling != null && nodes.is_red(sibling)) {
+				//split the 4-node, push the middle key up
+				nodes.set_red(sibling, false);
+				nodes.set_red(current, false);
+				nodes.set_red(parent, true);
+				current = parent;
+			} else {
+				//right-leaning 3-node, turn it around
+				rotate_left(parent);
+				nodes.set_red(current, false);
+				nodes.set_red(parent, true);
+				break;
+			}
+		} else {
+			Handle grandparent = nodes.parent(parent);
+			assert(grandparent != null);
+			if (nodes.left(parent) == current) {
+				rotate_right(grandparent);
+				nodes.set_red(current, false);
+				current = parent;
+			} else {
+				rotate_left(parent);
+				rotate_right(grandparent);
+				nodes.set_red(parent, false);
+			}
+		}
+	}
+	return;
+}
+
+/**
+ *  @return false if new_val already exists
+ */
+template<typename Tval, template<typename> class Layout, typename Policy>
+bool CompactRedBlackTree<Tval, Layout, Policy>::add(const Tval& new_val) {
+	Handle parent = null;
+	Handle current = root;
+	bool go_left = false;
+
+	while (current != null) {
+		auto comparison = order(new_val, nodes.key(current));
+		if (comparison == 0) {
+			return false;
+		}
+		parent = current;
+		go_left = comparison < 0;
+		current = go_left ? nodes.left(current) : nodes.right(current);
+	}
+
+	Handle new_node = nodes.allocate(new_val);
+	nodes.set_parent(new_node, parent);
+	nodes.set_red(new_node, true);
+	if (parent == null) {
+		root = new_node;
+	} else if (go_left) {
+		nodes.set_left(parent, new_node);
+	} else {
+		nodes.set_right(parent, new_node);
+	}
+	++count;
+
+	fix_up_add(new_node);
+	return true;
+}
+
+/**
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, template<typename> class Layout, typename Policy>
+bool CompactRedBlackTree<Tval, Layout, Policy>::remove(const Tval& target_key) {
+	Handle target = find(target_key).node;
+	if (target == null) {
+		return false;
+	}
+	remove_node(target);
+	return true;
+}
+
+//same steps as RedBlackTree::remove_node. the successor is relinked into target's place, never copied
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::remove_node(Handle target) {
+	Handle bottom = (nodes.right(target) != null) ? leftmost(nodes.right(target)) : target;
+	Handle bottom_parent = nodes.parent(bottom);
+	Handle child = nodes.left(bottom);
+
+	if (child != null) {
+		//black node of a 3-node with its red key below, that key takes its place
+		nodes.set_red(child, false);
+		replace_in_parent(bottom, child);
+	} else {
+		bool was_left = bottom_parent != null && nodes.left(bottom_parent) == bottom;
+		replace_in_parent(bottom, null);
+		if (bottom_parent != null && !nodes.is_red(bottom)) {
+			fix_black_deficit(bottom_parent, was_left);
+		}
+	}
+
+	if (bottom != target) {
+		Handle left = nodes.left(target);
+		Handle right = nodes.right(target);
+		nodes.set_left(bottom, left);
+		nodes.set_right(bottom, right);
+		if (left != null) nodes.set_parent(left, bottom);
+		if (right != null) nodes.set_parent(right, bottom);
+		nodes.set_red(bottom, nodes.is_red(target));
+		replace_in_parent(target, bottom);
+	}
+
+	if (root != null) {
+		nodes.set_red(root, false);
+	}
+	nodes.release(target);
+	--count;
+	return;
+}
+
+//same cases as RedBlackTree::Node::fix_black_deficit
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::fix_black_deficit(Handle node, bool left_is_short) {
+	Handle current = node;
+
+	while (current != null) {
+		bool was_red = nodes.is_red(current);
+		Handle next_short = null;
+		if (left_is_short) {
+			Handle sibling = nodes.right(current);
+			Handle nephew = nodes.left(sibling);
+			if (nephew != null && nodes.is_red(nephew)) {
+				//borrow: the sibling's red key moves up
+				rotate_right(sibling);
+				rotate_left(current);
+				nodes.set_red(nephew, was_red);
+				nodes.set_red(sibling, false);
+				nodes.set_red(current, false);
+				break;
+			}
+			//merge into a 3-node under the sibling, which takes our place
+			rotate_left(current);
+			nodes.set_red(sibling, false);
+			nodes.set_red(current, true);
+			next_short = sibling;
+		} else {
+			Handle sibling = nodes.left(current);
+			if (nodes.is_red(sibling)) {
+				//the short subtree is the right one of a 3-node, the middle subtree is the neighbour
+				Handle middle = nodes.right(sibling);
+				Handle middle_left = nodes.left(middle);
+				if (middle_left != null && nodes.is_red(middle_left)) {
+					rotate_left(sibling);
+					rotate_right(current);
+					nodes.set_red(middle, false);
+					nodes.set_red(sibling, true);
+					nodes.set_red(middle_left, false);
+				} else {
+					rotate_right(current);
+					nodes.set_red(sibling, false);
+					nodes.set_red(middle, true);
+				}
+				nodes.set_red(current, false);
+				break;
+			}
+			Handle nephew = nodes.left(sibling);
+			if (nephew != null && nodes.is_red(nephew)) {
+				rotate_right(current);
+				nodes.set_red(sibling, was_red);
+				nodes.set_red(nephew, false);
+				nodes.set_red(current, false);
+				break;
+			}
+			//merge: the sibling becomes our red key
+			nodes.set_red(sibling, true);
+			nodes.set_red(current, false);
+			next_short = current;
+		}
+
+		if (was_red) {
+			//the parent 3-node gave up a key, its black height stays
+			break;
+		}
+		current = nodes.parent(next_short);
+		left_is_short = current != null && nodes.left(current) == next_short;
+	}
+	return;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+void CompactRedBlackTree<Tval, Layout, Policy>::clear() {
+	nodes.release_all(root);
+	root = null;
+	count = 0;
+	return;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+template<typename It>
+CompactRedBlackTree<Tval, Layout, Policy>::Handle CompactRedBlackTree<Tval, Layout, Policy>::build_sorted(It *cur, It last, int count, int height) {
+	if (height == 0) {
+		assert(count == 0);
+		return null;
+	}
+
+	long long child_capacity = 1;
+	for (int i = 1 ; i < height ; ++i) {
+		child_capacity *= 3;
+	}
+	child_capacity -= 1;
+
+	auto take_node = [this, cur, last]() {
+		Handle node = nodes.allocate(**cur);
+		Tval key = **cur;
+		++*cur;
+		while (*cur != last && !is_less(key, **cur)) {
+			++*cur;
+		}
+		return node;
+	};
+
+	auto link = [this](Handle node, Handle left, Handle right) {
+		nodes.set_left(node, left);
+		nodes.set_right(node, right);
+		if (left != null) nodes.set_parent(left, node);
+		if (right != null) nodes.set_parent(right, node);
+	};
+
+	//same shape as RedBlackTree::Node::build_sorted
+	Handle result = null;
+	if (count - 1 <= 2 * child_capacity) {
+		int right_count = (count - 1) / 2;
+		int left_count = count - 1 - right_count;
+
+		Handle left_tree = build_sorted(cur, last, left_count, height - 1);
+		result = take_node();
+		link(result, left_tree, build_sorted(cur, last, right_count, height - 1));
+	} else {
+		int remaining = count - 2;
+		int first_count = (remaining + 2) / 3;
+		int middle_count = (remaining + 1) / 3;
+		int last_count = remaining / 3;
+
+		Handle first_tree = build_sorted(cur, last, first_count, height - 1);
+		Handle red = take_node();
+		link(red, first_tree, build_sorted(cur, last, middle_count, height - 1));
+		nodes.set_red(red, true);
+
+		result = take_node();
+		link(result, red, build_sorted(cur, last, last_count, height - 1));
+	}
+	return result;
+}
+
+/**
+ *  replaces the contents with the sorted keys in [first, last). duplicates are skipped.
+ *  linear time, and IndexPoolLayout allocates the pool once.
+ */
+template<typename Tval, template<typename> class Layout, typename Policy>
+template<std::forward_iterator It>
+void CompactRedBlackTree<Tval, Layout, Policy>::assign_sorted(It first, It last) {
+	clear();
+
+	int new_count = 0;
+	for (It cur = first ; cur != last ; ) {
+		Tval key = *cur;
+		++new_count;
+		while (cur != last && !is_less(key, *cur)) {
+			++cur;
+		}
+	}
+
+	int height = 0;
+	while ((2ll << height) - 1 <= new_count) {
+		++height;
+	}
+
+	nodes.reserve(new_count);
+	It cur = first;
+	root = build_sorted(&cur, last, new_count, height);
+	if (root != null) {
+		nodes.set_parent(root, null);
+	}
+	count = new_count;
+	return;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+template<typename Tkey>
+CompactRedBlackTree<Tval, Layout, Policy>::iterator CompactRedBlackTree<Tval, Layout, Policy>::find(const Tkey& target_key) const {
+	Handle current = root;
+	while (current != null) {
+		auto comparison = order(target_key, nodes.key(current));
+		if (comparison == 0) {
+			break;
+		}
+		current = (comparison < 0) ? nodes.left(current) : nodes.right(current);
+	}
+	iterator result{current, this};
+	return result;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+template<typename Tkey>
+bool CompactRedBlackTree<Tval, Layout, Policy>::contains(const Tkey& target_key) const {
+	bool result = find(target_key).node != null;
+	return result;
+}
+
+/**
+ *  @return first key not less than target_key
+ */
+template<typename Tval, template<typename> class Layout, typename Policy>
+template<typename Tkey>
+CompactRedBlackTree<Tval, Layout, Policy>::iterator CompactRedBlackTree<Tval, Layout, Policy>::lower_bound(const Tkey& target_key) const {
+	Handle found = null;
+	Handle current = root;
+	while (current != null) {
+		if (is_less(nodes.key(current), target_key)) {
+			current = nodes.right(current);
+		} else {
+			found = current;
+			current = nodes.left(current);
+		}
+	}
+	iterator result{found, this};
+	return result;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+CompactRedBlackTree<Tval, Layout, Policy>::Handle CompactRedBlackTree<Tval, Layout, Policy>::leftmost(Handle node) const {
+	while (nodes.left(node) != null) {
+		node = nodes.left(node);
+	}
+	return node;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+CompactRedBlackTree<Tval, Layout, Policy>::Handle CompactRedBlackTree<Tval, Layout, Policy>::rightmost(Handle node) const {
+	while (nodes.right(node) != null) {
+		node = nodes.right(node);
+	}
+	return node;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+CompactRedBlackTree<Tval, Layout, Policy>::Handle CompactRedBlackTree<Tval, Layout, Policy>::next(Handle node) const {
+	if (nodes.right(node) != null) {
+		return leftmost(nodes.right(node));
+	}
+	Handle parent = nodes.parent(node);
+	while (parent != null && nodes.right(parent) == node) {
+		node = parent;
+		parent = nodes.parent(node);
+	}
+	return parent;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+CompactRedBlackTree<Tval, Layout, Policy>::Handle CompactRedBlackTree<Tval, Layout, Policy>::prev(Handle node) const {
+	if (nodes.left(node) != null) {
+		return rightmost(nodes.left(node));
+	}
+	Handle parent = nodes.parent(node);
+	while (parent != null && nodes.left(parent) == node) {
+		node = parent;
+		parent = nodes.parent(node);
+	}
+	return parent;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+CompactRedBlackTree<Tval, Layout, Policy>::iterator CompactRedBlackTree<Tval, Layout, Policy>::begin() const {
+	iterator result{(root != null) ? leftmost(root) : null, this};
+	return result;
+}
+
+template<typename Tval, template<typename> class Layout, typename Policy>
+CompactRedBlackTree<Tval, Layout, Policy>::iterator CompactRedBlackTree<Tval, Layout, Policy>::end() const {
+	iterator result{null, this};
+	return result;
+}
+
+#endif //COMPACT_RED_BLACK_TREE_H
@@ -0,0 +1,339 @@
+#ifndef CONCURRENT_RED_BLACK_TREE_H
+#define CONCURRENT_RED_BLACK_TREE_H
+
+#include "path_copying_core.h"
+
+#include<atomic>
+#include<mutex>
+#include<optional>
+#include<vector>
+#include<utility>
+#include<cstdint>
+
+/*
+  ordered set for many reading threads and one writer at a time, read-copy-update style.
+  RedBlackTree rotates nodes in place, so a reader walking it without a lock could follow a link
+  in the middle of a rotation. here a write copies its search path (see PathCopyingCore) and
+  publishes the new root with one atomic store. readers take no lock and never wait: they pin
+  the current epoch, load the root and see one consistent version until they unpin.
+
+  nodes a write replaced are kept until every reader that could still see them has unpinned.
+  the writer tags them with the epoch of the write and advances the epoch, a batch is freed
+  once no reader is pinned at that epoch or earlier.
+*/
+template<typename Tval, typename Compare = std::compare_three_way>
+struct ConcurrentRedBlackTree {
+
+	struct Node {
+		Tval key;
+		Node *left = nullptr;
+		Node *right = nullptr;
+		bool is_red = true;
+		uint64_t version = 0; //the write that created the node
+	};
+
+	using Core = PathCopyingCore<Tval, Compare, ConcurrentRedBlackTree>;
+
+	static constexpr int max_readers = 128;
+	static constexpr uint64_t not_pinned = 0;
+
+	//one per reader, on its own cache line so pinning doesn't bounce lines between cores
+	struct alignas(64) ReaderSlot {
+		std::atomic<uint64_t> epoch{not_pinned};
+		std::atomic<bool> is_taken{false};
+	};
+
+	struct RetiredBatch {
+		uint64_t epoch;
+		std::vector<Node *> nodes;
+	};
+
+	/*
+	  a reading thread's handle. lookups pin and unpin around themselves,
+	  pin()/unpin() hold one version for longer reads such as a scan.
+	*/
+	struct Reader {
+		ConcurrentRedBlackTree *tree = nullptr;
+		ReaderSlot *slot = nullptr;
+
+		const Node *pin();
+		void unpin();
+
+		template<typename Tkey = Tval>
+		bool contains(const Tkey& target_key);
+		template<typename Tkey = Tval>
+		std::optional<Tval> find(const Tkey& target_key);
+		template<typename Tkey = Tval>
+		std::optional<Tval> lower_bound(const Tkey& target_key);
+		template<typename F>
+		void for_each(F&& visit);
+
+		Reader(ConcurrentRedBlackTree *tree_);
+		Reader(Reader&& other) :tree{other.tree}, slot{other.slot} { other.slot = nullptr; }
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+		~Reader();
+	};
+
+	std::atomic<Node *> root{nullptr};
+	std::atomic<uint64_t> epoch{1};
+	std::atomic<int> key_count{0};
+	ReaderSlot slots[max_readers];
+
+	//writer state
+	std::mutex write_lock;
+	uint64_t version = 1; //nodes of this version are not published yet and can change in place
+	std::vector<Node *> retired;
+	std::vector<RetiredBatch> limbo;
+
+	bool add(const Tval& new_val);
+	bool remove(const Tval& target_key);
+	int size() const { return key_count.load(std::memory_order_relaxed); }
+	Reader reader() { return Reader{this}; }
+
+	void publish(Node *new_root);
+	void reclaim();
+	static void delete_subtree(Node *node);
+
+	//called by PathCopyingCore
+	Node *make(const Tval& key);
+	Node *own(Node *node);
+	void retire(Node *node);
+
+	ConcurrentRedBlackTree()
+	{}
+
+	ConcurrentRedBlackTree(const ConcurrentRedBlackTree&) = delete;
+	ConcurrentRedBlackTree& operator=(const ConcurrentRedBlackTree&) = delete;
+
+	//no reader may be alive
+	~ConcurrentRedBlackTree();
+};
+
+
+template<typename Tval, typename Compare>
+ConcurrentRedBlackTree<Tval, Compare>::Node *ConcurrentRedBlackTree<Tval, Compare>::make(const Tval& key) {
+	Node *result = new Node{key};
+	result->version = version;
+	return result;
+}
+
+template<typename Tval, typename Compare>
+ConcurrentRedBlackTree<Tval, Compare>::Node *ConcurrentRedBlackTree<Tval, Compare>::own(Node *node) {
+	if (node->version == version) {
+		return node;
+	}
+	Node *result = new Node{*node};
+	result->version = version;
+	retire(node);
+	return result;
+}
+
+template<typename Tval, typename Compare>
+void ConcurrentRedBlackTree<Tval, Compare>::retire(Node *node) {
+	if (node->version == version) {
+		//no reader has seen it
+		delete node;
+	} else {
+		retired.push_back(node);
+	}
+	return;
+}
+
+/**
+ *  makes the write visible. readers that pin after this see new_root.
+ */
+template<typename Tval, typename Compare>
+void ConcurrentRedBlackTree<Tval, Compare>::publish(Node *new_root) {
+	root.store(new_root, std::memory_order_seq_cst);
+
+	//readers pinned at this epoch or earlier may have loaded the old root
+	uint64_t unlinked_epoch = epoch.fetch_add(1, std::memory_order_seq_cst);
+	if (!retired.empty()) {
+		limbo.push_back(RetiredBatch{unlinked_epoch, std::move(retired)});
+		retired.clear();
+	}
+	++version;
+
+	reclaim();
+	return;
+}
+
+template<typename Tval, typename Compare>
+void ConcurrentRedBlackTree<Tval, Compare>::reclaim() {
+	if (limbo.empty()) {
+		return;
+	}
+
+	uint64_t oldest_pinned = UINT64_MAX;
+	for (ReaderSlot& slot : slots) {
+		uint64_t pinned = slot.epoch.load(std::memory_order_seq_cst);
+		if (pinned != not_pinned && pinned < oldest_pinned) {
+			oldest_pinned = pinned;
+		}
+	}
+
+	//batches are in epoch order
+	size_t freed = 0;
+	while (freed < limbo.size() && limbo[freed].epoch < oldest_pinned) {
+		for (Node *node : limbo[freed].nodes) {
+			delete node;
+		}
+		++freed;
+	}
+	limbo.erase(limbo.begin(), limbo.begin() + freed);
+	return;
+}
+
+/**
+ *  @return false if new_val already exists
+ */
+template<typename Tval, typename Compare>
+bool ConcurrentRedBlackTree<Tval, Compare>::add(const Tval& new_val) {
+	std::lock_guard<std::mutex> guard{write_lock};
+
+	bool added = false;
+	Node *new_root = Core::add(*this, root.load(std::memory_order_relaxed), new_val, &added);
+	if (added) {
+		key_count.fetch_add(1, std::memory_order_relaxed);
+		publish(new_root);
+	}
+	return added;
+}
+
+/**
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, typename Compare>
+bool ConcurrentRedBlackTree<Tval, Compare>::remove(const Tval& target_key) {
+	std::lock_guard<std::mutex> guard{write_lock};
+
+	bool removed = false;
+	Node *new_root = Core::remove(*this, root.load(std::memory_order_relaxed), target_key, &removed);
+	if (removed) {
+		key_count.fetch_sub(1, std::memory_order_relaxed);
+		publish(new_root);
+	}
+	return removed;
+}
+
+template<typename Tval, typename Compare>
+void ConcurrentRedBlackTree<Tval, Compare>::delete_subtree(Node *node) {
+	if (!node) {
+		return;
+	}
+	delete_subtree(node->left);
+	delete_subtree(node->right);
+	delete node;
+	return;
+}
+
+template<typename Tval, typename Compare>
+ConcurrentRedBlackTree<Tval, Compare>::~ConcurrentRedBlackTree() {
+	delete_subtree(root.load());
+	for (RetiredBatch& batch : limbo) {
+		for (Node *node : batch.nodes) {
+			delete node;
+		}
+	}
+}
+
+
+template<typename Tval, typename Compare>
+ConcurrentRedBlackTree<Tval, Compare>::Reader::Reader(ConcurrentRedBlackTree *tree_)
+:tree{tree_}
+{
+	for (ReaderSlot& candidate : tree->slots) {
+		bool expected = false;
+		if (!candidate.is_taken.load(std::memory_order_relaxed) && candidate.is_taken.compare_exchange_strong(expected, true)) {
+			slot = &candidate;
+			break;
+		}
+	}
+	assert(slot); //more than max_readers readers at once
+}
+
+template<typename Tval, typename Compare>
+ConcurrentRedBlackTree<Tval, Compare>::Reader::~Reader() {
+	if (slot) {
+		slot->epoch.store(not_pinned, std::memory_order_release);
+		slot->is_taken.store(false, std::memory_order_release);
+	}
+}
+
+/**
+ *  @return the current root. it and everything below stays valid until unpin()
+ */
+template<typename Tval, typename Compare>
+const ConcurrentRedBlackTree<Tval, Compare>::Node *ConcurrentRedBlackTree<Tval, Compare>::Reader::pin() {
+	//NOTE: the slot must be visible to the writer before we load the root, hence seq_cst on both
+	slot->epoch.store(tree->epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+	const Node *result = tree->root.load(std::memory_order_seq_cst);
+	return result;
+}
+
+template<typename Tval, typename Compare>
+void ConcurrentRedBlackTree<Tval, Compare>::Reader::unpin() {
+	slot->epoch.store(not_pinned, std::memory_order_release);
+	return;
+}
+
+template<typename Tval, typename Compare>
+template<typename Tkey>
+bool ConcurrentRedBlackTree<Tval, Compare>::Reader::contains(const Tkey& target_key) {
+	const Node *current_root = pin();
+	bool result = Core::find(current_root, target_key) != nullptr;
+	unpin();
+	return result;
+}
+
+/**
+ *  @return a copy of the stored key equal to target_key
+ */
+template<typename Tval, typename Compare>
+template<typename Tkey>
+std::optional<Tval> ConcurrentRedBlackTree<Tval, Compare>::Reader::find(const Tkey& target_key) {
+	std::optional<Tval> result;
+	const Node *found = Core::find(pin(), target_key);
+	if (found) {
+		result = found->key;
+	}
+	unpin();
+	return result;
+}
+
+template<typename Tval, typename Compare>
+template<typename Tkey>
+std::optional<Tval> ConcurrentRedBlackTree<Tval, Compare>::Reader::lower_bound(const Tkey& target_key) {
+	std::optional<Tval> result;
+	const Node *found = Core::lower_bound(pin(), target_key);
+	if (found) {
+		result = found->key;
+	}
+	unpin();
+	return result;
+}
+
+/**
+ *  calls visit on every key in order, all from the same version
+ */
+template<typename Tval, typename Compare>
+template<typename F>
+void ConcurrentRedBlackTree<Tval, Compare>::Reader::for_each(F&& visit) {
+	const Node *current = pin();
+	std::vector<const Node *> pending;
+	while (current || !pending.empty()) {
+		while (current) {
+			pending.push_back(current);
+			current = current->left;
+		}
+		current = pending.back();
+		pending.pop_back();
+		visit(current->key);
+		current = current->right;
+	}
+	unpin();
+	return;
+}
+
+#endif //CONCURRENT_RED_BLACK_TREE_H
@@ -0,0 +1,117 @@
+#ifndef FROZEN_RED_BLACK_TREE_H
+#define FROZEN_RED_BLACK_TREE_H
+
+#include "red_black_tree.h"
+
+#include<new>
+#include<vector>
+#include<cstdint>
+
+/*
+  immutable copy of a RedBlackTree for read-mostly phases, in Eytzinger order:
+  the implicit binary search tree of the sorted keys stored breadth-first, root at index 1,
+  children of k at 2k and 2k+1. the top levels share a few cache lines that stay hot,
+  and a search needs no pointers and no branches that depend on the keys.
+
+  while a search is at k, the 16 (for 4-byte keys) descendants four levels below
+  lie in one cache line starting at index 16k, which is prefetched ahead.
+*/
+
+template<typename T>
+struct CacheLineAllocator {
+	using value_type = T;
+	static constexpr std::align_val_t alignment{64};
+
+	CacheLineAllocator() = default;
+	template<typename U>
+	CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+	T *allocate(size_t count) { return (T *)::operator new(count * sizeof(T), alignment); }
+	void deallocate(T *data, size_t) { ::operator delete(data, alignment); }
+
+	template<typename U>
+	bool operator==(const CacheLineAllocator<U>&) const { return true; }
+};
+
+template<typename Tval, typename Policy = DefaultTreePolicy>
+struct FrozenRedBlackTree {
+	using Compare = typename Policy::Compare;
+
+	//keys per cache line. the line at index k * keys_per_line holds the descendants of k that many levels down
+	static constexpr int keys_per_line = sizeof(Tval) >= 64 ? 1 : int(64 / sizeof(Tval));
+
+	//index 0 is unused
+	std::vector<Tval, CacheLineAllocator<Tval>> keys;
+	int key_count = 0;
+
+	template<typename Tkey = Tval>
+	const Tval *lower_bound(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	const Tval *find(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	bool contains(const Tkey& target_key) const { return find(target_key) != nullptr; }
+	int size() const { return key_count; }
+
+	int fill(const Tval *sorted, int next, int index);
+
+	FrozenRedBlackTree()
+	{}
+
+	//O(n): the keys come out of inorder_to_buf and go straight to their Eytzinger positions
+	explicit FrozenRedBlackTree(const RedBlackTree<Tval, Policy>& tree)
+	{
+		std::vector<Tval> sorted(tree.size());
+		if (tree.root) {
+			tree.root->inorder_to_buf(sorted.data());
+		}
+		key_count = (int)sorted.size();
+		keys.resize(key_count + 1);
+		fill(sorted.data(), 0, 1);
+	}
+};
+
+
+/**
+ *  stores sorted[next...] in-order into the subtree at index.
+ *  @return index into sorted of the first key not stored yet
+ */
+template<typename Tval, typename Policy>
+int FrozenRedBlackTree<Tval, Policy>::fill(const Tval *sorted, int next, int index) {
+	if (index <= key_count) {
+		next = fill(sorted, next, 2 * index);
+		keys[index] = sorted[next++];
+		next = fill(sorted, next, 2 * index + 1);
+	}
+	return next;
+}
+
+/**
+ *  @return first key not less than target_key, or nullptr
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+const Tval *FrozenRedBlackTree<Tval, Policy>::lower_bound(const Tkey& target_key) const {
+	const Tval *base = keys.data();
+	uintptr_t index = 1;
+	while (index <= (uintptr_t)key_count) {
+		//NOTE: the address may lie past the end, prefetching it is harmless
+		__builtin_prefetch((const char *)base + index * keys_per_line * sizeof(Tval));
+		index = 2 * index + (Compare{}(base[index], target_key) < 0 ? 1 : 0);
+	}
+	//we went right whenever the key was less. drop those trailing right turns and the last left turn
+	index >>= __builtin_ctzll(~(unsigned long long)index) + 1;
+	const Tval *result = index ? base + index : nullptr;
+	return result;
+}
+
+template<typename Tval, typename Policy>
+template<typename Tkey>
+const Tval *FrozenRedBlackTree<Tval, Policy>::find(const Tkey& target_key) const {
+	const Tval *result = lower_bound(target_key);
+	if (result && Compare{}(*result, target_key) != 0) {
+		result = nullptr;
+	}
+	return result;
+}
+
+#endif //FROZEN_RED_BLACK_TREE_H
@@ -0,0 +1,148 @@
+#ifndef MAPPED_RED_BLACK_TREE_H
+#define MAPPED_RED_BLACK_TREE_H
+
+#include "red_black_tree.h"
+
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+
+/*
+  read-only lookups straight from a file written by RedBlackTree::save, without building a tree.
+  the file is mapped, the sorted keys are searched in place with binary search.
+  opening costs a few system calls, pages come in as lookups touch them.
+  POSIX only.
+*/
+template<typename Tval, typename Policy = DefaultTreePolicy>
+struct MappedRedBlackTree {
+	static_assert(std::is_trivially_copyable_v<Tval>, "keys are read as raw bytes");
+
+	using Compare = typename Policy::Compare;
+	using iterator = const Tval*;
+	using const_iterator = const Tval*;
+
+	void *mapping = nullptr;
+	size_t mapping_bytes = 0;
+	const Tval *keys = nullptr;
+	int key_count = 0;
+
+	bool open(const char *path, bool verify_checksum = true);
+	void close();
+
+	template<typename Tkey = Tval>
+	iterator find(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	bool contains(const Tkey& target_key) const { return find(target_key) != end(); }
+	template<typename Tkey = Tval>
+	iterator lower_bound(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	iterator upper_bound(const Tkey& target_key) const;
+
+	int size() const { return key_count; }
+	iterator begin() const { return keys; }
+	iterator end() const { return keys + key_count; }
+
+	MappedRedBlackTree()
+	{}
+
+	MappedRedBlackTree(const MappedRedBlackTree&) = delete;
+	MappedRedBlackTree& operator=(const MappedRedBlackTree&) = delete;
+
+	~MappedRedBlackTree() {
+		close();
+	}
+};
+
+
+/**
+ *  maps a file written by RedBlackTree<Tval>::save. verifying the checksum reads the whole file once,
+ *  without it only the header is read now.
+ *  @return false, leaving nothing open, if the file can't be mapped, holds another key type or fails the checksum
+ */
+template<typename Tval, typename Policy>
+bool MappedRedBlackTree<Tval, Policy>::open(const char *path, bool verify_checksum) {
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat status{};
+	bool ok = fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(RedBlackTreeFileHeader);
+	if (ok) {
+		mapping_bytes = (size_t)status.st_size;
+		mapping = mmap(nullptr, mapping_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		ok = mapping != MAP_FAILED;
+		if (!ok) {
+			mapping = nullptr;
+		}
+	}
+	::close(fd); //the mapping stays valid
+
+	const RedBlackTreeFileHeader *header = (const RedBlackTreeFileHeader *)mapping;
+	ok = ok && is_valid_file_header(*header, sizeof(Tval), mapping_bytes);
+	if (ok) {
+		keys = (const Tval *)(header + 1);
+		key_count = (int)header->count;
+	}
+	if (ok && verify_checksum) {
+		madvise(mapping, mapping_bytes, MADV_SEQUENTIAL);
+		ok = file_checksum(file_checksum_seed, keys, key_count * sizeof(Tval)) == header->checksum;
+		madvise(mapping, mapping_bytes, MADV_RANDOM);
+	}
+
+	if (!ok) {
+		close();
+	}
+	return ok;
+}
+
+template<typename Tval, typename Policy>
+void MappedRedBlackTree<Tval, Policy>::close() {
+	if (mapping) {
+		munmap(mapping, mapping_bytes);
+	}
+	mapping = nullptr;
+	mapping_bytes = 0;
+	keys = nullptr;
+	key_count = 0;
+	return;
+}
+
+/**
+ *  @return first key not less than target_key
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+MappedRedBlackTree<Tval, Policy>::iterator MappedRedBlackTree<Tval, Policy>::lower_bound(const Tkey& target_key) const {
+	iterator result = std::lower_bound(begin(), end(), target_key, [](const Tval& key, const Tkey& target) {
+		return Compare{}(key, target) < 0;
+	});
+	return result;
+}
+
+/**
+ *  @return first key greater than target_key
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+MappedRedBlackTree<Tval, Policy>::iterator MappedRedBlackTree<Tval, Policy>::upper_bound(const Tkey& target_key) const {
+	iterator result = std::upper_bound(begin(), end(), target_key, [](const Tkey& target, const Tval& key) {
+		return Compare{}(target, key) < 0;
+	});
+	return result;
+}
+
+template<typename Tval, typename Policy>
+template<typename Tkey>
+MappedRedBlackTree<Tval, Policy>::iterator MappedRedBlackTree<Tval, Policy>::find(const Tkey& target_key) const {
+	iterator result = lower_bound(target_key);
+	if (result != end() && Compare{}(*result, target_key) != 0) {
+		result = end();
+	}
+	return result;
+}
+
+#endif //MAPPED_RED_BLACK_TREE_H
@@ -0,0 +1,280 @@
+#ifndef PATH_COPYING_CORE_H
+#define PATH_COPYING_CORE_H
+
+#include "red_black_tree.h"
+
+#include<cstdint>
+
+/*
+  left-leaning red-black insertion and removal that never modify a node another version can see.
+  the owner decides which nodes belong to the running write and what happens to replaced ones:
+
+  Node *owner.make(key)    new red node, belongs to the running write
+  Node *owner.own(node)    node itself if it belongs to the running write, otherwise a copy that does.
+                           the original is retired
+  void owner.retire(node)  node left the tree
+
+  a node is owned before any of its fields change, so a write copies the O(log n) nodes around
+  its search path and shares every other subtree with the previous version.
+  unlike RedBlackTree::Node there are no parent pointers: a copy would have to update them in both children.
+
+  same 2-3 balancing as RedBlackTree: a red node is always a left child and never has a red child.
+*/
+template<typename Tval, typename Compare, typename Owner>
+struct PathCopyingCore {
+
+	template<typename A, typename B>
+	static auto order(const A& a, const B& b) { return Compare{}(a, b); }
+
+	template<typename Node>
+	static bool is_red(const Node *node) { return node && node->is_red; }
+
+	template<typename Node, typename Tkey>
+	static const Node *find(const Node *root, const Tkey& target_key);
+	template<typename Node, typename Tkey>
+	static const Node *lower_bound(const Node *root, const Tkey& target_key);
+
+	template<typename Node>
+	static Node *add(Owner& owner, Node *root, const Tval& new_val, bool *added);
+	template<typename Node>
+	static Node *remove(Owner& owner, Node *root, const Tval& target_key, bool *removed);
+
+	template<typename Node>
+	static Node *insert_below(Owner& owner, Node *node, const Tval& new_val, bool *added);
+	template<typename Node>
+	static Node *remove_below(Owner& owner, Node *node, const Tval& target_key);
+	template<typename Node>
+	static Node *remove_min(Owner& owner, Node *node);
+
+	template<typename Node>
+	static Node *rotate_left(Owner& owner, Node *node);
+	template<typename Node>
+	static Node *rotate_right(Owner& owner, Node *node);
+	template<typename Node>
+	static void flip_colors(Owner& owner, Node *node);
+	template<typename Node>
+	static Node *move_red_left(Owner& owner, Node *node);
+	template<typename Node>
+	static Node *move_red_right(Owner& owner, Node *node);
+	template<typename Node>
+	static Node *balance(Owner& owner, Node *node);
+};
+
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node, typename Tkey>
+const Node *PathCopyingCore<Tval, Compare, Owner>::find(const Node *root, const Tkey& target_key) {
+	const Node *current = root;
+	while (current) {
+		auto comparison = order(target_key, current->key);
+		if (comparison == 0) {
+			break;
+		}
+		current = comparison < 0 ? current->left : current->right;
+	}
+	return current;
+}
+
+/**
+ *  @return node with the smallest key not less than target_key, or nullptr
+ */
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node, typename Tkey>
+const Node *PathCopyingCore<Tval, Compare, Owner>::lower_bound(const Node *root, const Tkey& target_key) {
+	const Node *result = nullptr;
+	const Node *current = root;
+	while (current) {
+		if (order(current->key, target_key) < 0) {
+			current = current->right;
+		} else {
+			result = current;
+			current = current->left;
+		}
+	}
+	return result;
+}
+
+//all rotations and flips work on an owned node and own the children they change
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::rotate_left(Owner& owner, Node *node) {
+	Node *result = owner.own(node->right);
+	node->right = result->left;
+	result->left = node;
+	result->is_red = node->is_red;
+	node->is_red = true;
+	return result;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::rotate_right(Owner& owner, Node *node) {
+	Node *result = owner.own(node->left);
+	node->left = result->right;
+	result->right = node;
+	result->is_red = node->is_red;
+	node->is_red = true;
+	return result;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+void PathCopyingCore<Tval, Compare, Owner>::flip_colors(Owner& owner, Node *node) {
+	node->left = owner.own(node->left);
+	node->right = owner.own(node->right);
+	node->is_red = !node->is_red;
+	node->left->is_red = !node->left->is_red;
+	node->right->is_red = !node->right->is_red;
+	return;
+}
+
+//restores the invariants on the way up: no red right child, no two reds in a row, no 4-nodes
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::balance(Owner& owner, Node *node) {
+	if (is_red(node->right) && !is_red(node->left)) {
+		node = rotate_left(owner, node);
+	}
+	if (is_red(node->left) && is_red(node->left->left)) {
+		node = rotate_right(owner, node);
+	}
+	if (is_red(node->left) && is_red(node->right)) {
+		flip_colors(owner, node);
+	}
+	return node;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::insert_below(Owner& owner, Node *node, const Tval& new_val, bool *added) {
+	if (!node) {
+		*added = true;
+		return owner.make(new_val);
+	}
+
+	//NOTE: own the parent before the child. own(child) takes over the link from the parent,
+	//a copy of the parent made afterwards would still link the original child
+	node = owner.own(node);
+	if (order(new_val, node->key) < 0) {
+		node->left = insert_below(owner, node->left, new_val, added);
+	} else {
+		node->right = insert_below(owner, node->right, new_val, added);
+	}
+	Node *result = balance(owner, node);
+	return result;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::add(Owner& owner, Node *root, const Tval& new_val, bool *added) {
+	//a duplicate copies nothing
+	*added = find(static_cast<const Node *>(root), new_val) == nullptr;
+	if (!*added) {
+		return root;
+	}
+	Node *result = insert_below(owner, root, new_val, added);
+	result->is_red = false;
+	return result;
+}
+
+//the removal descends with a red link in hand, so it ends in a 3-node where a key can be dropped
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::move_red_left(Owner& owner, Node *node) {
+	flip_colors(owner, node);
+	if (is_red(node->right->left)) {
+		node->right = rotate_right(owner, node->right);
+		node = rotate_left(owner, node);
+		flip_colors(owner, node);
+	}
+	return node;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::move_red_right(Owner& owner, Node *node) {
+	flip_colors(owner, node);
+	if (is_red(node->left->left)) {
+		node = rotate_right(owner, node);
+		flip_colors(owner, node);
+	}
+	return node;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::remove_min(Owner& owner, Node *node) {
+	if (!node->left) {
+		owner.retire(node);
+		return nullptr;
+	}
+	node = owner.own(node);
+	if (!is_red(node->left) && !is_red(node->left->left)) {
+		node = move_red_left(owner, node);
+	}
+	node->left = remove_min(owner, node->left);
+	Node *result = balance(owner, node);
+	return result;
+}
+
+//target_key must exist below node
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::remove_below(Owner& owner, Node *node, const Tval& target_key) {
+	node = owner.own(node);
+
+	if (order(target_key, node->key) < 0) {
+		if (!is_red(node->left) && !is_red(node->left->left)) {
+			node = move_red_left(owner, node);
+		}
+		node->left = remove_below(owner, node->left, target_key);
+	} else {
+		if (is_red(node->left)) {
+			node = rotate_right(owner, node);
+		}
+		if (order(target_key, node->key) == 0 && !node->right) {
+			owner.retire(node);
+			return nullptr;
+		}
+		if (!is_red(node->right) && !is_red(node->right->left)) {
+			node = move_red_right(owner, node);
+		}
+		if (order(target_key, node->key) == 0) {
+			//the successor's key moves up here, then the successor goes
+			const Node *successor = node->right;
+			while (successor->left) {
+				successor = successor->left;
+			}
+			node->key = successor->key;
+			node->right = remove_min(owner, node->right);
+		} else {
+			node->right = remove_below(owner, node->right, target_key);
+		}
+	}
+
+	Node *result = balance(owner, node);
+	return result;
+}
+
+template<typename Tval, typename Compare, typename Owner>
+template<typename Node>
+Node *PathCopyingCore<Tval, Compare, Owner>::remove(Owner& owner, Node *root, const Tval& target_key, bool *removed) {
+	*removed = find(static_cast<const Node *>(root), target_key) != nullptr;
+	if (!*removed) {
+		return root;
+	}
+
+	root = owner.own(root);
+	if (!is_red(root->left) && !is_red(root->right)) {
+		root->is_red = true;
+	}
+	Node *result = remove_below(owner, root, target_key);
+	if (result) {
+		result->is_red = false;
+	}
+	return result;
+}
+
+#endif //PATH_COPYING_CORE_H
@@ -0,0 +1,284 @@
+#ifndef PERSISTENT_RED_BLACK_TREE_H
+#define PERSISTENT_RED_BLACK_TREE_H
+
+#include "path_copying_core.h"
+
+#include<atomic>
+#include<vector>
+#include<utility>
+#include<cstdint>
+
+/*
+  ordered set with O(1) snapshots. add and remove copy the O(log n) nodes around their search path
+  (see PathCopyingCore) and share everything else with earlier versions, so a snapshot is just
+  a counted reference to the current root.
+
+  every node counts the links and handles that point to it and is freed when the last one goes.
+  the counts are atomic, snapshots may be read and dropped on other threads while the tree changes.
+  nodes carry the version of the tree that created them: a node of the current version is not part
+  of any snapshot and changes in place. taking a snapshot starts a new version.
+*/
+template<typename Tval, typename Compare = std::compare_three_way>
+struct PersistentRedBlackTree {
+
+	struct Node {
+		Tval key;
+		Node *left = nullptr;
+		Node *right = nullptr;
+		bool is_red = true;
+		uint64_t version = 0;
+		std::atomic<int> references{1};
+	};
+
+	using Core = PathCopyingCore<Tval, Compare, PersistentRedBlackTree>;
+
+	//versions are unique across all trees, a tree forked from a snapshot must not take the other's nodes for its own
+	static inline std::atomic<uint64_t> next_version{1};
+
+	//in-order traversal with an explicit stack, the nodes have no parent pointers
+	struct iterator {
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = Tval;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Tval*;
+		using reference = const Tval&;
+
+		std::vector<const Node *> pending; //empty means end()
+
+		void push_left_spine(const Node *node) {
+			for ( ; node ; node = node->left) {
+				pending.push_back(node);
+			}
+		}
+
+		reference operator*() const { return pending.back()->key; }
+		pointer operator->() const { return &pending.back()->key; }
+
+		iterator& operator++() {
+			const Node *current = pending.back();
+			pending.pop_back();
+			push_left_spine(current->right);
+			return *this;
+		}
+
+		iterator operator++(int) {
+			iterator before = *this;
+			++*this;
+			return before;
+		}
+
+		bool operator==(const iterator& other) const {
+			bool result = pending.empty() ? other.pending.empty() : (!other.pending.empty() && pending.back() == other.pending.back());
+			return result;
+		}
+	};
+	using const_iterator = iterator;
+
+	//a read-only version of the tree. copying one is O(1) as well
+	struct Snapshot {
+		Node *root = nullptr;
+		int key_count = 0;
+
+		template<typename Tkey = Tval>
+		const Tval *find(const Tkey& target_key) const { return PersistentRedBlackTree::find_in(root, target_key); }
+		template<typename Tkey = Tval>
+		bool contains(const Tkey& target_key) const { return find(target_key) != nullptr; }
+		template<typename Tkey = Tval>
+		const Tval *lower_bound(const Tkey& target_key) const { return PersistentRedBlackTree::lower_bound_in(root, target_key); }
+		int size() const { return key_count; }
+		iterator begin() const { return PersistentRedBlackTree::begin_at(root); }
+		iterator end() const { return iterator{}; }
+
+		Snapshot()
+		{}
+
+		Snapshot(Node *root_, int key_count_)
+		:root{acquire(root_)}, key_count{key_count_}
+		{}
+
+		Snapshot(const Snapshot& other)
+		:root{acquire(other.root)}, key_count{other.key_count}
+		{}
+
+		Snapshot(Snapshot&& other)
+		:root{other.root}, key_count{other.key_count}
+		{
+			other.root = nullptr;
+			other.key_count = 0;
+		}
+
+		Snapshot& operator=(Snapshot other) {
+			std::swap(root, other.root);
+			std::swap(key_count, other.key_count);
+			return *this;
+		}
+
+		~Snapshot() {
+			release(root);
+		}
+	};
+
+	Node *root = nullptr;
+	int key_count = 0;
+	uint64_t version = next_version++;
+
+	bool add(const Tval& new_val);
+	bool remove(const Tval& target_key);
+	Snapshot snapshot();
+	void clear();
+
+	template<typename Tkey = Tval>
+	const Tval *find(const Tkey& target_key) const { return find_in(root, target_key); }
+	template<typename Tkey = Tval>
+	bool contains(const Tkey& target_key) const { return find(target_key) != nullptr; }
+	template<typename Tkey = Tval>
+	const Tval *lower_bound(const Tkey& target_key) const { return lower_bound_in(root, target_key); }
+	int size() const { return key_count; }
+	iterator begin() const { return begin_at(root); }
+	iterator end() const { return iterator{}; }
+
+	template<typename Tkey>
+	static const Tval *find_in(const Node *tree, const Tkey& target_key);
+	template<typename Tkey>
+	static const Tval *lower_bound_in(const Node *tree, const Tkey& target_key);
+	static iterator begin_at(const Node *tree);
+
+	static Node *acquire(Node *node);
+	static void release(Node *node);
+
+	//called by PathCopyingCore
+	Node *make(const Tval& key);
+	Node *own(Node *node);
+	void retire(Node *node);
+
+	PersistentRedBlackTree()
+	{}
+
+	//continues from a snapshot. the snapshot itself doesn't change
+	explicit PersistentRedBlackTree(const Snapshot& from)
+	:root{acquire(from.root)}, key_count{from.key_count}
+	{}
+
+	PersistentRedBlackTree(const PersistentRedBlackTree&) = delete;
+	PersistentRedBlackTree& operator=(const PersistentRedBlackTree&) = delete;
+
+	~PersistentRedBlackTree() {
+		release(root);
+	}
+};
+
+
+template<typename Tval, typename Compare>
+PersistentRedBlackTree<Tval, Compare>::Node *PersistentRedBlackTree<Tval, Compare>::acquire(Node *node) {
+	if (node) {
+		node->references.fetch_add(1, std::memory_order_relaxed);
+	}
+	return node;
+}
+
+/**
+ *  drops one reference. a node without references is freed and drops its references to the children
+ */
+template<typename Tval, typename Compare>
+void PersistentRedBlackTree<Tval, Compare>::release(Node *node) {
+	while (node && node->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		Node *left = node->left;
+		release(node->right);
+		delete node;
+		node = left;
+	}
+	return;
+}
+
+template<typename Tval, typename Compare>
+PersistentRedBlackTree<Tval, Compare>::Node *PersistentRedBlackTree<Tval, Compare>::make(const Tval& key) {
+	Node *result = new Node{key};
+	result->version = version;
+	return result;
+}
+
+/**
+ *  @return node if it belongs to the current version, otherwise a copy that takes over
+ *  the link pointing to node
+ */
+template<typename Tval, typename Compare>
+PersistentRedBlackTree<Tval, Compare>::Node *PersistentRedBlackTree<Tval, Compare>::own(Node *node) {
+	if (node->version == version) {
+		return node;
+	}
+	Node *result = new Node{node->key, acquire(node->left), acquire(node->right), node->is_red, version};
+	release(node);
+	return result;
+}
+
+//the core only drops leaves, there are no children to hand on
+template<typename Tval, typename Compare>
+void PersistentRedBlackTree<Tval, Compare>::retire(Node *node) {
+	release(node);
+	return;
+}
+
+/**
+ *  @return false if new_val already exists
+ */
+template<typename Tval, typename Compare>
+bool PersistentRedBlackTree<Tval, Compare>::add(const Tval& new_val) {
+	bool added = false;
+	root = Core::add(*this, root, new_val, &added);
+	key_count += added ? 1 : 0;
+	return added;
+}
+
+/**
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, typename Compare>
+bool PersistentRedBlackTree<Tval, Compare>::remove(const Tval& target_key) {
+	bool removed = false;
+	root = Core::remove(*this, root, target_key, &removed);
+	key_count -= removed ? 1 : 0;
+	return removed;
+}
+
+/**
+ *  O(1): shares the root. the next change copies its path instead of changing nodes in place
+ */
+template<typename Tval, typename Compare>
+PersistentRedBlackTree<Tval, Compare>::Snapshot PersistentRedBlackTree<Tval, Compare>::snapshot() {
+	version = next_version++;
+	Snapshot result{root, key_count};
+	return result;
+}
+
+template<typename Tval, typename Compare>
+void PersistentRedBlackTree<Tval, Compare>::clear() {
+	release(root);
+	root = nullptr;
+	key_count = 0;
+	return;
+}
+
+template<typename Tval, typename Compare>
+template<typename Tkey>
+const Tval *PersistentRedBlackTree<Tval, Compare>::find_in(const Node *tree, const Tkey& target_key) {
+	const Node *found = Core::find(tree, target_key);
+	const Tval *result = found ? &found->key : nullptr;
+	return result;
+}
+
+template<typename Tval, typename Compare>
+template<typename Tkey>
+const Tval *PersistentRedBlackTree<Tval, Compare>::lower_bound_in(const Node *tree, const Tkey& target_key) {
+	const Node *found = Core::lower_bound(tree, target_key);
+	const Tval *result = found ? &found->key : nullptr;
+	return result;
+}
+
+template<typename Tval, typename Compare>
+PersistentRedBlackTree<Tval, Compare>::iterator PersistentRedBlackTree<Tval, Compare>::begin_at(const Node *tree) {
+	iterator result;
+	result.push_left_spine(tree);
+	return result;
+}
+
+#endif //PERSISTENT_RED_BLACK_TREE_H
@@ -0,0 +1,159 @@
+#ifndef RED_BLACK_MAP_H
+#define RED_BLACK_MAP_H
+
+#include "red_black_tree.h"
+
+template<typename Tkey, typename Tvalue>
+struct MapEntry {
+	Tkey key;
+	Tvalue value;
+};
+
+/**
+ *  orders map entries by key only. it is transparent: anything Tcompare can compare to a key
+ *  can be compared to an entry, e.g. a std::string_view or a const char* for std::string keys.
+ */
+template<typename Tcompare>
+struct EntryCompare {
+	using is_transparent = void;
+	
+	//string literals arrive as arrays, which three-way comparators don't accept. pass them on as pointers
+	template<typename Tlookup>
+	static const auto& decay(const Tlookup& key) {
+		return key;
+	}
+	
+	template<typename Tchar, size_t count>
+	static const Tchar *decay(const Tchar (&key)[count]) {
+		return key;
+	}
+	
+	template<typename K1, typename V1, typename K2, typename V2>
+	auto operator()(const MapEntry<K1, V1>& a, const MapEntry<K2, V2>& b) const {
+		return Tcompare{}(a.key, b.key);
+	}
+	
+	template<typename K, typename V, typename Tlookup>
+	auto operator()(const MapEntry<K, V>& a, const Tlookup& b) const {
+		return Tcompare{}(a.key, decay(b));
+	}
+	
+	template<typename Tlookup, typename K, typename V>
+	auto operator()(const Tlookup& a, const MapEntry<K, V>& b) const {
+		return Tcompare{}(decay(a), b.key);
+	}
+};
+
+/**
+ *  ordered key/value map on the RedBlackTree balancing core. the tree stores MapEntry and compares
+ *  only the keys, with one three-way comparison per level.
+ *  Tcompare returns a three-way result like <=> (default SynthesizedThreeWay, which is transparent
+ *  and falls back to < for keys without <=>).
+ *  Policy options of the tree (track_size, ...) are passed through.
+ */
+template<typename Tkey, typename Tvalue, typename Tcompare = SynthesizedThreeWay, typename Policy = DefaultTreePolicy>
+struct RedBlackMap {
+	using Entry = MapEntry<Tkey, Tvalue>;
+	
+	struct EntryPolicy : Policy {
+		using Compare = EntryCompare<Tcompare>;
+	};
+	
+	using Tree = RedBlackTree<Entry, EntryPolicy>;
+	using Node = typename Tree::Node;
+	using iterator = typename Tree::iterator;
+	
+	Tree tree;
+	
+	bool insert(const Tkey& key, const Tvalue& value);
+	void insert_or_assign(const Tkey& key, const Tvalue& value);
+	Tvalue& operator[](const Tkey& key);
+	
+	template<typename Tlookup>
+	Tvalue *find(const Tlookup& key);
+	template<typename Tlookup>
+	bool contains(const Tlookup& key);
+	template<typename Tlookup>
+	bool erase(const Tlookup& key);
+	
+	template<typename Tlookup>
+	iterator lower_bound(const Tlookup& key) const {
+		return tree.lower_bound(key);
+	}
+	
+	template<typename Tlookup>
+	iterator upper_bound(const Tlookup& key) const {
+		return tree.upper_bound(key);
+	}
+	
+	iterator begin() const { return tree.begin(); }
+	iterator end() const { return tree.end(); }
+	int size() const { return tree.size(); }
+	void clear() { tree.clear(); }
+};
+
+/**
+ *  @return false if the key already exists. the stored value is left unchanged in that case.
+ */
+template<typename Tkey, typename Tvalue, typename Tcompare, typename Policy>
+bool RedBlackMap<Tkey, Tvalue, Tcompare, Policy>::insert(const Tkey& key, const Tvalue& value) {
+	Node *inserted = tree.insert_below(tree.root, Entry{key, value});
+	bool result = inserted != nullptr;
+	return result;
+}
+
+template<typename Tkey, typename Tvalue, typename Tcompare, typename Policy>
+void RedBlackMap<Tkey, Tvalue, Tcompare, Policy>::insert_or_assign(const Tkey& key, const Tvalue& value) {
+	//NOTE: one descent, a miss inserts below the node it ended at
+	Node *parent = nullptr;
+	Node *existing = tree.find_or_parent(key, &parent);
+	if (existing) {
+		existing->key.value = value;
+	} else {
+		tree.insert_below(parent, Entry{key, value});
+	}
+	return;
+}
+
+template<typename Tkey, typename Tvalue, typename Tcompare, typename Policy>
+Tvalue& RedBlackMap<Tkey, Tvalue, Tcompare, Policy>::operator[](const Tkey& key) {
+	Node *parent = nullptr;
+	Node *existing = tree.find_or_parent(key, &parent);
+	if (existing) {
+		return existing->key.value;
+	}
+	Node *inserted = tree.insert_below(parent, Entry{key, Tvalue{}});
+	return inserted->key.value;
+}
+
+/**
+ *  @return pointer to the value stored for key, or nullptr. no temporary Tkey is built.
+ */
+template<typename Tkey, typename Tvalue, typename Tcompare, typename Policy>
+template<typename Tlookup>
+Tvalue *RedBlackMap<Tkey, Tvalue, Tcompare, Policy>::find(const Tlookup& key) {
+	Node *found = tree.root ? tree.root->find(key) : nullptr;
+	Tvalue *result = found ? &found->key.value : nullptr;
+	return result;
+}
+
+template<typename Tkey, typename Tvalue, typename Tcompare, typename Policy>
+template<typename Tlookup>
+bool RedBlackMap<Tkey, Tvalue, Tcompare, Policy>::contains(const Tlookup& key) {
+	bool result = find(key) != nullptr;
+	return result;
+}
+
+template<typename Tkey, typename Tvalue, typename Tcompare, typename Policy>
+template<typename Tlookup>
+bool RedBlackMap<Tkey, Tvalue, Tcompare, Policy>::erase(const Tlookup& key) {
+	Node *found = tree.root ? tree.root->find(key) : nullptr;
+	if (!found) {
+		return false;
+	}
+	//the node is already found, no second descent
+	delete tree.remove_node(found);
+	return true;
+}
+
+#endif //RED_BLACK_MAP_H
@@ -1,10 +1,60 @@
+#ifndef RED_BLACK_TREE_H
+#define RED_BLACK_TREE_H
 
 #include <cstdio>
+#include <cstdlib>
 
 #include<string>
+#include<string_view>
 #include<sstream>
+#include<iterator>
+#include<span>
+#include<vector>
+#include<algorithm>
+#include<utility>
+#include<cstddef>
+#include<type_traits>
+#include<limits>
+#include<compare>
+#include<functional>
+#include<future>
+#include<thread>
+#include<cstdint>
+#include<cstring>
+#include<charconv>
+#include<cerrno>
+#include<unistd.h>
 
-#define assert(condition) if(!(condition)) {*(int *)0 = 0;}
+/*
+  assertion levels. define RB_ASSERT_LEVEL before including:
+  0  no checks, conditions are not evaluated
+  1  cheap local checks in the tree operations (default)
+  2  additionally validate the whole tree after every structural change, O(n) each. for tests on small trees,
+     soak tests at full size rather call RedBlackTree::validate every so often
+  a failed check reports the condition and where it is, then aborts.
+*/
+#ifndef RB_ASSERT_LEVEL
+#define RB_ASSERT_LEVEL 1
+#endif
+
+[[noreturn]] inline void rb_assert_failed(const char *condition, const char *file, int line) {
+	fprintf(stderr, "%s:%d: assertion failed: %s\n", file, line, condition);
+	fflush(stderr);
+	abort();
+}
+
+#undef assert
+#if RB_ASSERT_LEVEL >= 1
+#define assert(condition) do { if (!(condition)) rb_assert_failed(#condition, __FILE__, __LINE__); } while (0)
+#else
+#define assert(condition) do {} while (0)
+#endif
+
+#if RB_ASSERT_LEVEL >= 2
+#define assert_expensive(condition) assert(condition)
+#else
+#define assert_expensive(condition) do {} while (0)
+#endif
 
 template<typename T>
 T min(const T& a, const T& b) {
@@ -18,9 +68,239 @@ T max(const T& a, const T& b) {
 	return result;
 }
 
-template<typename Tval>
+//stands in for optional node fields that a policy turned off. takes no space with [[no_unique_address]]
+struct NoField {};
+
+/**
+ *  the default comparison of keys: a <=> b where the types have it, otherwise synthesized from <,
+ *  so keys that only define < keep working. transparent, like std::compare_three_way
+ */
+struct SynthesizedThreeWay {
+	using is_transparent = void;
+	
+	template<typename A, typename B>
+	constexpr auto operator()(const A& a, const B& b) const {
+		if constexpr (requires { a <=> b; }) {
+			return a <=> b;
+		} else {
+			return a < b ? std::weak_ordering::less : b < a ? std::weak_ordering::greater : std::weak_ordering::equivalent;
+		}
+	}
+};
+
+/**
+ *  per-subtree aggregates. an augment is a monoid over values derived from the keys:
+ *  	value_type
+ *  	static value_type identity();
+ *  	static value_type from_key(const Tkey&);
+ *  	static value_type combine(const value_type& left, const value_type& right); //associative
+ *  combine is always applied in key order, so it doesn't need to be commutative.
+ */
+struct NoAugment {};
+
+template<typename Tkey, typename Tsum = Tkey>
+struct SumAugment {
+	using value_type = Tsum;
+	static value_type identity() { return value_type{}; }
+	static value_type from_key(const Tkey& key) { return value_type(key); }
+	static value_type combine(const value_type& left, const value_type& right) { return left + right; }
+};
+
+template<typename Tkey>
+struct MinAugment {
+	using value_type = Tkey;
+	static value_type identity() { return std::numeric_limits<Tkey>::max(); }
+	static value_type from_key(const Tkey& key) { return key; }
+	static value_type combine(const value_type& left, const value_type& right) { return min(left, right); }
+};
+
+template<typename Tkey>
+struct MaxAugment {
+	using value_type = Tkey;
+	static value_type identity() { return std::numeric_limits<Tkey>::lowest(); }
+	static value_type from_key(const Tkey& key) { return key; }
+	static value_type combine(const value_type& left, const value_type& right) { return max(left, right); }
+};
+
+/**
+ *  compile-time options for RedBlackTree. derive from this and override what you need,
+ *  so that options added later keep their defaults.
+ */
+struct DefaultTreePolicy {
+	//store the subtree size in every node: O(1) size(), O(log n) rank/select/count_range
+	static constexpr bool track_size = false;
+	//store Augment::value_type of every subtree: O(log n) aggregate_range
+	using Augment = NoAugment;
+	//three-way comparison of keys, result like that of <=>. transparent comparators allow lookups by other types
+	using Compare = SynthesizedThreeWay;
+	//remove finds the key first and repairs the black height upwards from where a node left, see remove_bottom_up.
+	//false: remove makes room on the way down and only rebalances on the way back, see remove
+	static constexpr bool bottom_up_remove = false;
+	//count rotations, other rebalancing steps and the depth of each search in RedBlackTree::stats(), see RedBlackTreeStats.
+	//every tree counts its own work. find and count write the counters too, so they are no longer safe from several threads
+	//at once. without it no counter exists and nothing is counted
+	static constexpr bool collect_stats = false;
+	//every node counts the occurrences of its key, see insert and erase_one. the tree keeps one node per distinct key,
+	//size(), subtree sizes and aggregates see each key once. save and the set operations keep keys, not counts
+	static constexpr bool multiset = false;
+	//add starts from the node added last and climbs to the insertion point, see add_hint.
+	//pays off for ascending or clustered keys such as timestamps, costs a little for random ones
+	static constexpr bool finger_insert = false;
+};
+
+struct OrderStatisticPolicy : DefaultTreePolicy {
+	static constexpr bool track_size = true;
+};
+
+struct StatsPolicy : DefaultTreePolicy {
+	static constexpr bool collect_stats = true;
+};
+
+struct MultisetPolicy : DefaultTreePolicy {
+	static constexpr bool multiset = true;
+};
+
+/*
+  file layout of RedBlackTree::save: this 64-byte header, then `count` keys in ascending order,
+  stored as their raw bytes (host byte order). the keys start 64-byte aligned, so a mapped file
+  can be searched in place, see MappedRedBlackTree.
+*/
+struct RedBlackTreeFileHeader {
+	char magic[8];
+	uint32_t format_version;
+	uint32_t key_bytes;
+	uint64_t count;
+	uint64_t checksum; //of the key bytes, see file_checksum
+	uint8_t reserved[32];
+};
+static_assert(sizeof(RedBlackTreeFileHeader) == 64);
+
+constexpr char red_black_tree_file_magic[8] = {'R', 'B', 'T', 'K', 'E', 'Y', 'S', '\0'};
+constexpr uint32_t red_black_tree_file_version = 1;
+constexpr uint64_t file_checksum_seed = 0xcbf29ce484222325ull;
+
+/**
+ *  FNV-1a over 64-bit words, then over the trailing bytes. eight bytes per multiply keeps it
+ *  close to memory speed. when checksumming in pieces, every piece but the last must be a multiple of 8 bytes.
+ */
+inline uint64_t file_checksum(uint64_t checksum, const void *data, size_t byte_count) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t word_count = byte_count / 8;
+	for (size_t i = 0 ; i < word_count ; ++i) {
+		uint64_t word;
+		memcpy(&word, bytes + 8 * i, 8);
+		checksum = (checksum ^ word) * 0x100000001b3ull;
+	}
+	for (size_t i = 8 * word_count ; i < byte_count ; ++i) {
+		checksum = (checksum ^ bytes[i]) * 0x100000001b3ull;
+	}
+	return checksum;
+}
+
+/**
+ *  @return true if header belongs to a file of file_bytes bytes holding keys of key_bytes bytes each
+ */
+inline bool is_valid_file_header(const RedBlackTreeFileHeader& header, size_t key_bytes, uint64_t file_bytes) {
+	bool result = memcmp(header.magic, red_black_tree_file_magic, sizeof(header.magic)) == 0;
+	result = result && header.format_version == red_black_tree_file_version;
+	result = result && header.key_bytes == key_bytes;
+	result = result && file_bytes >= sizeof(RedBlackTreeFileHeader);
+	result = result && header.count <= (file_bytes - sizeof(RedBlackTreeFileHeader)) / key_bytes;
+	result = result && file_bytes == sizeof(RedBlackTreeFileHeader) + header.count * key_bytes;
+	return result;
+}
+
+/*
+  result of validate_red_black_tree. converts to true if the tree is valid,
+  otherwise failure says which rule the node at `node` breaks first.
+*/
+struct RedBlackTreeValidation {
+	const char *failure = nullptr;
+	const void *node = nullptr;
+	int black_height = 0;
+	int count = 0;
+	int height = 0; //nodes on the longest path from the root
+	
+	explicit operator bool() const { return failure == nullptr; }
+};
+
+/*
+  the counters of one tree, see RedBlackTree::stats(), since it was made or since reset_stats().
+  a join or set operation counts for the tree it returns.
+  each field counts calls of the Node method of the same name. lend counts lend_left and lend_right, the steps of the
+  top-down remove, shift those of them that borrow from a sibling and squash those that merge with it.
+  a descent is one search down the tree, by find, count, add, remove or erase_one. add_hint and finger inserts
+  descend from the node they climbed to, insert searches a second time for a new key.
+  its depth is the number of nodes it compares with, descents_by_depth[d] counts those of depth d.
+*/
+struct RedBlackTreeStats {
+	static constexpr int max_tracked_depth = 64;
+	
+	long long rotate_left = 0;
+	long long rotate_right = 0;
+	long long flip_colors_with_children = 0;
+	long long flip_colors_with_parent = 0;
+	long long lend = 0;
+	long long shift = 0;
+	long long squash = 0;
+	long long fix_black_deficit = 0;
+	
+	long long descents = 0;
+	long long descent_steps = 0; //nodes compared with, over all descents
+	long long descents_by_depth[max_tracked_depth] = {}; //the last entry takes the deeper ones as well
+	
+	long long rotations() const { return rotate_left + rotate_right; }
+	double mean_descent_depth() const { return descents ? (double)descent_steps / descents : 0.0; }
+	int max_descent_depth() const {
+		int result = max_tracked_depth - 1;
+		while (result > 0 && descents_by_depth[result] == 0) {
+			--result;
+		}
+		return result;
+	}
+	
+	RedBlackTreeStats& operator+=(const RedBlackTreeStats& other) {
+		rotate_left += other.rotate_left;
+		rotate_right += other.rotate_right;
+		flip_colors_with_children += other.flip_colors_with_children;
+		flip_colors_with_parent += other.flip_colors_with_parent;
+		lend += other.lend;
+		shift += other.shift;
+		squash += other.squash;
+		fix_black_deficit += other.fix_black_deficit;
+		descents += other.descents;
+		descent_steps += other.descent_steps;
+		for (int i = 0 ; i < max_tracked_depth ; ++i) {
+			descents_by_depth[i] += other.descents_by_depth[i];
+		}
+		return *this;
+	}
+};
+
+
+template<typename Tval, typename Policy = DefaultTreePolicy>
 struct RedBlackTree {	
 	
+	using Augment = typename Policy::Augment;
+	static constexpr bool has_augment = !std::is_same_v<Augment, NoAugment>;
+	static constexpr bool caches_subtree_data = Policy::track_size || has_augment;
+	
+	template<typename A>
+	struct AugmentValue { using type = typename A::value_type; };
+	using Aggregate = typename std::conditional_t<has_augment, AugmentValue<Augment>, std::type_identity<NoField>>::type;
+	
+	using Compare = typename Policy::Compare;
+	
+	//one key comparison per call: negative, zero or positive
+	template<typename A, typename B>
+	static auto order(const A& a, const B& b) { return Compare{}(a, b); }
+	
+	template<typename A, typename B>
+	static bool is_less(const A& a, const B& b) { return order(a, b) < 0; }
+	
+	template<typename A, typename B>
+	static bool is_equal(const A& a, const B& b) { return order(a, b) == 0; }
+	
 	struct Node {
 		Tval key;
 		
@@ -30,9 +310,15 @@ struct RedBlackTree {
 		
 		bool is_red = false;
 		
-		Node *find(Tval search_key);		
+		[[no_unique_address]] std::conditional_t<Policy::track_size, int, NoField> subtree_size{};
+		[[no_unique_address]] Aggregate aggregate{};
+		[[no_unique_address]] std::conditional_t<Policy::multiset, int, NoField> multiplicity{};
+		
+		template<typename Tkey>
+		Node *find(const Tkey& search_key);		
 		int count();		
-		Node *get_insertion_parent(Tval new_key);
+		Node *get_insertion_parent(const Tval& new_key);
+		Node *climb_to_cover(const Tval& target_key);
 		void attach_child(Node *Node);
 		void append_leaf(Node *new_node);
 		Node *add(const Tval&);
@@ -48,58 +334,247 @@ struct RedBlackTree {
 		bool is_2_node();
 		bool is_3_node();
 		bool is_4_node();
-		bool is_in_3_4_leaf();
-		bool key_exists_in_2_3_4_node(const Tval& target_key);
-		Node *remove_key_from_3_4_leaf(const Tval& target_key);
-		Node *get_sibling();
-		Node *get_far_sibling();
+		Node *leftmost();
+		Node *rightmost();
+		Node *next();
+		Node *prev();
 		Node *fix_up_add();
-		Node *fix_up_root();
-		void fix_up();
 		Node *replace_right(Node *);
 		Node *replace_left(Node *);
 		Node *replace_child(Node *old_child, Node *new_child);
 		Node *replace_with(Node *replacement);
 		void remove_leaf();
-		Node *shift();
-		Node *shift_right();
-		Node *shift_left();
-		Node *far_shift();		
-		void squash();
-		Node *far_squash();
-		Node *get_nearest(Tval target_key);
 		Node *walk_down_step_root(Tval target_key);
 		Node *walk_down_step(Tval target_key);
-		void make_3_4_node();
-		Node *descend(Node **target_node_ptr, const Tval& target_key);
-		Node *turn_back(Node *removed_node);
-		Node *ascend(Node *removed_node);
+		Node *fix_black_deficit(bool left_is_short);
+		Node *lean_left();
+		Node *lean_right();
+		Node *lend_left();
+		Node *lend_right();
+		Node *rebalance();
+		static bool is_red_node(Node *node) { return node && node->is_red; }
+		
+		//recompute cached subtree data from the children. no-ops unless the policy caches anything
+		void refresh();
+		void refresh_upwards();
 		
 		//store contained keys in order
 		Tval * inorder_to_buf(Tval *out);	
 		
+		template<typename It>
+		static Node *build_sorted(It *cur, It last, int count, int height);
+		int delete_subtree();
+		
+		//join-based operations on detached subtrees. they take ownership of the arguments and return the new root
+		static Node *as_root(Node *tree);
+		static int spine_black_height(Node *tree);
+		static Node *join(Node *left_tree, Node *middle, Node *right_tree);
+		static Node *join2(Node *left_tree, Node *right_tree);
+		static Node *split(Node *tree, const Tval& split_key, Node **less, Node **greater);
+		template<typename Fleft, typename Fright>
+		static std::pair<Node *, Node *> fork_join(Node *work_tree, int fork_depth, Fleft&& left_work, Fright&& right_work);
+		static Node *set_union(Node *first, Node *second, int fork_depth);
+		static Node *set_intersection(Node *first, Node *second, int fork_depth);
+		static Node *set_difference(Node *first, Node *second, int fork_depth);
+		
 		Node(Tval key_) :key{key_}
-		{}
+		{
+			if constexpr (Policy::track_size) {
+				subtree_size = 1;
+			}
+			if constexpr (has_augment) {
+				aggregate = Augment::from_key(key);
+			}
+			if constexpr (Policy::multiset) {
+				multiplicity = 1;
+			}
+		}
 		
 		void debug_add_left(Tval new_val, bool set_red);
 		void debug_add_right(Tval new_val, bool set_red);
 		
 	};
 	
+	//in-order traversal through parent pointers, needs no stack. keys can't be modified through it.
+	struct iterator {
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = Tval;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Tval*;
+		using reference = const Tval&;
+		
+		Node *node = nullptr; //nullptr means end()
+		const RedBlackTree *tree = nullptr;
+		
+		reference operator*() const { return node->key; }
+		pointer operator->() const { return &node->key; }
+		
+		iterator& operator++() {
+			node = node->next();
+			return *this;
+		}
+		
+		iterator operator++(int) {
+			iterator before = *this;
+			++*this;
+			return before;
+		}
+		
+		iterator& operator--() {
+			//end() steps back onto the largest key
+			node = node ? node->prev() : tree->root->rightmost();
+			return *this;
+		}
+		
+		iterator operator--(int) {
+			iterator before = *this;
+			--*this;
+			return before;
+		}
+		
+		bool operator==(const iterator& other) const {
+			return node == other.node;
+		}
+	};
+	using const_iterator = iterator;
+	
 	Node *root;
 	
+	//the node added last, if Policy::finger_insert. every other change forgets it
+	Node *finger = nullptr;
+	
+	//leftmost and rightmost node, nullptr only if empty. single adds and removes keep them,
+	//other changes find them again with refresh_cached_nodes. so does update_root, after root was set from outside
+	Node *first_node = nullptr;
+	Node *last_node = nullptr;
+	
+	//insert_many rebuilds the whole tree once the batch holds at least 1/ratio as many keys as the tree
+	static constexpr int insert_many_rebuild_ratio = 4;
+	
+	//set operations run subtrees of lower black height (fewer than about 2^height keys) on the calling thread
+	static constexpr int set_operation_grain_height = 10;
+	
+	//find_many advances this many lookups side by side
+	static constexpr int find_many_group_size = 16;
+	
+	using StatsCounters = std::conditional_t<Policy::collect_stats, RedBlackTreeStats, NoField>;
+	
+	//this tree's counters, if Policy::collect_stats. mutable: find and count are const and count as well
+	[[no_unique_address]] mutable StatsCounters stats_counters{};
+	//where the Node methods running on this thread count: the counters of the tree whose method called them, see StatsScope
+	static inline thread_local std::conditional_t<Policy::collect_stats, RedBlackTreeStats *, NoField> stats_sink{};
+	
+	//points stats_sink at counters for its lifetime, then back at the ones before. nothing without Policy::collect_stats
+	struct StatsScope {
+		[[no_unique_address]] std::conditional_t<Policy::collect_stats, RedBlackTreeStats *, NoField> previous{};
+		
+		explicit StatsScope(StatsCounters& counters) {
+			if constexpr (Policy::collect_stats) {
+				previous = stats_sink;
+				stats_sink = &counters;
+			}
+		}
+		~StatsScope() {
+			if constexpr (Policy::collect_stats) {
+				stats_sink = previous;
+			}
+		}
+		StatsScope(const StatsScope&) = delete;
+		StatsScope& operator=(const StatsScope&) = delete;
+	};
+	
+	static void count_stat(long long RedBlackTreeStats::*counter);
+	RedBlackTreeStats stats() const;
+	void reset_stats();
+	long long descent_mark() const;
+	void record_descent(long long mark) const;
+	
 	void add(const Tval& new_val);
+	Node *add_hint(Node *hint, const Tval& new_val);
+	iterator add_hint(iterator hint, const Tval& new_val);
+	void insert_many(std::span<const Tval> new_vals);
+	Node *insert_below(Node *start, const Tval& new_val);
+	template<typename Tkey = Tval>
+	Node *find_or_parent(const Tkey& target_key, Node **parent) const;
 	
 	Node *remove(const Tval& target_key);
-	
+	Node *remove_bottom_up(const Tval& target_key);
+	Node *remove_node(Node *target);
+	
+	//O(1), see first_node
+	Node *min_node() const { assert(cached_nodes_plausible()); return first_node; }
+	Node *max_node() const { assert(cached_nodes_plausible()); return last_node; }
+	bool cached_nodes_plausible() const;
+	iterator min() const { return iterator{min_node(), this}; }
+	iterator max() const { return iterator{max_node(), this}; }
+	Node *pop_min();
+	Node *pop_max();
+	void refresh_cached_nodes();
+	
+	Node *insert(const Tval& new_val);
+	bool erase_one(const Tval& target_key);
+	template<typename Tkey = Tval>
+	int count(const Tkey& target_key) const;
+	
+	template<std::forward_iterator It>
+	void assign_sorted(It first, It last);
+	void clear();
+	
+	static RedBlackTree join(RedBlackTree& left, const Tval& key, RedBlackTree& right);
+	RedBlackTree split(const Tval& split_key, bool *found = nullptr);
+	int erase_range(const Tval& low, const Tval& high);
+	static RedBlackTree set_union(RedBlackTree& first, RedBlackTree& second, int fork_depth = set_operation_fork_depth());
+	static RedBlackTree set_intersection(RedBlackTree& first, RedBlackTree& second, int fork_depth = set_operation_fork_depth());
+	static RedBlackTree set_difference(RedBlackTree& first, RedBlackTree& second, int fork_depth = set_operation_fork_depth());
+	static int set_operation_fork_depth();
+	
+	bool save(const char *path) const;
+	bool load(const char *path);
 	
 	void update_root();
 	bool to_string(char *out, int size);
+	std::string dump() const;
+	bool dump(int fd) const;
+	
+	RedBlackTreeValidation validate() const;
+	
+	int size() const;
+	int rank(const Tval& target_key) const;
+	iterator select(int index) const;
+	int count_range(const Tval& low, const Tval& high) const;
+	
+	Aggregate aggregate() const;
+	Aggregate aggregate_range(const Tval& low, const Tval& high) const;
+	
+	iterator begin() const;
+	iterator end() const;
+	template<typename Tkey = Tval>
+	iterator find(const Tkey& target_key) const;
+	void find_many(std::span<const Tval> target_keys, std::span<iterator> results) const;
+	template<typename Tkey = Tval>
+	iterator lower_bound(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	iterator upper_bound(const Tkey& target_key) const;
+	template<typename Tkey = Tval>
+	std::pair<iterator, iterator> equal_range(const Tkey& target_key) const;
+	
+	RedBlackTree()
+	:root{nullptr}
+	{}
 	
 	RedBlackTree(Tval key_)
 	:root{new Node{key_}}
+	,first_node{root}
+	,last_node{root}
 	{}	
 	
+	template<std::forward_iterator It>
+	RedBlackTree(It first, It last)
+	:root{nullptr}
+	{
+		assign_sorted(first, last);
+	}
+	
 	
 	
 };
@@ -107,20 +582,50 @@ struct RedBlackTree {
 // template<typename Tval>
 // using RedBlackTree = RedBlackTree<Tval>;
 
-template <typename Tval>
-int RedBlackTree<Tval>::Node::count() {
+template <typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::Node::count() {
+	if constexpr (Policy::track_size) {
+		return subtree_size;
+	}
 	int result = 1;
 	if (left) result += left->count();
 	if (right) result += right->count();
 	return result;
 }
 
-template<typename Tval>
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::find(Tval search_key) {	
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::Node::refresh() {
+	if constexpr (Policy::track_size) {
+		subtree_size = 1 + (left ? left->subtree_size : 0) + (right ? right->subtree_size : 0);
+	}
+	if constexpr (has_augment) {
+		aggregate = Augment::from_key(key);
+		if (left) aggregate = Augment::combine(left->aggregate, aggregate);
+		if (right) aggregate = Augment::combine(aggregate, right->aggregate);
+	}
+	return;
+}
+
+//call after a node was attached or detached below this one
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::Node::refresh_upwards() {
+	if constexpr (caches_subtree_data) {
+		for (Node *current = this ; current ; current = current->parent) {
+			current->refresh();
+		}
+	}
+	return;
+}
+
+template<typename Tval, typename Policy>
+template<typename Tkey>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::find(const Tkey& search_key) {	
+	count_stat(&RedBlackTreeStats::descent_steps);
 	Node *result = nullptr;
-	if (key == search_key) {
+	auto comparison = order(search_key, key);
+	if (comparison == 0) {
 		result = this;
-	} else if (search_key < key) {
+	} else if (comparison < 0) {
 		result = left ? left -> find( search_key ) : nullptr;
 	} else {
 		result = right ? right -> find( search_key ) : nullptr ;
@@ -130,8 +635,8 @@ RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::find(Tval search_key) {
 }
 
 
-template<typename Tval>
-Tval *RedBlackTree<Tval>::Node::inorder_to_buf(Tval *out) {
+template<typename Tval, typename Policy>
+Tval *RedBlackTree<Tval, Policy>::Node::inorder_to_buf(Tval *out) {
 	Tval *next_slot = out;
 	
 	next_slot = left ? left -> inorder_to_buf(next_slot) : next_slot;
@@ -142,17 +647,68 @@ Tval *RedBlackTree<Tval>::Node::inorder_to_buf(Tval *out) {
 }
 
 
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::leftmost() {
+	Node *current = this;
+	while (current->left) {
+		current = current->left;
+	}
+	return current;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::rightmost() {
+	Node *current = this;
+	while (current->right) {
+		current = current->right;
+	}
+	return current;
+}
+
+/**
+ *  @return in-order successor, or nullptr if this holds the largest key
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::next() {
+	if (right) {
+		return right->leftmost();
+	}
+	Node *current = this;
+	while (current->parent && current->parent->right == current) {
+		current = current->parent;
+	}
+	return current->parent;
+}
+
+/**
+ *  @return in-order predecessor, or nullptr if this holds the smallest key
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::prev() {
+	if (left) {
+		return left->rightmost();
+	}
+	Node *current = this;
+	while (current->parent && current->parent->left == current) {
+		current = current->parent;
+	}
+	return current->parent;
+}
+
+
 /**
  *  @return nullptr if already exists, pointer to parent otherwise
  */
-template<typename Tval>
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::get_insertion_parent(Tval new_key) {
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::get_insertion_parent(const Tval& new_key) {
+	count_stat(&RedBlackTreeStats::descent_steps);
 	
 	RedBlackTree::Node *result = nullptr;
 	
-	if (key == new_key) {
+	auto comparison = order(new_key, key);
+	if (comparison == 0) {
 		result = nullptr;
-	} else if (new_key < key) {
+	} else if (comparison < 0) {
 		result = left ? left -> get_insertion_parent( new_key ) : this;
 	} else {
 		result = right ? right -> get_insertion_parent( new_key ) : this;
@@ -162,10 +718,47 @@ RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::get_insertion_parent(Tval ne
 }
 
 
-template<typename Tval>
-void RedBlackTree<Tval>::Node::attach_child(RedBlackTree::Node *node) {
-	assert(node->key != key);
-	if (node->key < key) {
+/**
+ *  walks up from this node to the lowest node whose subtree must contain target_key (if present at all).
+ *  cheap when target_key is close to this node's key, e.g. for the next key of a sorted stream:
+ *  only ancestors on target_key's side bound the subtree there, the others are passed without comparing.
+ *  @return nullptr if target_key is the key of this node or of an ancestor on the way, i.e. already exists
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::climb_to_cover(const Tval& target_key) {
+	auto comparison = order(target_key, key);
+	if (comparison == 0) {
+		return nullptr;
+	}
+	bool go_right = comparison > 0;
+	
+	Node *covering = this;
+	Node *current = this;
+	while (current->parent) {
+		Node *up = current->parent;
+		if (go_right ? up->left == current : up->right == current) {
+			comparison = order(target_key, up->key);
+			if (comparison == 0) {
+				return nullptr;
+			}
+			if (go_right ? comparison < 0 : comparison > 0) {
+				break;
+			}
+			//target_key lies beyond up, so beyond everything we came through
+			covering = up;
+		}
+		current = up;
+	}
+	
+	return covering;
+}
+
+
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::Node::attach_child(RedBlackTree::Node *node) {
+	auto comparison = order(node->key, key);
+	assert(comparison != 0);
+	if (comparison < 0) {
 		assert(left == nullptr);
 		left = node;
 	} else {
@@ -173,13 +766,14 @@ void RedBlackTree<Tval>::Node::attach_child(RedBlackTree::Node *node) {
 		right = node;
 	}
 	node->parent = this;
+	refresh_upwards();
 	
 	return; 
 }
 
 
-template<typename Tval>
-void RedBlackTree<Tval>::Node::append_leaf(RedBlackTree::Node *node){	
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::Node::append_leaf(RedBlackTree::Node *node){	
 	//percolate down from root and attach to parent
 	
 	if (!node) return;
@@ -190,36 +784,36 @@ void RedBlackTree<Tval>::Node::append_leaf(RedBlackTree::Node *node){
 }
 
  
-template<typename Tval>
-int RedBlackTree<Tval>::Node::child_count(){
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::Node::child_count(){
 	int result = 0;
 	if (left) result++;
 	if (right) result++;	
 	return result;
 }
 
-template<typename Tval>
-bool RedBlackTree<Tval>::Node::is_root(){
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::Node::is_root(){
 	bool result = parent == nullptr;
 	return result;
 }
 
 
-template<typename Tval>
-bool RedBlackTree<Tval>::Node::is_leaf(){	
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::Node::is_leaf(){	
 	bool result = !right && !left;
 	return result;
 }
 
 
-template<typename Tval>
-bool RedBlackTree<Tval>::Node::is_leaf_or_3_node(){	
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::Node::is_leaf_or_3_node(){	
 	bool result = right == nullptr;
 	return result;
 }
 
-template<class T>
-bool RedBlackTree<T>::Node::is_2_node() {
+template<class T, typename Policy>
+bool RedBlackTree<T, Policy>::Node::is_2_node() {
 	//in this implementation red nodes always lean left unless during transformations	
 	assert(!right || !right->is_red); //don't call this function during transformations.
 	assert(!is_red); //ensure this function is only called on black nodes.
@@ -227,8 +821,8 @@ bool RedBlackTree<T>::Node::is_2_node() {
 	return result;
 }
 
-template<typename Tval>
-bool RedBlackTree<Tval>::Node::is_3_node(){
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::Node::is_3_node(){
 	//in this implementation red nodes always lean left unless during transformations	
 	assert(!right || !right->is_red); //don't call this function during transformations.
 	
@@ -236,42 +830,17 @@ bool RedBlackTree<Tval>::Node::is_3_node(){
 	return result;
 }
 
-template<typename Tval>
-bool RedBlackTree<Tval>::Node::is_4_node(){
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::Node::is_4_node(){
 	
 	bool result = (left && right && left->is_red && right->is_red);
 	return result;
 }
 
-template<typename Tval>
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::get_sibling(){		
-	Node *sibling = nullptr;
-	if (parent) {
-		if (parent->left == this) {
-			sibling = parent->right;
-		} else {
-			sibling = parent->left;
-		}
-	}
-	return sibling;
-}
-
-template<typename Tval>
-//sibling in the sense of belonging to the same 3-node.
-//assumes this is the right child of a black node whose left child is red
-//gets the nearest (left) sibling. "far" in the sense, that it has another parent.
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::get_far_sibling(){		
-	assert(parent && parent->right == this);
-	assert(parent->is_black());
-	assert(parent->left && parent->left->is_red);
-	
-	Node *sibling = parent->left->right;
-	return sibling;
-}
-
-template<typename Tval>
-void RedBlackTree<Tval>::Node::flip_colors_with_parent(){
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::Node::flip_colors_with_parent(){
 	assert(parent);
+	count_stat(&RedBlackTreeStats::flip_colors_with_parent);
 	assert(is_red != parent->is_red);
 	
 	parent->is_red = is_red;
@@ -280,9 +849,10 @@ void RedBlackTree<Tval>::Node::flip_colors_with_parent(){
 	return;
 }
 
-template<typename Tval>
-void RedBlackTree<Tval>::Node::flip_colors_with_children(){
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::Node::flip_colors_with_children(){
 	assert(left && right);
+	count_stat(&RedBlackTreeStats::flip_colors_with_children);
 	assert(left->is_red == right->is_red && left->is_red != is_red);
 	
 	left->is_red = right->is_red = is_red;
@@ -292,12 +862,13 @@ void RedBlackTree<Tval>::Node::flip_colors_with_children(){
 }
 
 
-template<typename Tval>
+template<typename Tval, typename Policy>
 //"become the right child of my left child"
-void RedBlackTree<Tval>::Node::rotate_right(){
+void RedBlackTree<Tval, Policy>::Node::rotate_right(){
 	assert(left);
+	count_stat(&RedBlackTreeStats::rotate_right);
 	
-	RedBlackTree<Tval>::Node *old_parent = parent;
+	RedBlackTree<Tval, Policy>::Node *old_parent = parent;
 	
 	Node *new_left = left->replace_right(this);
 	replace_left(new_left);	
@@ -306,13 +877,16 @@ void RedBlackTree<Tval>::Node::rotate_right(){
 	if(old_parent) {
 		old_parent->replace_child(this, parent);
 	}
+	
+	refresh();
+	parent->refresh();
 
 	return;
 }
 
-template<typename Tval>
+template<typename Tval, typename Policy>
 //returns the replaced node that now has no connections, OR nullptr, if replaced with itself
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::replace_with(Node *replacement) {
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::replace_with(Node *replacement) {
 	if (this == replacement) {
 		return nullptr;
 	}
@@ -326,17 +900,20 @@ RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::replace_with(Node *replaceme
 	if (right != replacement) {
 		replacement->replace_right(right);
 	}
+	//the key at this position changed, so aggregates above it change as well
+	replacement->refresh_upwards();
 	parent = left = right = nullptr;
 	
 	return this;
 }
 
-template<typename Tval>
+template<typename Tval, typename Policy>
 //"become the left child of my right child"
-void RedBlackTree<Tval>::Node::rotate_left(){
+void RedBlackTree<Tval, Policy>::Node::rotate_left(){
 	assert(right);
+	count_stat(&RedBlackTreeStats::rotate_left);
 	
-	RedBlackTree<Tval>::Node *old_parent = parent;
+	RedBlackTree<Tval, Policy>::Node *old_parent = parent;
 	
 	Node *new_right = right->replace_left(this);
 	replace_right(new_right);
@@ -346,11 +923,14 @@ void RedBlackTree<Tval>::Node::rotate_left(){
 		old_parent->replace_child(this, parent);
 	}
 	
+	refresh();
+	parent->refresh();
+	
 	return;
 }
 
-template<typename Tval>
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::add(const Tval& new_val) {
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::add(const Tval& new_val) {
 	//NOTE(Gerald): we track the highest node in the tree that is affected
 	//we return it so tree can check if it's the new root and update if needed
 	Node *highest_changed = find(new_val);
@@ -367,8 +947,8 @@ RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::add(const Tval& new_val) {
 	return highest_changed;
 }
 
-template<typename Tval>
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::fix_up_add() {	
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::fix_up_add() {	
 	assert(is_red);
 	//NOTE(Gerald): we track the highest node in the tree that is affected
 	//we return it so tree can check if it's the new root and update if needed
@@ -413,266 +993,1539 @@ RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::fix_up_add() {
 
 
 
-template<typename T>
-//TODO: shorten this
-bool RedBlackTree<T>::Node::is_in_3_4_leaf() {
-	 bool result = false;
-	 result = result || (is_red && parent && parent->is_black() && !left && !right);
-	 result = result || (is_black() && child_count() == 2 && left->is_red && right->is_red && left->is_leaf() && right->is_leaf());
-	 result = result || (is_black() && child_count() == 1 && left && left->is_red);
-	 assert(child_count()!=1 || left);
-	 return result;
-}
-
-
-template<typename T>
-bool RedBlackTree<T>::Node::key_exists_in_2_3_4_node(const T& target_key) {
-	if (is_red) {
-		return parent->key_exists_in_2_3_4_node(target_key);
+/**
+ *  removes target_key on a single way down, in 2-3-4 terms: every node entered holds at least two keys,
+ *  borrowed or merged from a neighbour (lend_left, lend_right), so the key can drop out of the bottom without
+ *  a black height deficit. on the way back up rebalance restores left-leaning 2-3 nodes.
+ *  a node with two children is replaced by its successor, nodes keep their keys. an absent key may still reshape the path.
+ *  @return the removed node, detached, or nullptr if target_key doesn't exist
+ */
+template<class T, typename Policy>
+RedBlackTree<T, Policy>::Node *RedBlackTree<T, Policy>::remove(const T& target_key) {
+	StatsScope counting{stats_counters};
+	if constexpr (Policy::bottom_up_remove) {
+		return remove_bottom_up(target_key);
 	}
 	
-	bool result = false;
-	
-	result = result || key == target_key;
-	result = result || left && left->key == target_key;
-	result = result || right && right->key == target_key;
+	if (!root) {
+		return nullptr;
+	}
+	assert(cached_nodes_plausible());
+	if (!Node::is_red_node(root->left)) {
+		root->is_red = true;
+	}
 	
-	return result;
-}
-
-template<class T>
-//TODO: what if replacement has different color than original?
-RedBlackTree<T>::Node *RedBlackTree<T>::remove(const T& target_key) {
-	Node *removed_node = nullptr;
-	Node *traveller = root->get_nearest(target_key);
-	if (root->child_count() == 0) {
-		root = nullptr;
-		delete root;
-	} else if (root->child_count() == 1) {
-		assert(root->left);
-		if (root->key == target_key) {
-			Node * new_root = root->left;
-			root = nullptr;
-			delete root;
-			root = new_root;
+	//target holds the key, bottom is the node that leaves the tree: target itself or its successor
+	Node *target = nullptr;
+	Node *bottom = nullptr;
+	Node *current = root;
+	long long mark = descent_mark();
+	while (true) {
+		count_stat(&RedBlackTreeStats::descent_steps);
+		if (target || is_less(target_key, current->key)) {
+			if (!current->left) {
+				bottom = target ? current : nullptr;
+				break;
+			}
+			if (!Node::is_red_node(current->left) && !Node::is_red_node(current->left->left)) {
+				current = current->lend_left();
+			}
+			current = current->left;
 		} else {
-			delete root->left;
-			root->left = nullptr;
-		}		
-	} else {
-		if (root->key == target_key) {
-			removed_node = root;
-			traveller = root->right;
+			if (Node::is_red_node(current->left)) {
+				current = current->lean_right();
+			}
+			//without a right child a left-leaning node is a leaf, red as we made sure on the way
+			if (!current->right) {
+				bottom = is_equal(target_key, current->key) ? current : nullptr;
+				target = bottom;
+				break;
+			}
+			if (!Node::is_red_node(current->right) && !Node::is_red_node(current->right->left)) {
+				current = current->lend_right();
+			}
+			//lend_right may have brought a smaller key up, then the target is further down to the right
+			if (is_equal(target_key, current->key)) {
+				target = current;
+			}
+			current = current->right;
+		}
+	}
+	record_descent(mark);
+	
+	Node *fix_from = current;
+	if (bottom) {
+		assert(bottom->is_red && !bottom->left && !bottom->right);
+		fix_from = bottom->parent;
+		if (fix_from) {
+			fix_from->replace_child(bottom, nullptr);
+			fix_from->refresh_upwards();
+		}
+		bottom->parent = nullptr;
+		if (bottom != target) {
+			bottom->is_red = target->is_red;
+			if (fix_from == target) {
+				fix_from = bottom;
+			}
+			target->replace_with(bottom);
 		}
-		
-		traveller = traveller->descend(&removed_node, target_key);
-		traveller = traveller->turn_back(removed_node);
-		root = traveller->ascend(removed_node);
 	}
 	
+	Node *top = nullptr;
+	for (Node *current = fix_from ; current ; current = top->parent) {
+		top = current->rebalance();
+	}
+	root = top;
 	if (root) {
 		root->is_red = false;
 	}
 	
-	return removed_node;
+	finger = nullptr;
+	if (target && target == first_node) {
+		first_node = root ? root->leftmost() : nullptr;
+	}
+	if (target && target == last_node) {
+		last_node = root ? root->rightmost() : nullptr;
+	}
+	
+	assert_expensive(validate());
+	return target;
 }
 
-template<typename T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::descend(typename RedBlackTree<T>::Node **node_to_remove_ptr, const T& target_key) {
-	Node *current = this;
-	while ( ! (current->is_in_3_4_leaf() && (current->key == target_key || current->is_leaf() ) && *node_to_remove_ptr)) {
-		assert(*node_to_remove_ptr || !current->is_leaf() || current->key == target_key);
-		current->make_3_4_node();
-		if (current->key == target_key){
-			*node_to_remove_ptr = current;			
-			if (current->right) {
-				current = current->right;
-			}
-		}
-		current = current->get_nearest(target_key);
-	}
-	assert(current->is_in_3_4_leaf() && (current->key == target_key || current->is_leaf()));
-	return current;	
+/**
+ *  removes target_key without restructuring on the way down: finds its node, then remove_node.
+ *  an absent key changes nothing.
+ *  @return the removed node, detached, or nullptr if target_key doesn't exist
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::remove_bottom_up(const Tval& target_key) {
+	StatsScope counting{stats_counters};
+	long long mark = descent_mark();
+	Node *target = root ? root->find(target_key) : nullptr;
+	record_descent(mark);
+	Node *result = target ? remove_node(target) : nullptr;
+	return result;
 }
 
-template<typename T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::turn_back(typename RedBlackTree<T>::Node *node_to_remove) {
-	assert(is_in_3_4_leaf());	
-	
-	Node *ascent_start = is_red ? parent : left;
-	
-	Node *old_parent = parent;
-	remove_key_from_3_4_leaf(this->key);
+/**
+ *  takes target, a node of this tree, out: swaps in the successor if there are two children,
+ *  drops a node at the bottom and repairs the black height from there upwards, see fix_black_deficit.
+ *  @return target, detached
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::remove_node(Node *target) {
+	StatsScope counting{stats_counters};
+	assert(cached_nodes_plausible());
+	finger = nullptr;
+	//nodes keep their keys through the repair, the neighbour of an extreme becomes the new one
+	if (target == first_node) {
+		first_node = target->next();
+	}
+	if (target == last_node) {
+		last_node = target->prev();
+	}
 	
-	if (this != node_to_remove) {
-		
-		if (ascent_start == node_to_remove) {
-			assert(ascent_start == old_parent) {
-				ascent_start = this;
-			}
+	//the successor of a node with a right child is a leaf. without a right child the node is at the bottom already
+	Node *bottom = target->right ? target->right->leftmost() : target;
+	Node *bottom_parent = bottom->parent;
+	//a node that stays in the tree, to find the root from
+	Node *remaining = bottom_parent;
+	
+	if (bottom->left) {
+		//black node of a 3-node with its red key below, that key takes its place
+		Node *child = bottom->replace_left(nullptr);
+		child->is_red = false;
+		child->parent = nullptr;
+		if (bottom_parent) {
+			bottom_parent->replace_child(bottom, child);
+		}
+		child->refresh_upwards();
+		remaining = child;
+	} else if (bottom_parent) {
+		bool was_left = bottom_parent->left == bottom;
+		bottom_parent->replace_child(bottom, nullptr);
+		bottom_parent->refresh_upwards();
+		if (!bottom->is_red) {
+			remaining = bottom_parent->fix_black_deficit(was_left);
 		}
-		is_red = node_to_remove->is_red;
-		node_to_remove->replace_with(this);
 	}
+	bottom->parent = nullptr;
 	
-	return ascent_start;
+	if (bottom != target) {
+		bottom->is_red = target->is_red;
+		target->replace_with(bottom);
+		remaining = bottom;
+	}
+	
+	root = remaining;
+	while (root && root->parent) {
+		root = root->parent;
+	}
+	if (root) {
+		root->is_red = false;
+	}
+	assert_expensive(validate());
+	return target;
 }
 
-template<typename T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::remove_key_from_3_4_leaf(const T& target_key) {	
-	assert(is_in_3_4_leaf());
-	key_exists_in_2_3_4_node(target_key);
-	
-	Node *removed_node = this;
-	if (key == target_key) {
-		if (right) {
-			assert(is_black());
-			rotate_left();
-			parent->is_red = false;
-			parent->replace_left(left);
-		} else if (left) {
-			assert(is_black());
-			left->parent = nullptr;
-			left->is_red = false;
-			if (parent) {
-				parent->replace_child(this, left);
-			}
-		} else {
-			parent->replace_child(this, nullptr);
-		}
-		parent = right = left = nullptr;
-	} else if (is_leaf()) {
-		removed_node = parent->get_nearest(target_key)->remove_key_from_3_4_leaf(target_key);
-	} else {
-		removed_node = get_nearest(target_key)->remove_key_from_3_4_leaf(target_key);
-	}
-	return removed_node;
+/**
+ *  after a change of the whole tree: forgets the finger and finds the first and last node again, O(log n)
+ */
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::refresh_cached_nodes() {
+	finger = nullptr;
+	first_node = root ? root->leftmost() : nullptr;
+	last_node = root ? root->rightmost() : nullptr;
+	return;
 }
 
-template<typename T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::ascend(typename RedBlackTree<T>::Node *removed_node) {
-	Node *current = this;
-	while (!current->is_root()){
-		current->fix_up();
-		current = current->parent;
-	}
-	Node *new_root = current->fix_up_root();
-	return new_root;
+/**
+ *  O(1) part of what validate checks about first_node and last_node, for the asserts of the methods that trust them:
+ *  set exactly when the tree has keys, and without a child on their outer side.
+ *  catches a root that was replaced without refresh_cached_nodes
+ */
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::cached_nodes_plausible() const {
+	bool result = !first_node == !root && !last_node == !root;
+	result = result && (!first_node || (!first_node->left && !last_node->right));
+	return result;
 }
 
-template<typename T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::fix_up_root() {
-	assert(is_root());
-	if (is_black()) {
-		if (is_4_node()) {
-			flip_colors_with_children();
-		} else if (right && right->is_red) {
-			assert(left);
-			rotate_left();
-			parent->is_red = false;
-			is_red = true;
-			return parent;
-		}		
-	}
-	return this;
+/**
+ *  removes the smallest key without searching for it. with Policy::multiset all its occurrences go.
+ *  @return the removed node, detached, or nullptr if empty
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::pop_min() {
+	Node *target = min_node();
+	Node *result = target ? remove_node(target) : nullptr;
+	return result;
 }
 
-template<typename T>
-void RedBlackTree<T>::Node::fix_up() {		
-	if (is_black()) {		
-		if (right && right->is_red) {
-			assert(left && left->is_red);
-			flip_colors_with_children();
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::pop_max() {
+	Node *target = max_node();
+	Node *result = target ? remove_node(target) : nullptr;
+	return result;
+}
+
+/**
+ *  the subtree at left (left_is_short) or right lost one level of black height.
+ *  in 2-3 terms: borrow a key through the parent from a neighbouring 3-node, which ends the repair,
+ *  or merge with a neighbouring 2-node and the parent's key. that ends it as well if the parent was a 3-node,
+ *  otherwise the parent's subtree is now one level short. at most two rotations per level,
+ *  and merges that go on upwards leave 3-nodes behind, so a series of removals rotates O(1) times per removal on average.
+ *  @return the highest node changed
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::fix_black_deficit(bool left_is_short) {
+	count_stat(&RedBlackTreeStats::fix_black_deficit);
+	Node *current = this;
+	Node *highest_changed = this;
+	while (current) {
+		bool was_red = current->is_red;
+		Node *next_short = nullptr;
+		if (left_is_short) {
+			//a right child is black, and it exists since its side is at least one level high
+			Node *sibling = current->right;
+			if (sibling->left && sibling->left->is_red) {
+				//borrow: the sibling's red key moves up
+				sibling->rotate_right();
+				current->rotate_left();
+				highest_changed = current->parent;
+				highest_changed->is_red = was_red;
+				highest_changed->right->is_red = false;
+				current->is_red = false;
+				break;
+			}
+			//merge into a 3-node under the sibling, which takes our place
+			current->rotate_left();
+			highest_changed = current->parent;
+			highest_changed->is_red = false;
+			current->is_red = true;
+			next_short = highest_changed;
+		} else {
+			Node *sibling = current->left;
+			if (sibling->is_red) {
+				//we are the black key of a 3-node and the short subtree is its right one.
+				//the middle subtree is the neighbour
+				Node *middle = sibling->right;
+				if (middle->left && middle->left->is_red) {
+					sibling->rotate_left();
+					current->rotate_right();
+					highest_changed = current->parent;
+					highest_changed->is_red = false;
+					sibling->is_red = true;
+					sibling->right->is_red = false;
+				} else {
+					current->rotate_right();
+					highest_changed = sibling;
+					sibling->is_red = false;
+					middle->is_red = true;
+				}
+				current->is_red = false;
+				break;
+			}
+			if (sibling->left && sibling->left->is_red) {
+				current->rotate_right();
+				highest_changed = sibling;
+				sibling->is_red = was_red;
+				sibling->left->is_red = false;
+				current->is_red = false;
+				break;
+			}
+			//merge: the sibling becomes our red key
+			sibling->is_red = true;
+			current->is_red = false;
+			highest_changed = current;
+			next_short = current;
+		}
+		
+		if (was_red) {
+			//the parent 3-node gave up a key, its black height stays
+			break;
+		}
+		current = next_short->parent;
+		left_is_short = current && current->left == next_short;
+	}
+	return highest_changed;
+}
+
+//"my red right child takes my place and color, I become its red left child"
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::lean_left() {
+	assert(right && right->is_red);
+	Node *top = right;
+	rotate_left();
+	top->is_red = is_red;
+	is_red = true;
+	return top;
+}
+
+//"my red left child takes my place and color, I become its red right child"
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::lean_right() {
+	assert(left && left->is_red);
+	Node *top = left;
+	rotate_right();
+	top->is_red = is_red;
+	is_red = true;
+	return top;
+}
+
+/**
+ *  a step of the top-down remove, for a red node whose left child is a 2-node: the left child gets a second key,
+ *  borrowed from the right sibling if that is a 3-node (shift), otherwise merged with ours and the sibling's (squash).
+ *  @return the node now at our place
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::lend_left() {
+	count_stat(&RedBlackTreeStats::lend);
+	Node *top = this;
+	flip_colors_with_children();
+	if (is_red_node(right->left)) {
+		right->lean_right();
+		top = lean_left();
+		top->flip_colors_with_children();
+		count_stat(&RedBlackTreeStats::shift);
+	} else {
+		count_stat(&RedBlackTreeStats::squash);
+	}
+	return top;
+}
+
+/**
+ *  the mirror image of lend_left, for a red node whose right child is a 2-node
+ *  @return the node now at our place
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::lend_right() {
+	count_stat(&RedBlackTreeStats::lend);
+	Node *top = this;
+	flip_colors_with_children();
+	if (is_red_node(left->left)) {
+		top = lean_right();
+		top->flip_colors_with_children();
+		count_stat(&RedBlackTreeStats::shift);
+	} else {
+		count_stat(&RedBlackTreeStats::squash);
+	}
+	return top;
+}
+
+/**
+ *  undoes what the way down of the top-down remove left at this node: a red right child, two reds in a row
+ *  on the left, or a 4-node, which splits and passes a red key up
+ *  @return the node now at our place
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::rebalance() {
+	Node *top = this;
+	if (is_red_node(right) && !is_red_node(left)) {
+		top = lean_left();
+	}
+	if (is_red_node(top->left) && is_red_node(top->left->left)) {
+		top = top->lean_right();
+	}
+	if (is_red_node(top->left) && is_red_node(top->right)) {
+		top->flip_colors_with_children();
+	}
+	return top;
+}
+
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::add(const Tval& new_val) {
+	if constexpr (Policy::multiset) {
+		insert(new_val);
+		return;
+	}
+	if constexpr (Policy::finger_insert) {
+		finger = add_hint(finger, new_val);
+		return;
+	}
+	
+	//NOTE: one search, an existing key is found where the new node would go
+	insert_below(root, new_val);
+	return;
+}
+
+/**
+ *  adds one occurrence of new_val. with Policy::multiset an existing key counts one more,
+ *  otherwise it stays as it is, like add.
+ *  @return the node holding new_val
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::insert(const Tval& new_val) {
+	StatsScope counting{stats_counters};
+	//NOTE: look first, repeated keys are the common case when counting
+	long long mark = descent_mark();
+	Node *result = root ? root->find(new_val) : nullptr;
+	record_descent(mark);
+	if (result) {
+		if constexpr (Policy::multiset) {
+			++result->multiplicity;
+		}
+	} else if constexpr (Policy::finger_insert) {
+		result = finger = add_hint(finger, new_val);
+	} else {
+		result = insert_below(root, new_val);
+	}
+	return result;
+}
+
+/**
+ *  removes one occurrence of target_key, the node goes with the last one.
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::erase_one(const Tval& target_key) {
+	StatsScope counting{stats_counters};
+	long long mark = descent_mark();
+	Node *target = root ? root->find(target_key) : nullptr;
+	record_descent(mark);
+	if (!target) {
+		return false;
+	}
+	if constexpr (Policy::multiset) {
+		if (target->multiplicity > 1) {
+			--target->multiplicity;
+			return true;
+		}
+	}
+	delete remove_node(target);
+	return true;
+}
+
+/**
+ *  @return occurrences of target_key: 0 or 1 unless Policy::multiset
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+int RedBlackTree<Tval, Policy>::count(const Tkey& target_key) const {
+	StatsScope counting{stats_counters};
+	long long mark = descent_mark();
+	Node *found = root ? root->find(target_key) : nullptr;
+	record_descent(mark);
+	int result = 0;
+	if (found) {
+		if constexpr (Policy::multiset) {
+			result = found->multiplicity;
+		} else {
+			result = 1;
+		}
+	}
+	return result;
+}
+
+/**
+ *  inserts new_val starting from hint, a node of this tree or nullptr, instead of the root:
+ *  climbs through parent pointers to the lowest subtree that covers new_val and descends from there.
+ *  a key d positions away from hint takes O(log d) comparisons plus rebalancing.
+ *  @return the node holding new_val, new or already there
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::add_hint(Node *hint, const Tval& new_val) {
+	StatsScope counting{stats_counters};
+	Node *start = hint ? hint->climb_to_cover(new_val) : root;
+	Node *result = (start || !root) ? insert_below(start, new_val) : nullptr;
+	if (!result) {
+		result = root->find(new_val);
+	}
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::add_hint(iterator hint, const Tval& new_val) {
+	iterator result{add_hint(hint.node, new_val), this};
+	return result;
+}
+
+/**
+ *  inserts new_val by descending from start instead of the root.
+ *  start must be the root or a node whose subtree covers new_val, see climb_to_cover.
+ *  @return the new node, or nullptr if new_val already exists
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::insert_below(Node *start, const Tval& new_val) {
+	StatsScope counting{stats_counters};
+	assert(cached_nodes_plausible());
+	if (!root) {
+		root = first_node = last_node = new Node{new_val};
+		return root;
+	}
+	
+	long long mark = descent_mark();
+	Node *insertion_parent = start->get_insertion_parent(new_val);
+	record_descent(mark);
+	if (!insertion_parent) {
+		return nullptr;
+	}
+	
+	Node *new_node = new Node{new_val};
+	new_node->is_red = true;
+	insertion_parent->attach_child(new_node);
+	//rotations keep the order, an extreme stays one
+	if (insertion_parent == first_node && insertion_parent->left == new_node) {
+		first_node = new_node;
+	} else if (insertion_parent == last_node && insertion_parent->right == new_node) {
+		last_node = new_node;
+	}
+	
+	Node *highest_changed = new_node->fix_up_add();
+	if (highest_changed->is_root()) {
+		root = highest_changed;
+	}
+	
+	assert_expensive(validate());
+	return new_node;
+}
+
+/**
+ *  sorts and deduplicates the batch, then inserts it in ascending order.
+ *  each insertion climbs up from the previous one instead of descending from the root,
+ *  so neighbouring keys share most of the path.
+ *  large batches (see insert_many_rebuild_ratio) are merged with the contents and rebuilt
+ *  with assign_sorted instead. NOTE: that replaces all nodes, pointers into the tree become invalid.
+ */
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::insert_many(std::span<const Tval> new_vals) {
+	if (new_vals.empty()) {
+		return;
+	}
+	if constexpr (Policy::multiset) {
+		//every occurrence counts, the deduplication below would drop some
+		for (const Tval& new_val : new_vals) {
+			insert(new_val);
+		}
+		return;
+	}
+	
+	auto less = [](const Tval& a, const Tval& b) { return is_less(a, b); };
+	auto equal = [](const Tval& a, const Tval& b) { return is_equal(a, b); };
+	
+	std::vector<Tval> batch{new_vals.begin(), new_vals.end()};
+	std::sort(batch.begin(), batch.end(), less);
+	batch.erase(std::unique(batch.begin(), batch.end(), equal), batch.end());
+	
+	//black nodes on the left spine: the tree holds at least 2^height-1 keys
+	long long estimated_size = 1;
+	for (Node *cur = root ; cur ; cur = cur->left) {
+		if (cur->is_black()) estimated_size *= 2;
+	}
+	
+	if ((long long)batch.size() * insert_many_rebuild_ratio >= estimated_size) {
+		int old_count = root ? root->count() : 0;
+		std::vector<Tval> old_keys(old_count);
+		if (root) root->inorder_to_buf(old_keys.data());
+		
+		std::vector<Tval> merged;
+		merged.reserve(old_keys.size() + batch.size());
+		std::set_union(old_keys.begin(), old_keys.end(), batch.begin(), batch.end(), std::back_inserter(merged), less);
+		
+		assign_sorted(merged.begin(), merged.end());
+		return;
+	}
+	
+	Node *previous = nullptr;
+	for (const Tval& new_val : batch) {
+		Node *start = previous ? previous->climb_to_cover(new_val) : root;
+		if (!start) {
+			continue; //already exists
+		}
+		Node *inserted = insert_below(start, new_val);
+		if (inserted) {
+			previous = inserted;
+		}
+	}
+	
+	return;
+}
+
+/**
+ *  @return a copy of this tree's counters, see RedBlackTreeStats
+ */
+template<typename Tval, typename Policy>
+RedBlackTreeStats RedBlackTree<Tval, Policy>::stats() const {
+	static_assert(Policy::collect_stats, "stats need a policy with collect_stats, e.g. StatsPolicy");
+	return stats_counters;
+}
+
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::reset_stats() {
+	static_assert(Policy::collect_stats, "stats need a policy with collect_stats, e.g. StatsPolicy");
+	stats_counters = RedBlackTreeStats{};
+	return;
+}
+
+//counts one in the counters of the tree whose method runs on this thread, see StatsScope. outside of tree methods nothing counts
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::count_stat(long long RedBlackTreeStats::*counter) {
+	if constexpr (Policy::collect_stats) {
+		if (stats_sink) {
+			++(stats_sink->*counter);
+		}
+	}
+	return;
+}
+
+//a descent starts: the steps this tree counted so far. 0 without Policy::collect_stats
+template<typename Tval, typename Policy>
+long long RedBlackTree<Tval, Policy>::descent_mark() const {
+	long long result = 0;
+	if constexpr (Policy::collect_stats) {
+		result = stats_counters.descent_steps;
+	}
+	return result;
+}
+
+//the descent started at mark ended, its depth is the steps counted since
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::record_descent(long long mark) const {
+	if constexpr (Policy::collect_stats) {
+		int depth = int(stats_counters.descent_steps - mark);
+		++stats_counters.descents;
+		++stats_counters.descents_by_depth[std::min(depth, RedBlackTreeStats::max_tracked_depth - 1)];
+	}
+	return;
+}
+
+/**
+ *  O(1) with Policy::track_size, otherwise this counts all nodes
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::size() const {
+	int result = root ? root->count() : 0;
+	return result;
+}
+
+/**
+ *  @return number of keys less than target_key
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::rank(const Tval& target_key) const {
+	static_assert(Policy::track_size, "rank needs a policy with track_size, e.g. OrderStatisticPolicy");
+	int result = 0;
+	Node *current = root;
+	while (current) {
+		if (is_less(current->key, target_key)) {
+			result += 1 + (current->left ? current->left->subtree_size : 0);
+			current = current->right;
+		} else {
+			current = current->left;
+		}
+	}
+	return result;
+}
+
+/**
+ *  @return iterator to the key with the given 0-based position in sorted order, or end()
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::select(int index) const {
+	static_assert(Policy::track_size, "select needs a policy with track_size, e.g. OrderStatisticPolicy");
+	Node *current = (index >= 0) ? root : nullptr;
+	while (current) {
+		int left_size = current->left ? current->left->subtree_size : 0;
+		if (index < left_size) {
+			current = current->left;
+		} else if (index == left_size) {
+			break;
+		} else {
+			index -= left_size + 1;
+			current = current->right;
+		}
+	}
+	iterator result{current, this};
+	return result;
+}
+
+/**
+ *  @return number of keys in [low, high)
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::count_range(const Tval& low, const Tval& high) const {
+	if (!is_less(low, high)) {
+		return 0;
+	}
+	int result = rank(high) - rank(low);
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Aggregate RedBlackTree<Tval, Policy>::aggregate() const {
+	static_assert(has_augment, "aggregate needs a policy with an Augment");
+	Aggregate result = root ? root->aggregate : Augment::identity();
+	return result;
+}
+
+/**
+ *  @return Augment::combine over all keys in [low, high), in key order. O(log n)
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Aggregate RedBlackTree<Tval, Policy>::aggregate_range(const Tval& low, const Tval& high) const {
+	static_assert(has_augment, "aggregate_range needs a policy with an Augment");
+	
+	//find the highest node inside the range, both bounds split off below it
+	Node *split = root;
+	while (split && !(!is_less(split->key, low) && is_less(split->key, high))) {
+		split = is_less(split->key, low) ? split->right : split->left;
+	}
+	if (!split || !is_less(low, high)) {
+		return Augment::identity();
+	}
+	
+	//left of split: everything at or above low
+	Aggregate from_low = Augment::identity();
+	for (Node *current = split->left ; current ; ) {
+		if (is_less(current->key, low)) {
+			current = current->right;
+		} else {
+			Aggregate right_part = Augment::from_key(current->key);
+			if (current->right) right_part = Augment::combine(right_part, current->right->aggregate);
+			from_low = Augment::combine(right_part, from_low);
+			current = current->left;
 		}
-	} else if (parent->is_black()) {		
+	}
+	
+	//right of split: everything below high
+	Aggregate to_high = Augment::identity();
+	for (Node *current = split->right ; current ; ) {
+		if (is_less(current->key, high)) {
+			Aggregate left_part = Augment::from_key(current->key);
+			if (current->left) left_part = Augment::combine(current->left->aggregate, left_part);
+			to_high = Augment::combine(to_high, left_part);
+			current = current->right;
+		} else {
+			current = current->left;
+		}
+	}
+	
+	Aggregate result = Augment::combine(Augment::combine(from_low, Augment::from_key(split->key)), to_high);
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::begin() const {
+	iterator result{root ? root->leftmost() : nullptr, this};
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::end() const {
+	iterator result{nullptr, this};
+	return result;
+}
+
+/**
+ *  the one descent of a find-or-insert. on a miss *parent is the node a new key would hang from,
+ *  nullptr if the tree is empty, and insert_below can start there instead of at the root.
+ *  @return the node holding target_key, or nullptr
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::find_or_parent(const Tkey& target_key, Node **parent) const {
+	StatsScope counting{stats_counters};
+	long long mark = descent_mark();
+	Node *result = nullptr;
+	*parent = nullptr;
+	Node *current = root;
+	while (current) {
+		count_stat(&RedBlackTreeStats::descent_steps);
+		auto comparison = order(target_key, current->key);
+		if (comparison == 0) {
+			result = current;
+			break;
+		}
+		*parent = current;
+		current = comparison < 0 ? current->left : current->right;
+	}
+	record_descent(mark);
+	return result;
+}
+
+template<typename Tval, typename Policy>
+template<typename Tkey>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::find(const Tkey& target_key) const {
+	StatsScope counting{stats_counters};
+	long long mark = descent_mark();
+	iterator result{root ? root->find(target_key) : nullptr, this};
+	record_descent(mark);
+	return result;
+}
+
+/**
+ *  looks up all target_keys, results[i] is find(target_keys[i]).
+ *  a single lookup waits for one cache miss per level. here a group of lookups takes one step
+ *  each in turn and prefetches the child it moves to, so the misses of the whole group overlap.
+ */
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::find_many(std::span<const Tval> target_keys, std::span<iterator> results) const {
+	assert(results.size() >= target_keys.size());
+	
+	for (size_t first = 0 ; first < target_keys.size() ; first += find_many_group_size) {
+		int count = (int)::min<size_t>(find_many_group_size, target_keys.size() - first);
+		const Tval *keys = target_keys.data() + first;
+		iterator *out = results.data() + first;
+		
+		Node *current[find_many_group_size];
+		for (int i = 0 ; i < count ; ++i) {
+			current[i] = root;
+			out[i] = end();
+		}
+		
+		bool any_active = true;
+		while (any_active) {
+			any_active = false;
+			for (int i = 0 ; i < count ; ++i) {
+				Node *node = current[i];
+				if (!node) {
+					continue;
+				}
+				auto comparison = order(keys[i], node->key);
+				if (comparison == 0) {
+					out[i].node = node;
+					node = nullptr;
+				} else {
+					node = comparison < 0 ? node->left : node->right;
+				}
+				if (node) {
+					__builtin_prefetch(node);
+					any_active = true;
+				}
+				current[i] = node;
+			}
+		}
+	}
+	return;
+}
+
+/**
+ *  @return first key not less than target_key
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::lower_bound(const Tkey& target_key) const {
+	Node *found = nullptr;
+	Node *current = root;
+	while (current) {
+		if (is_less(current->key, target_key)) {
+			current = current->right;
+		} else {
+			found = current;
+			current = current->left;
+		}
+	}
+	iterator result{found, this};
+	return result;
+}
+
+/**
+ *  @return first key greater than target_key
+ */
+template<typename Tval, typename Policy>
+template<typename Tkey>
+RedBlackTree<Tval, Policy>::iterator RedBlackTree<Tval, Policy>::upper_bound(const Tkey& target_key) const {
+	Node *found = nullptr;
+	Node *current = root;
+	while (current) {
+		if (is_less(target_key, current->key)) {
+			found = current;
+			current = current->left;
+		} else {
+			current = current->right;
+		}
+	}
+	iterator result{found, this};
+	return result;
+}
+
+template<typename Tval, typename Policy>
+template<typename Tkey>
+std::pair<typename RedBlackTree<Tval, Policy>::iterator, typename RedBlackTree<Tval, Policy>::iterator> RedBlackTree<Tval, Policy>::equal_range(const Tkey& target_key) const {
+	std::pair<iterator, iterator> result{lower_bound(target_key), upper_bound(target_key)};
+	return result;
+}
+
+template<class T, typename Policy>
+void RedBlackTree<T, Policy>::Node::remove_leaf() {	
+	assert(is_leaf());
+	parent->replace_child(this, nullptr);
+	return;
+}
+
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::update_root() {
+	while (root->parent) {
+		root = root->parent;
+	}
+	refresh_cached_nodes();
+	return;
+}
+
+
+/**
+ *  @return number of nodes freed
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::Node::delete_subtree() {
+	int result = 1;
+	if (left) result += left->delete_subtree();
+	if (right) result += right->delete_subtree();
+	delete this;
+	return result;
+}
+
+template<typename Tval, typename Policy>
+void RedBlackTree<Tval, Policy>::clear() {
+	if (root) {
+		root->delete_subtree();
+	}
+	root = nullptr;
+	refresh_cached_nodes();
+	return;
+}
+
+/**
+ *  builds a subtree of `count` keys with the given black height, consuming keys from *cur in order.
+ *  a black height h holds between 2^h-1 keys (all 2-nodes) and 3^h-1 keys (all 3-nodes).
+ *  we make a 2-node whenever the children can hold the remaining keys, so red nodes only appear
+ *  where the bottom level is not full. no rotations or color flips are needed afterwards.
+ */
+template<typename Tval, typename Policy>
+template<typename It>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::build_sorted(It *cur, It last, int count, int height) {
+	if (height == 0) {
+		assert(count == 0);
+		return nullptr;
+	}
+	
+	long long child_capacity = 1;
+	for (int i = 1 ; i < height ; ++i) {
+		child_capacity *= 3;
+	}
+	child_capacity -= 1;
+	
+	//NOTE: duplicates in the input were already excluded from `count`, we skip them here.
+	auto take_key = [cur, last]() {
+		Tval key = **cur;
+		++*cur;
+		while (*cur != last && !is_less(key, **cur)) {
+			assert(!is_less(**cur, key)); //input must be sorted
+			++*cur;
+		}
+		return key;
+	};
+	
+	Node *result = nullptr;
+	
+	if (count - 1 <= 2 * child_capacity) {
+		int right_count = (count - 1) / 2;
+		int left_count = count - 1 - right_count;
+		
+		Node *left_tree = build_sorted(cur, last, left_count, height - 1);
+		result = new Node{take_key()};
+		result->replace_left(left_tree);
+		result->replace_right(build_sorted(cur, last, right_count, height - 1));
+		result->refresh();
+	} else {
+		//3-node: black node with a red left child
+		int remaining = count - 2;
+		int first_count = (remaining + 2) / 3;
+		int middle_count = (remaining + 1) / 3;
+		int last_count = remaining / 3;
+		
+		Node *first_tree = build_sorted(cur, last, first_count, height - 1);
+		Node *red = new Node{take_key()};
+		red->is_red = true;
+		red->replace_left(first_tree);
+		red->replace_right(build_sorted(cur, last, middle_count, height - 1));
+		red->refresh();
+		
+		result = new Node{take_key()};
+		result->replace_left(red);
+		result->replace_right(build_sorted(cur, last, last_count, height - 1));
+		result->refresh();
+	}
+	
+	return result;
+}
+
+/**
+ *  replaces the contents with the keys in [first, last), which must be sorted in ascending order.
+ *  duplicates are skipped. runs in linear time, every node is allocated exactly once.
+ */
+template<typename Tval, typename Policy>
+template<std::forward_iterator It>
+void RedBlackTree<Tval, Policy>::assign_sorted(It first, It last) {
+	clear();
+	
+	int count = 0;
+	for (It cur = first ; cur != last ; ) {
+		Tval key = *cur;
+		++count;
+		while (cur != last && !is_less(key, *cur)) {
+			++cur;
+		}
+	}
+	
+	int height = 0;
+	while ((2ll << height) - 1 <= count) {
+		++height;
+	}
+	
+	It cur = first;
+	root = Node::build_sorted(&cur, last, count, height);
+	refresh_cached_nodes();
+	
+	assert_expensive(validate());
+	return;
+}
+
+
+/**
+ *  detaches tree from its parent and paints it black, so it can stand as a tree of its own
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::as_root(Node *tree) {
+	if (tree) {
+		tree->parent = nullptr;
+		tree->is_red = false;
+	}
+	return tree;
+}
+
+/**
+ *  @return black nodes on the path from tree down to a leaf, tree included. 0 for an empty tree
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::Node::spine_black_height(Node *tree) {
+	int result = 0;
+	for (Node *current = tree ; current ; current = current->left) {
+		if (current->is_black()) ++result;
+	}
+	return result;
+}
+
+/**
+ *  joins left_tree, middle and right_tree, where all keys of left_tree < middle->key < all keys of right_tree.
+ *  walks down the spine of the taller tree to a black node with the black height of the other tree,
+ *  hangs middle in there as a red node and fixes up as after an insertion.
+ *  O(difference of black heights + 1)
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::join(Node *left_tree, Node *middle, Node *right_tree) {
+	as_root(left_tree);
+	as_root(right_tree);
+	middle->parent = middle->left = middle->right = nullptr;
+	
+	int left_height = spine_black_height(left_tree);
+	int right_height = spine_black_height(right_tree);
+	
+	if (left_height == right_height) {
+		middle->replace_left(left_tree);
+		middle->replace_right(right_tree);
+		middle->is_red = false;
+		middle->refresh();
+		return middle;
+	}
+	
+	middle->is_red = true;
+	Node *hook = nullptr;
+	if (left_height > right_height) {
+		Node *current = left_tree;
+		int height = left_height;
+		while (current && (current->is_red || height > right_height)) {
+			if (current->is_black()) --height;
+			hook = current;
+			current = current->right;
+		}
+		middle->replace_left(current);
+		middle->replace_right(right_tree);
+		middle->refresh();
+		hook->replace_right(middle);
+	} else {
+		Node *current = right_tree;
+		int height = right_height;
+		while (current && (current->is_red || height > left_height)) {
+			if (current->is_black()) --height;
+			hook = current;
+			current = current->left;
+		}
+		middle->replace_left(left_tree);
+		middle->replace_right(current);
+		middle->refresh();
+		hook->replace_left(middle);
+	}
+	hook->refresh_upwards();
+	
+	Node *result = middle->fix_up_add();
+	while (result->parent) {
+		result = result->parent;
+	}
+	result->is_red = false;
+	return result;
+}
+
+/**
+ *  join without a middle key: the largest key of left_tree takes that place
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::join2(Node *left_tree, Node *right_tree) {
+	if (!left_tree) {
+		return as_root(right_tree);
+	}
+	if (!right_tree) {
+		return as_root(left_tree);
+	}
+	Tval last_key = left_tree->rightmost()->key;
+	Node *rest = nullptr;
+	Node *nothing = nullptr;
+	Node *last = split(left_tree, last_key, &rest, &nothing);
+	Node *result = join(rest, last, right_tree);
+	return result;
+}
+
+/**
+ *  splits tree into *less, the keys less than split_key, and *greater, the keys greater than split_key.
+ *  O(log n): the pieces that hang off the search path are joined back together on the way up.
+ *  @return the detached node holding split_key, or nullptr
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::split(Node *tree, const Tval& split_key, Node **less, Node **greater) {
+	if (!tree) {
+		*less = *greater = nullptr;
+		return nullptr;
+	}
+	
+	Node *left_tree = tree->replace_left(nullptr);
+	Node *right_tree = tree->replace_right(nullptr);
+	tree->parent = nullptr;
+	tree->refresh();
+	
+	Node *found = nullptr;
+	auto comparison = order(split_key, tree->key);
+	if (comparison == 0) {
+		*less = as_root(left_tree);
+		*greater = as_root(right_tree);
+		found = tree;
+	} else if (comparison < 0) {
+		Node *between = nullptr;
+		found = split(as_root(left_tree), split_key, less, &between);
+		*greater = join(between, tree, right_tree);
+	} else {
+		Node *between = nullptr;
+		found = split(as_root(right_tree), split_key, &between, greater);
+		*less = join(left_tree, tree, between);
+	}
+	return found;
+}
+
+/**
+ *  runs both halves of a set operation. the left one goes to another thread
+ *  while fork levels are left and work_tree is above the grain size.
+ */
+template<typename Tval, typename Policy>
+template<typename Fleft, typename Fright>
+std::pair<typename RedBlackTree<Tval, Policy>::Node *, typename RedBlackTree<Tval, Policy>::Node *> RedBlackTree<Tval, Policy>::Node::fork_join(Node *work_tree, int fork_depth, Fleft&& left_work, Fright&& right_work) {
+	std::pair<Node *, Node *> result;
+	if (fork_depth > 0 && spine_black_height(work_tree) >= set_operation_grain_height) {
+		//the other thread counts on its own, its counts join ours with its result
+		StatsCounters forked_counters{};
+		auto left_result = std::async(std::launch::async, [&]() {
+			StatsScope counting{forked_counters};
+			return left_work();
+		});
+		result.second = right_work();
+		result.first = left_result.get();
+		if constexpr (Policy::collect_stats) {
+			if (stats_sink) {
+				*stats_sink += forked_counters;
+			}
+		}
+	} else {
+		result.first = left_work();
+		result.second = right_work();
+	}
+	return result;
+}
+
+/**
+ *  the root of first splits second, the halves are united recursively and joined back with that root.
+ *  O(m log(n/m + 1)) work for sizes m <= n.
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::set_union(Node *first, Node *second, int fork_depth) {
+	if (!first) {
+		return as_root(second);
+	}
+	if (!second) {
+		return as_root(first);
+	}
+	
+	Node *less = nullptr;
+	Node *greater = nullptr;
+	Node *duplicate = split(second, first->key, &less, &greater);
+	delete duplicate;
+	
+	//NOTE: the halves must not reach first through their parent pointers, they may run on different threads
+	Node *left_tree = as_root(first->replace_left(nullptr));
+	Node *right_tree = as_root(first->replace_right(nullptr));
+	
+	auto [left_result, right_result] = fork_join(first, fork_depth,
+		[=]() { return set_union(left_tree, less, fork_depth - 1); },
+		[=]() { return set_union(right_tree, greater, fork_depth - 1); });
+	
+	Node *result = join(left_result, first, right_result);
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::set_intersection(Node *first, Node *second, int fork_depth) {
+	if (!first || !second) {
+		if (first) first->delete_subtree();
+		if (second) second->delete_subtree();
+		return nullptr;
+	}
+	
+	Node *less = nullptr;
+	Node *greater = nullptr;
+	Node *duplicate = split(second, first->key, &less, &greater);
+	
+	Node *left_tree = as_root(first->replace_left(nullptr));
+	Node *right_tree = as_root(first->replace_right(nullptr));
+	
+	auto [left_result, right_result] = fork_join(first, fork_depth,
+		[=]() { return set_intersection(left_tree, less, fork_depth - 1); },
+		[=]() { return set_intersection(right_tree, greater, fork_depth - 1); });
+	
+	Node *result = nullptr;
+	if (duplicate) {
+		delete duplicate;
+		result = join(left_result, first, right_result);
+	} else {
+		delete first;
+		result = join2(left_result, right_result);
+	}
+	return result;
+}
+
+/**
+ *  keys of first that are not in second
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::set_difference(Node *first, Node *second, int fork_depth) {
+	if (!first || !second) {
+		if (second) second->delete_subtree();
+		return as_root(first);
+	}
 	
-		if (parent->is_4_node()) {
-			parent->flip_colors_with_children();
-			
-		} else if (parent->right == this) {			
-			parent->rotate_left();
-			parent->is_red = false;
-			left->is_red = true;
-		}
-			
-	} else { // parent is red
+	Node *less = nullptr;
+	Node *greater = nullptr;
+	Node *duplicate = split(first, second->key, &less, &greater);
+	delete duplicate;
 	
-		if (parent->left == this) {
-			parent->parent->rotate_right();
-			is_red = false;
-			
-		} else {
-			parent->rotate_left();
-			parent->rotate_right();
-			left->is_red = false;
-		}
+	Node *left_tree = as_root(second->replace_left(nullptr));
+	Node *right_tree = as_root(second->replace_right(nullptr));
+	delete second;
+	
+	auto [left_result, right_result] = fork_join(less, fork_depth,
+		[=]() { return set_difference(less, left_tree, fork_depth - 1); },
+		[=]() { return set_difference(greater, right_tree, fork_depth - 1); });
+	
+	Node *result = join2(left_result, right_result);
+	return result;
+}
+
+/**
+ *  @return how many levels of set operations fork, enough to give every hardware thread a subtree
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::set_operation_fork_depth() {
+	int result = 0;
+	for (unsigned threads = std::thread::hardware_concurrency() ; threads > 1 ; threads = (threads + 1) / 2) {
+		++result;
 	}
-	return;
+	return result;
 }
 
-template<typename Tval>
-void RedBlackTree<Tval>::add(const Tval& new_val) {
-	Node *highest_changed = root->add(new_val);
-	if (highest_changed->is_root()) {
-		root = highest_changed;
+/**
+ *  takes all keys of left and right, which must be less and greater than key. both end up empty.
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy> RedBlackTree<Tval, Policy>::join(RedBlackTree& left, const Tval& key, RedBlackTree& right) {
+	RedBlackTree result;
+	StatsScope counting{result.stats_counters};
+	result.root = Node::join(left.root, new Node{key}, right.root);
+	left.root = right.root = nullptr;
+	left.refresh_cached_nodes();
+	right.refresh_cached_nodes();
+	result.refresh_cached_nodes();
+	assert_expensive(result.validate());
+	return result;
+}
+
+/**
+ *  keeps the keys less than split_key and moves the keys greater than split_key to the returned tree.
+ *  split_key itself is removed.
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy> RedBlackTree<Tval, Policy>::split(const Tval& split_key, bool *found) {
+	StatsScope counting{stats_counters};
+	RedBlackTree result;
+	Node *less = nullptr;
+	Node *middle = Node::split(root, split_key, &less, &result.root);
+	root = less;
+	refresh_cached_nodes();
+	result.refresh_cached_nodes();
+	if (found) {
+		*found = middle != nullptr;
 	}
-	return;
+	delete middle;
+	assert_expensive(validate() && result.validate());
+	return result;
 }
 
-template<class T>
-void RedBlackTree<T>::Node::remove_leaf() {	
-	assert(is_leaf());
-	parent->replace_child(this, nullptr);
-	return;
+/**
+ *  removes the keys in [low, high) with two splits and one join, O(log n), then frees the k removed nodes
+ *  in one pass that does no rebalancing. with Policy::multiset all occurrences go.
+ *  @return number of keys removed
+ */
+template<typename Tval, typename Policy>
+int RedBlackTree<Tval, Policy>::erase_range(const Tval& low, const Tval& high) {
+	StatsScope counting{stats_counters};
+	if (!root || !is_less(low, high)) {
+		return 0;
+	}
+	
+	Node *less = nullptr;
+	Node *from_low = nullptr;
+	Node *low_node = Node::split(root, low, &less, &from_low);
+	Node *inside = nullptr;
+	Node *greater = nullptr;
+	Node *high_node = Node::split(from_low, high, &inside, &greater);
+	//high stays, it can be the key that joins both sides
+	root = high_node ? Node::join(less, high_node, greater) : Node::join2(less, greater);
+	refresh_cached_nodes();
+	
+	int result = 0;
+	if (low_node) {
+		delete low_node;
+		++result;
+	}
+	if (inside) {
+		result += inside->delete_subtree();
+	}
+	assert_expensive(validate());
+	return result;
 }
 
-template<typename Tval>
-void RedBlackTree<Tval>::update_root() {
-	while (root->parent) {
-		root = root->parent;
+/**
+ *  the set operations take the nodes of both arguments, which end up empty.
+ *  nodes are reused for the result or freed, no keys are copied.
+ *  fork_depth levels of the recursion may hand a half to another thread, see fork_join.
+ */
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy> RedBlackTree<Tval, Policy>::set_union(RedBlackTree& first, RedBlackTree& second, int fork_depth) {
+	RedBlackTree result;
+	StatsScope counting{result.stats_counters};
+	result.root = Node::set_union(first.root, second.root, fork_depth);
+	first.root = second.root = nullptr;
+	first.refresh_cached_nodes();
+	second.refresh_cached_nodes();
+	result.refresh_cached_nodes();
+	assert_expensive(result.validate());
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy> RedBlackTree<Tval, Policy>::set_intersection(RedBlackTree& first, RedBlackTree& second, int fork_depth) {
+	RedBlackTree result;
+	StatsScope counting{result.stats_counters};
+	result.root = Node::set_intersection(first.root, second.root, fork_depth);
+	first.root = second.root = nullptr;
+	first.refresh_cached_nodes();
+	second.refresh_cached_nodes();
+	result.refresh_cached_nodes();
+	assert_expensive(result.validate());
+	return result;
+}
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy> RedBlackTree<Tval, Policy>::set_difference(RedBlackTree& first, RedBlackTree& second, int fork_depth) {
+	RedBlackTree result;
+	StatsScope counting{result.stats_counters};
+	result.root = Node::set_difference(first.root, second.root, fork_depth);
+	first.root = second.root = nullptr;
+	first.refresh_cached_nodes();
+	second.refresh_cached_nodes();
+	result.refresh_cached_nodes();
+	assert_expensive(result.validate());
+	return result;
+}
+
+
+/**
+ *  writes the keys in ascending order with a RedBlackTreeFileHeader in front.
+ *  keys are stored as raw bytes, so Tval must be trivially copyable.
+ *  @return false if the file can't be written
+ */
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::save(const char *path) const {
+	static_assert(std::is_trivially_copyable_v<Tval>, "save writes the raw bytes of the keys");
+	
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
 	}
-	return;
+	
+	RedBlackTreeFileHeader header{};
+	memcpy(header.magic, red_black_tree_file_magic, sizeof(header.magic));
+	header.format_version = red_black_tree_file_version;
+	header.key_bytes = sizeof(Tval);
+	header.checksum = file_checksum_seed;
+	
+	//the header goes first as a placeholder, count and checksum are known at the end
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	
+	//NOTE: a multiple of 8 keys keeps every chunk a multiple of 8 bytes, as file_checksum needs
+	constexpr int chunk_keys = 8192;
+	std::vector<Tval> chunk;
+	chunk.reserve(chunk_keys);
+	auto flush = [&]() {
+		header.checksum = file_checksum(header.checksum, chunk.data(), chunk.size() * sizeof(Tval));
+		header.count += chunk.size();
+		ok = ok && fwrite(chunk.data(), sizeof(Tval), chunk.size(), file) == chunk.size();
+		chunk.clear();
+	};
+	for (const Tval& key : *this) {
+		chunk.push_back(key);
+		if ((int)chunk.size() == chunk_keys) {
+			flush();
+		}
+	}
+	flush();
+	
+	ok = ok && fseek(file, 0, SEEK_SET) == 0;
+	ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = (fclose(file) == 0) && ok;
+	return ok;
+}
+
+/**
+ *  replaces the contents with the keys of a file written by save. O(n) with assign_sorted.
+ *  @return false, leaving the tree unchanged, if the file can't be read, is of another key type or fails the checksum
+ */
+template<typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::load(const char *path) {
+	static_assert(std::is_trivially_copyable_v<Tval>, "load reads the raw bytes of the keys");
+	
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	
+	RedBlackTreeFileHeader header{};
+	bool ok = fread(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fseek(file, 0, SEEK_END) == 0;
+	long file_bytes = ok ? ftell(file) : -1;
+	ok = ok && file_bytes >= 0 && is_valid_file_header(header, sizeof(Tval), (uint64_t)file_bytes);
+	ok = ok && fseek(file, sizeof(header), SEEK_SET) == 0;
+	
+	std::vector<Tval> keys;
+	if (ok) {
+		keys.resize(header.count);
+		ok = fread(keys.data(), sizeof(Tval), keys.size(), file) == keys.size();
+	}
+	fclose(file);
+	
+	ok = ok && file_checksum(file_checksum_seed, keys.data(), keys.size() * sizeof(Tval)) == header.checksum;
+	if (!ok) {
+		return false;
+	}
+	
+	assign_sorted(keys.begin(), keys.end());
+	return true;
 }
 
 
-template <typename Tval>
-int get_shortest_path_length(typename RedBlackTree<Tval>::Node *tree) {
+template <typename Tval, typename Policy = DefaultTreePolicy>
+int get_shortest_path_length(typename RedBlackTree<Tval, Policy>::Node *tree) {
 	if (!tree) return 0;
-	int shortest = 1 + min<int>(get_shortest_path_length<Tval>(tree->left), get_shortest_path_length<Tval>(tree->right));
+	int shortest = 1 + min<int>(get_shortest_path_length<Tval, Policy>(tree->left), get_shortest_path_length<Tval, Policy>(tree->right));
 	return shortest;
 }
 
 
-template <typename Tval>
-int get_longest_path_length(typename RedBlackTree<Tval>::Node *tree) {
+template <typename Tval, typename Policy = DefaultTreePolicy>
+int get_longest_path_length(typename RedBlackTree<Tval, Policy>::Node *tree) {
 	
 	if (!tree) return 0;
-	int longest = 1 + max<int>(get_longest_path_length<Tval>(tree->left), get_longest_path_length<Tval>(tree->right));
+	int longest = 1 + max<int>(get_longest_path_length<Tval, Policy>(tree->left), get_longest_path_length<Tval, Policy>(tree->right));
 	
 	return longest;	
 }
 
-template <typename Tval>
-int black_height(typename RedBlackTree<Tval>::Node *tree) {
+template <typename Tval, typename Policy = DefaultTreePolicy>
+int black_height(typename RedBlackTree<Tval, Policy>::Node *tree) {
 	//NOTE(Gerald): empty children of a red node count as black. but an empty tree has height 0.
 	//thus, this will give the wrong result for empty trees.
 	//to fix this we could make this a member function. then we can test for parent != null.
 	int result = 1; 
 	if (!tree) return result;
 	result = tree->is_red ? 0 : 1;
-	result += max<int>(black_height(tree->left), black_height(tree->right));
+	result += max<int>(black_height<Tval, Policy>(tree->left), black_height<Tval, Policy>(tree->right));
 		
 	return result;
 }
 
-template <typename Tval>
-bool RedBlackTree<Tval>::Node::is_black() {	
+template <typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::Node::is_black() {	
 	bool result = !is_red;
 	return result;
 }
 	
-template <typename Tval>
-int count_children(typename RedBlackTree<Tval>::Node *tree) {
+template <typename Tval, typename Policy = DefaultTreePolicy>
+int count_children(typename RedBlackTree<Tval, Policy>::Node *tree) {
 	//counts only non-empty children
 	int result = 0;
 	
@@ -683,36 +2536,142 @@ int count_children(typename RedBlackTree<Tval>::Node *tree) {
 	return result;
 }	
 
-template <typename Tval>
-//the name is misleading. the argument implies as much. the point is to check for validity
-//TODO(Gerald, 2025 03 19): this function has multiple issues. revise.
-bool is_red_black_tree(typename RedBlackTree<Tval>::Node *tree) {
+/**
+ *  checks a subtree in one post-order pass with an explicit stack, O(n) time and O(height) space:
+ *  keys strictly ascending in order, parent links, no red child under a red node, equal black height
+ *  on every path, no red right child (if left_leaning), and the cached sizes and aggregates the policy keeps.
+ *  the subtree's root may have a parent and be red, RedBlackTree::validate checks those for a whole tree.
+ */
+template <typename Tval, typename Policy = DefaultTreePolicy>
+RedBlackTreeValidation validate_red_black_tree(const typename RedBlackTree<Tval, Policy>::Node *tree, bool left_leaning = true) {
+	using Tree = RedBlackTree<Tval, Policy>;
+	using Node = typename Tree::Node;
+	
+	struct Pending {
+		const Node *node;
+		bool children_done;
+	};
+	//black height and count of each finished subtree whose parent isn't finished yet
+	struct Done {
+		int black_height;
+		int count;
+	};
 	
-	bool result = true;
+	RedBlackTreeValidation result;
+	std::vector<Pending> pending;
+	std::vector<Done> done;
+	const Node *previous = nullptr; //in order
 	
-	//NOTE(Gerald, 2025 03 19): why, when we check black_height? why only in the root?
-	if (tree->is_red) {
-		result &= tree->left  ? !tree->left->is_red  : true;
-		result &= tree->right ? !tree->right->is_red : true;
-	}
-
-	result &= black_height(tree->left) == black_height(tree->right);
+	auto fail = [&](const Node *node, const char *failure) {
+		result.failure = failure;
+		result.node = node;
+	};
+	
+	//NOTE: a node goes on the stack twice: on the way down, and after its children to be checked
+	auto descend_left = [&](const Node *node) {
+		for ( ; node ; node = node->left) {
+			pending.push_back(Pending{node, false});
+		}
+		//the stack holds the path from the root
+		result.height = std::max(result.height, (int)pending.size());
+	};
+	descend_left(tree);
 	
-	//NOTE(Gerald, 2025 03 19): redundant?
-	if (is_black(tree) && count_children(tree) == 1) {
-		result &= is_red(tree->left) || is_red(tree->right);
+	while (!pending.empty() && !result.failure) {
+		Pending& top = pending.back();
+		const Node *node = top.node;
+		
+		if (!top.children_done) {
+			//the left subtree is finished, this is the node's turn in order
+			if (previous && !Tree::is_less(previous->key, node->key)) {
+				fail(node, "keys out of order");
+				break;
+			}
+			previous = node;
+			top.children_done = true;
+			descend_left(node->right);
+			continue;
+		}
+		pending.pop_back();
+		
+		Done right = node->right ? done.back() : Done{0, 0};
+		if (node->right) done.pop_back();
+		Done left = node->left ? done.back() : Done{0, 0};
+		if (node->left) done.pop_back();
+		
+		if ((node->left && node->left->parent != node) || (node->right && node->right->parent != node)) {
+			fail(node, "child's parent link doesn't point back");
+		} else if (node->is_red && ((node->left && node->left->is_red) || (node->right && node->right->is_red))) {
+			fail(node, "red node with a red child");
+		} else if (left_leaning && node->right && node->right->is_red) {
+			fail(node, "red right child");
+		} else if (left.black_height != right.black_height) {
+			fail(node, "black heights of the subtrees differ");
+		}
+		if constexpr (Policy::track_size) {
+			if (!result.failure && node->subtree_size != 1 + left.count + right.count) {
+				fail(node, "subtree_size is stale");
+			}
+		}
+		if constexpr (Tree::has_augment) {
+			using Augment = typename Policy::Augment;
+			auto expected = Augment::from_key(node->key);
+			if (node->left) expected = Augment::combine(node->left->aggregate, expected);
+			if (node->right) expected = Augment::combine(expected, node->right->aggregate);
+			if (!result.failure && !(node->aggregate == expected)) {
+				fail(node, "aggregate is stale");
+			}
+		}
+		
+		done.push_back(Done{left.black_height + (node->is_red ? 0 : 1), 1 + left.count + right.count});
 	}
 	
+	if (!result.failure && !done.empty()) {
+		result.black_height = done.back().black_height;
+		result.count = done.back().count;
+	}
 	return result;
 }
 
+/**
+ *  any red-black tree, not only left-leaning ones. see validate_red_black_tree
+ */
+template <typename Tval, typename Policy = DefaultTreePolicy>
+bool is_red_black_tree(typename RedBlackTree<Tval, Policy>::Node *tree) {
+	bool result = (bool)validate_red_black_tree<Tval, Policy>(tree, false);
+	return result;
+}
+
+/**
+ *  validate_red_black_tree on the whole tree, plus: the root is black and has no parent, first_node and last_node are current
+ */
+template <typename Tval, typename Policy>
+RedBlackTreeValidation RedBlackTree<Tval, Policy>::validate() const {
+	RedBlackTreeValidation result;
+	if (root && root->parent) {
+		result.failure = "root has a parent";
+		result.node = root;
+	} else if (root && root->is_red) {
+		result.failure = "root is red";
+		result.node = root;
+	} else {
+		result = validate_red_black_tree<Tval, Policy>(root);
+	}
+	//after the shape: a tree built by hand breaks a rule of the shape before its cached nodes
+	if (result && (first_node != (root ? root->leftmost() : nullptr) || last_node != (root ? root->rightmost() : nullptr))) {
+		result.failure = "cached first or last node is stale";
+		result.node = first_node;
+	}
+	return result;
+}
 
 
 
 
-template<typename Tval>
-RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::replace_child(typename RedBlackTree<Tval>::Node *old_child, typename RedBlackTree<Tval>::Node *new_child) {
-	RedBlackTree<Tval>::Node *replaced = nullptr;
+
+template<typename Tval, typename Policy>
+RedBlackTree<Tval, Policy>::Node *RedBlackTree<Tval, Policy>::Node::replace_child(typename RedBlackTree<Tval, Policy>::Node *old_child, typename RedBlackTree<Tval, Policy>::Node *new_child) {
+	RedBlackTree<Tval, Policy>::Node *replaced = nullptr;
 	
 	if (left == old_child) {
 		replaced = replace_left(new_child);
@@ -724,9 +2683,9 @@ RedBlackTree<Tval>::Node *RedBlackTree<Tval>::Node::replace_child(typename RedBl
 	return replaced;
 }
 
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::replace_right(RedBlackTree<T>::Node *new_right) {
-	RedBlackTree<T>::Node *old_right = right;	
+template<class T, typename Policy>
+RedBlackTree<T, Policy>::Node *RedBlackTree<T, Policy>::Node::replace_right(RedBlackTree<T, Policy>::Node *new_right) {
+	RedBlackTree<T, Policy>::Node *old_right = right;	
 	right = new_right;
 	if (right) {
 		right->parent = this;
@@ -735,9 +2694,9 @@ RedBlackTree<T>::Node *RedBlackTree<T>::Node::replace_right(RedBlackTree<T>::Nod
 }
 
 
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::replace_left(RedBlackTree<T>::Node *new_left) {
-	RedBlackTree<T>::Node *old_left = left;
+template<class T, typename Policy>
+RedBlackTree<T, Policy>::Node *RedBlackTree<T, Policy>::Node::replace_left(RedBlackTree<T, Policy>::Node *new_left) {
+	RedBlackTree<T, Policy>::Node *old_left = left;
 	
 	left = new_left;
 	if (left) {
@@ -747,152 +2706,21 @@ RedBlackTree<T>::Node *RedBlackTree<T>::Node::replace_left(RedBlackTree<T>::Node
 	return old_left;
 }
 
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::shift_right() {
-	assert(left && left->is_3_node() && right && right->is_2_node());	
-	
-	Node *replacement = left;
-	rotate_right();
-	
-	assert(parent->left->is_red);
-	parent->left->is_red = false;
-	
-	rotate_left();
-	
-	if (is_black()) {
-		is_red = true;
-	} else {
-		assert(parent->parent->is_black());
-		parent->parent->is_red = true;
-	}
-	
-	return replacement;	
-}
-
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::shift_left() {
-	assert(left && left->is_2_node() && right && right->is_3_node());
-	
-	
-	right->rotate_right();
-	rotate_left();
-	Node *replacement = parent;
-	assert(parent->is_red && left->is_black());
-	left->is_red = true;
-	
-	assert(parent->is_red);
-	if (is_red) {
-		is_red = false;
-	} else {
-		parent->is_red = false;
-	}
-	
-	
-	return replacement;	
-}
-
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::shift() {
-	assert(left && right);
-	Node *replacement = nullptr;
-	
-	if (left->is_2_node()) {
-		replacement = shift_left();
-	} else {
-		replacement = shift_right();
-	}
-	
-	return replacement;
-}
-
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::far_shift() {
-	//supposed to solve a specific case
-	assert(left && right && left->right && left->right->left);
-	assert(left->is_red && left->right->left->is_red);
-	left->rotate_left();
-	left->left->right->is_red = false;
-	rotate_right(); //become the right child of my left child.
-	Node *replacement = parent;
-	rotate_left();
-	is_red = true;
-	
-	return replacement;
-}
-
-
-template<class T>
-void RedBlackTree<T>::Node::squash() {
-	assert(left && left->is_2_node() && right && right->is_2_node());
-	left->is_red = right->is_red = true;
-	is_red = false;
-	return;
-}
-
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::far_squash() {
-	assert(left && right);
-	
-	rotate_right();
-	squash();	
-	
-	assert(parent->is_red);
-	parent->is_red = false;
-	
-	Node *replacement = parent;
-	
-	return replacement;
-}
-
-template<class T>
-RedBlackTree<T>::Node *RedBlackTree<T>::Node::get_nearest(T target_key) {
-	if (target_key == key) {
-		return this;
-	} else if (target_key < key) {
-		return left ? left : this;
-	} else { //target_key > key
-		return right ? right : this;
-	}
-}
-
-
-template<class T>
-void RedBlackTree<T>::Node::make_3_4_node() {
-	if (is_3_node() || is_red) {
-		return;
-	}
-	
-	Node *sibling = get_sibling();
-	if (sibling && sibling->is_black() && sibling->is_2_node() ) {
-			parent->squash();
-	} else if (parent->is_red) {
-			parent->shift();
-	} else { // parent is black
-		// i am black right child of 3-node
-		if (get_far_sibling()->is_2_node()) {
-			parent->far_squash();
-		} else {
-			parent->far_shift();
-		}
-	}
-	return;
-}
-
-
-
-template<class T>
-void RedBlackTree<T>::Node::debug_add_left(T new_val, bool set_red) {
+template<class T, typename Policy>
+void RedBlackTree<T, Policy>::Node::debug_add_left(T new_val, bool set_red) {
 	left = new Node{new_val};
 	left->parent = this;
 	left->is_red = set_red;
+	refresh_upwards();
 	return;
 }
 
-template<class T>
-void RedBlackTree<T>::Node::debug_add_right(T new_val, bool set_red) {
+template<class T, typename Policy>
+void RedBlackTree<T, Policy>::Node::debug_add_right(T new_val, bool set_red) {
 	right = new Node{new_val};
 	right->parent = this;
 	right->is_red = set_red;
+	refresh_upwards();
 	return;
 }
 
@@ -907,9 +2735,9 @@ void print(Tval key) {
 }
 
 
-template <typename Tval> 
-void print(typename RedBlackTree<Tval>::Node *tree) {
-	print_red_black_tree_node<Tval>(tree);
+template <typename Tval, typename Policy = DefaultTreePolicy> 
+void print(typename RedBlackTree<Tval, Policy>::Node *tree) {
+	print_red_black_tree_node<Tval, Policy>(tree);
 }
 
 template <> void print(char c) {
@@ -920,9 +2748,9 @@ template <> void print(int i) {
 	printf("%d",i);
 }
 
-template <typename Tval>
-void print(RedBlackTree<Tval> *tree) {
-	print_red_black_tree_node<Tval>(tree->root);
+template <typename Tval, typename Policy = DefaultTreePolicy>
+void print(RedBlackTree<Tval, Policy> *tree) {
+	print_red_black_tree_node<Tval, Policy>(tree->root);
 }
 
 
@@ -979,8 +2807,8 @@ template<class T> bool StringBuffer::put(T value) {
 	return false;
 }
 
-template <class Tval>
-bool traverse_and_print_nodes_to(StringBuffer *buf, typename RedBlackTree<Tval>::Node *tree, int indent = 0) {
+template <class Tval, typename Policy = DefaultTreePolicy>
+bool traverse_and_print_nodes_to(StringBuffer *buf, typename RedBlackTree<Tval, Policy>::Node *tree, int indent = 0) {
 	if (!tree) {
 		return true;
 	}
@@ -1004,8 +2832,8 @@ bool traverse_and_print_nodes_to(StringBuffer *buf, typename RedBlackTree<Tval>:
 	no_errors &= buf->put(tree->key);
 	no_errors &= buf->put('\n');
 	
-	if (!buf->full()) no_errors &= traverse_and_print_nodes_to<Tval>(buf, tree->left, indent+1);
-	if (!buf->full()) no_errors &= traverse_and_print_nodes_to<Tval>(buf, tree->right, indent+1);
+	if (!buf->full()) no_errors &= traverse_and_print_nodes_to<Tval, Policy>(buf, tree->left, indent+1);
+	if (!buf->full()) no_errors &= traverse_and_print_nodes_to<Tval, Policy>(buf, tree->right, indent+1);
 	
 	return no_errors;
 }
@@ -1013,7 +2841,8 @@ bool traverse_and_print_nodes_to(StringBuffer *buf, typename RedBlackTree<Tval>:
 template <> bool StringBuffer::put(char c) {	
 	char *buf_mem = get_buf();
 	if (buf_mem) {
-		sprintf(buf_mem, "%c", c);
+		//NOTE: the buffer starts zeroed, so it stays null-terminated
+		*buf_mem = c;
 		modify_fill(1);
 		return true;
 	}		
@@ -1052,17 +2881,170 @@ template <> bool StringBuffer::put(int i) {
 }
 
 
-template <typename Tval>
-bool RedBlackTree<Tval>::to_string(char *out, int size){
+/*
+  buffered output for dumps of large trees. collects output in a chunk and hands it on when the chunk is full:
+  with large write() calls to a file descriptor, or appended to a string. numbers are formatted with std::to_chars.
+*/
+struct DumpWriter {
+	static constexpr size_t chunk_bytes = 1 << 20;
 	
-	StringBuffer buf{size};
+	std::vector<char> chunk;
+	size_t fill = 0;
+	int fd = -1;
+	std::string *text = nullptr;
+	bool ok = true;
 	
-	bool fits = traverse_and_print_nodes_to<Tval>(&buf, root);
+	explicit DumpWriter(int fd_)
+	:chunk(chunk_bytes), fd{fd_}
+	{}
 	
-	if (fits) {
-		for (char *src = buf.base, *dst = out ; src <= buf.base+buf.fill ; ++src, ++dst) {
-			*dst = *src;
+	explicit DumpWriter(std::string *text_)
+	:chunk(chunk_bytes), text{text_}
+	{}
+	
+	DumpWriter(const DumpWriter&) = delete;
+	DumpWriter& operator=(const DumpWriter&) = delete;
+	
+	~DumpWriter() {
+		flush();
+	}
+	
+	char *reserve(size_t bytes) {
+		if (chunk.size() - fill < bytes) {
+			flush();
+			if (chunk.size() < bytes) {
+				chunk.resize(bytes);
+			}
+		}
+		return chunk.data() + fill;
+	}
+	
+	void put(char c) {
+		*reserve(1) = c;
+		++fill;
+	}
+	
+	void put(char c, int count) {
+		if (count > 0) {
+			memset(reserve(count), c, count);
+			fill += count;
+		}
+	}
+	
+	void put(std::string_view bytes) {
+		memcpy(reserve(bytes.size()), bytes.data(), bytes.size());
+		fill += bytes.size();
+	}
+	
+	template<typename T>
+	void put_key(const T& key);
+	
+	bool flush();
+};
+
+/**
+ *  chars go out as they are, other numbers through std::to_chars, anything else must convert to std::string_view
+ */
+template<typename T>
+void DumpWriter::put_key(const T& key) {
+	if constexpr (std::is_same_v<T, char>) {
+		put(key);
+	} else if constexpr (std::is_arithmetic_v<T>) {
+		constexpr size_t max_bytes = 64;
+		char *start = reserve(max_bytes);
+		std::to_chars_result result = std::to_chars(start, start + max_bytes, key);
+		fill += result.ptr - start;
+	} else {
+		put(std::string_view{key});
+	}
+	return;
+}
+
+/**
+ *  @return false if any write so far failed
+ */
+inline bool DumpWriter::flush() {
+	if (text) {
+		text->append(chunk.data(), fill);
+	} else {
+		size_t written = 0;
+		while (ok && written < fill) {
+			ssize_t result = write(fd, chunk.data() + written, fill - written);
+			if (result < 0 && errno != EINTR) {
+				ok = false;
+			}
+			written += result > 0 ? result : 0;
+		}
+	}
+	fill = 0;
+	return ok;
+}
+
+/**
+ *  writes the tree in the format of print_red_black_tree_node, one key per line in preorder:
+ *  indented by depth, '|' below the root, '*' before red keys.
+ *  walks with an explicit stack, so the depth is not limited by the call stack.
+ */
+template <typename Tval, typename Policy = DefaultTreePolicy>
+void dump_red_black_tree_node(DumpWriter& out, const typename RedBlackTree<Tval, Policy>::Node *tree) {
+	using Node = typename RedBlackTree<Tval, Policy>::Node;
+	std::vector<std::pair<const Node *, int>> pending;
+	if (tree) {
+		pending.emplace_back(tree, 0);
+	}
+	while (!pending.empty()) {
+		auto [node, indent] = pending.back();
+		pending.pop_back();
+		
+		out.put(' ', indent - 1);
+		if (indent != 0) {
+			out.put('|');
 		}
+		if (node->is_red) {
+			out.put('*');
+		}
+		out.put_key(node->key);
+		out.put('\n');
+		
+		//the left subtree comes first
+		if (node->right) pending.emplace_back(node->right, indent + 1);
+		if (node->left) pending.emplace_back(node->left, indent + 1);
+	}
+	return;
+}
+
+template <typename Tval, typename Policy>
+std::string RedBlackTree<Tval, Policy>::dump() const {
+	std::string result;
+	{
+		DumpWriter out{&result};
+		dump_red_black_tree_node<Tval, Policy>(out, root);
+	}
+	return result;
+}
+
+/**
+ *  @return false if writing to fd failed
+ */
+template <typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::dump(int fd) const {
+	DumpWriter out{fd};
+	dump_red_black_tree_node<Tval, Policy>(out, root);
+	bool result = out.flush();
+	return result;
+}
+
+/**
+ *  copies the dump with its terminating null into out.
+ *  @return false, leaving out unchanged, if it needs more than size chars
+ */
+template <typename Tval, typename Policy>
+bool RedBlackTree<Tval, Policy>::to_string(char *out, int size){
+	std::string text = dump();
+	
+	bool fits = (long long)text.size() < size;
+	if (fits) {
+		memcpy(out, text.c_str(), text.size() + 1);
 	}
 	
 	return fits;
@@ -1079,8 +3061,8 @@ bool RedBlackTree<Tval>::to_string(char *out, int size){
   |5
 |-5
 */
-template <typename Tval>
-void print_red_black_tree_node(typename RedBlackTree<Tval>::Node *tree, int indent = 0) {
+template <typename Tval, typename Policy = DefaultTreePolicy>
+void print_red_black_tree_node(typename RedBlackTree<Tval, Policy>::Node *tree, int indent = 0) {
 	if (!tree) {
 		return;
 	}
@@ -1099,18 +3081,26 @@ void print_red_black_tree_node(typename RedBlackTree<Tval>::Node *tree, int inde
 	print(tree->key);
 	print('\n');
 	
-	print_red_black_tree_node<Tval>(tree->left, indent+1);
-	print_red_black_tree_node<Tval>(tree->right, indent+1);
+	print_red_black_tree_node<Tval, Policy>(tree->left, indent+1);
+	print_red_black_tree_node<Tval, Policy>(tree->right, indent+1);
 	
 	return;
 }
 
-template <class T>
-RedBlackTree<T> rb_from_keys(T *keys, int count) {
-	RedBlackTree<T> rb{keys[0]};
+template <class T, typename Policy = DefaultTreePolicy>
+RedBlackTree<T, Policy> rb_from_keys(T *keys, int count) {
+	RedBlackTree<T, Policy> rb{keys[0]};
 	for (int i = 1 ; i < count ; ++i) {
 		rb.add(keys[i]);
 	}
 	
 	return rb;
-}
\ No newline at end of file
+}
+
+template <class T, typename Policy = DefaultTreePolicy>
+RedBlackTree<T, Policy> rb_from_sorted_keys(T *keys, int count) {
+	RedBlackTree<T, Policy> rb{keys, keys + count};
+	return rb;
+}
+
+#endif //RED_BLACK_TREE_H
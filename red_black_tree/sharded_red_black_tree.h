@@ -0,0 +1,289 @@
+#ifndef SHARDED_RED_BLACK_TREE_H
+#define SHARDED_RED_BLACK_TREE_H
+
+#include "red_black_tree.h"
+
+#include<atomic>
+#include<mutex>
+#include<memory>
+#include<optional>
+#include<vector>
+
+/*
+  ordered set for many writing threads. the key space is cut into ranges, each range is a shard:
+  a RedBlackTree behind its own lock, so writes to different shards run in parallel.
+
+  a shard that takes many writes splits in two at its root key, so the boundaries follow the load.
+  the table of boundaries (the layout) is never changed in place: a split publishes a new one with an
+  atomic store, and operations find their shard without taking any shared lock. a shard knows its own range,
+  an operation that picked a shard from an older layout notices after locking it and looks again.
+  shards and old layouts live until the set is destroyed, there are at most max_shards of them.
+
+  scans visit the shards in key order, each one under its lock. keys that stay in the set during
+  a scan are all visited, keys added or removed meanwhile may or may not be.
+*/
+template<typename Tval, typename Policy = DefaultTreePolicy>
+struct ShardedRedBlackTree {
+	using Tree = RedBlackTree<Tval, Policy>;
+	static_assert(!Policy::multiset, "a split moves one copy of its key to the upper shard");
+
+	static constexpr int max_shards = 256;
+	//a shard considers splitting after this many writes since it last did
+	static constexpr int split_check_writes = 4096;
+	//and splits only if it holds at least this many keys
+	static constexpr int min_split_keys = 1024;
+
+	//own cache line, so that locking one shard doesn't slow down writers of its neighbours
+	struct alignas(64) Shard {
+		std::mutex lock;
+		Tree tree;
+		//the shard holds keys in [low, high). the first shard has no low bound, the last no high bound
+		std::optional<Tval> low;
+		std::optional<Tval> high;
+		std::atomic<int> key_count{0};
+		int writes_since_split = 0;
+
+		bool covers(const Tval& key) const {
+			bool result = (!low || !Tree::is_less(key, *low)) && (!high || Tree::is_less(key, *high));
+			return result;
+		}
+
+		~Shard() {
+			tree.clear();
+		}
+	};
+
+	struct Layout {
+		std::vector<Tval> lower_keys; //lower_keys[i] is the low bound of shards[i + 1]
+		std::vector<Shard *> shards;
+
+		Shard *shard_for(const Tval& key) const {
+			auto found = std::upper_bound(lower_keys.begin(), lower_keys.end(), key, [](const Tval& a, const Tval& b) {
+				return Tree::is_less(a, b);
+			});
+			return shards[found - lower_keys.begin()];
+		}
+	};
+
+	std::atomic<Layout *> layout{nullptr};
+
+	//serializes splits. taken while holding the lock of the shard that splits, never the other way round
+	std::mutex split_lock;
+	std::vector<std::unique_ptr<Shard>> all_shards;
+	std::vector<std::unique_ptr<Layout>> all_layouts;
+
+	bool add(const Tval& new_val);
+	bool remove(const Tval& target_key);
+	bool contains(const Tval& target_key);
+	std::optional<Tval> lower_bound(const Tval& target_key);
+	int size() const;
+	int shard_count() const { return (int)layout.load(std::memory_order_acquire)->shards.size(); }
+
+	//visit(key) in ascending order, under the lock of the key's shard: visit must not use this set
+	template<typename F>
+	void for_each(F&& visit) { scan_from(nullptr, nullptr, visit); }
+	//keys in [low, high)
+	template<typename F>
+	void scan(const Tval& low, const Tval& high, F&& visit) { scan_from(&low, &high, visit); }
+
+	template<typename F>
+	void scan_from(const Tval *low, const Tval *high, F& visit);
+	Shard *lock_shard_for(const Tval& key);
+	void split(Shard *shard);
+
+	//starts with one shard, or with one per range between the given ascending boundaries
+	explicit ShardedRedBlackTree(std::span<const Tval> boundaries = {});
+
+	ShardedRedBlackTree(const ShardedRedBlackTree&) = delete;
+	ShardedRedBlackTree& operator=(const ShardedRedBlackTree&) = delete;
+};
+
+
+template<typename Tval, typename Policy>
+ShardedRedBlackTree<Tval, Policy>::ShardedRedBlackTree(std::span<const Tval> boundaries) {
+	auto first = std::make_unique<Layout>();
+	for (int i = 0 ; i <= (int)boundaries.size() ; ++i) {
+		all_shards.push_back(std::make_unique<Shard>());
+		Shard *shard = all_shards.back().get();
+		if (i > 0) {
+			shard->low = boundaries[i - 1];
+			first->lower_keys.push_back(boundaries[i - 1]);
+		}
+		if (i < (int)boundaries.size()) {
+			shard->high = boundaries[i];
+		}
+		first->shards.push_back(shard);
+	}
+	layout.store(first.get(), std::memory_order_release);
+	all_layouts.push_back(std::move(first));
+}
+
+/**
+ *  @return the locked shard whose range covers key
+ */
+template<typename Tval, typename Policy>
+ShardedRedBlackTree<Tval, Policy>::Shard *ShardedRedBlackTree<Tval, Policy>::lock_shard_for(const Tval& key) {
+	while (true) {
+		Shard *shard = layout.load(std::memory_order_acquire)->shard_for(key);
+		shard->lock.lock();
+		if (shard->covers(key)) {
+			return shard;
+		}
+		//split since we loaded the layout, the new one is published by now
+		shard->lock.unlock();
+	}
+}
+
+/**
+ *  @return false if new_val already exists
+ */
+template<typename Tval, typename Policy>
+bool ShardedRedBlackTree<Tval, Policy>::add(const Tval& new_val) {
+	Shard *shard = lock_shard_for(new_val);
+	bool added = shard->tree.insert_below(shard->tree.root, new_val) != nullptr;
+	if (added) {
+		shard->key_count.fetch_add(1, std::memory_order_relaxed);
+		if (++shard->writes_since_split >= split_check_writes) {
+			split(shard);
+		}
+	}
+	shard->lock.unlock();
+	return added;
+}
+
+/**
+ *  @return false if target_key doesn't exist
+ */
+template<typename Tval, typename Policy>
+bool ShardedRedBlackTree<Tval, Policy>::remove(const Tval& target_key) {
+	Shard *shard = lock_shard_for(target_key);
+	//NOTE: finds the key first, so an absent key costs one lookup
+	typename Tree::Node *removed = shard->tree.remove_bottom_up(target_key);
+	if (removed) {
+		shard->key_count.fetch_sub(1, std::memory_order_relaxed);
+		++shard->writes_since_split;
+		delete removed;
+	}
+	shard->lock.unlock();
+	return removed != nullptr;
+}
+
+template<typename Tval, typename Policy>
+bool ShardedRedBlackTree<Tval, Policy>::contains(const Tval& target_key) {
+	Shard *shard = lock_shard_for(target_key);
+	bool result = shard->tree.find(target_key) != shard->tree.end();
+	shard->lock.unlock();
+	return result;
+}
+
+/**
+ *  @return the smallest key not less than target_key, possibly from a later shard
+ */
+template<typename Tval, typename Policy>
+std::optional<Tval> ShardedRedBlackTree<Tval, Policy>::lower_bound(const Tval& target_key) {
+	std::optional<Tval> result;
+	auto take_first = [&](const Tval& key) {
+		if (!result) {
+			result = key;
+		}
+	};
+	scan_from(&target_key, nullptr, take_first);
+	return result;
+}
+
+template<typename Tval, typename Policy>
+int ShardedRedBlackTree<Tval, Policy>::size() const {
+	int result = 0;
+	for (Shard *shard : layout.load(std::memory_order_acquire)->shards) {
+		result += shard->key_count.load(std::memory_order_relaxed);
+	}
+	return result;
+}
+
+/**
+ *  walks from shard to shard along their ranges rather than along one layout,
+ *  so a split during the scan can't hide the keys it moves
+ */
+template<typename Tval, typename Policy>
+template<typename F>
+void ShardedRedBlackTree<Tval, Policy>::scan_from(const Tval *low, const Tval *high, F& visit) {
+	std::optional<Tval> cursor;
+	if (low) {
+		cursor = *low;
+	}
+
+	while (true) {
+		Shard *shard = nullptr;
+		if (cursor) {
+			shard = lock_shard_for(*cursor);
+		} else {
+			//the first shard never splits away its low end
+			shard = layout.load(std::memory_order_acquire)->shards.front();
+			shard->lock.lock();
+		}
+
+		bool done = false;
+		auto key = cursor ? shard->tree.lower_bound(*cursor) : shard->tree.begin();
+		for ( ; key != shard->tree.end() ; ++key) {
+			if (high && !Tree::is_less(*key, *high)) {
+				done = true;
+				break;
+			}
+			visit(*key);
+		}
+
+		std::optional<Tval> next = shard->high;
+		shard->lock.unlock();
+		if (done || !next || (high && !Tree::is_less(*next, *high))) {
+			break;
+		}
+		cursor = next;
+	}
+	return;
+}
+
+/**
+ *  moves the upper half of a hot shard to a new shard. the caller holds shard->lock
+ */
+template<typename Tval, typename Policy>
+void ShardedRedBlackTree<Tval, Policy>::split(Shard *shard) {
+	shard->writes_since_split = 0;
+	if (shard->key_count.load(std::memory_order_relaxed) < min_split_keys) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard{split_lock};
+	const Layout *current = layout.load(std::memory_order_acquire);
+	if ((int)current->shards.size() >= max_shards) {
+		return;
+	}
+
+	//the root's key splits a balanced tree roughly in half, and costs no search
+	Tval split_key = shard->tree.root->key;
+	auto upper = std::make_unique<Shard>();
+	bool found = false;
+	upper->tree = shard->tree.split(split_key, &found);
+	if (found) {
+		upper->tree.add(split_key);
+	}
+	upper->low = split_key;
+	upper->high = shard->high;
+	shard->high = split_key;
+
+	int moved = upper->tree.size();
+	upper->key_count.store(moved, std::memory_order_relaxed);
+	shard->key_count.fetch_sub(moved, std::memory_order_relaxed);
+
+	auto next = std::make_unique<Layout>(*current);
+	int index = int(std::find(next->shards.begin(), next->shards.end(), shard) - next->shards.begin());
+	next->shards.insert(next->shards.begin() + index + 1, upper.get());
+	next->lower_keys.insert(next->lower_keys.begin() + index, split_key);
+
+	//NOTE: publish before unlocking the shard, whoever finds split_key out of its range must see the new layout
+	layout.store(next.get(), std::memory_order_release);
+	all_shards.push_back(std::move(upper));
+	all_layouts.push_back(std::move(next));
+	return;
+}
+
+#endif //SHARDED_RED_BLACK_TREE_H